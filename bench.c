@@ -0,0 +1,502 @@
+
+#include "common.h"
+
+#include <time.h>
+
+#define LISP_BENCH_FILE stdout
+
+#ifndef LISP_BENCH_WARMUP
+#define LISP_BENCH_WARMUP 1
+#endif
+
+typedef void (*BenchFun)(void * data, U64 ops);
+
+static F64 bench_now()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (F64) ts.tv_sec + (F64) ts.tv_nsec * 1e-9;
+}
+
+static size_t bench_file_size(char const * path)
+{
+    FILE * file = fopen(path, "rb");
+    if (!file)
+    {
+        LISP_FAIL("cannot open %s\n", path);
+    }
+    fseek(file, 0, SEEK_END);
+    long const size = ftell(file);
+    fclose(file);
+    return (size_t) size;
+}
+
+static int bench_compare(void const * a, void const * b)
+{
+    F64 const x = *(F64 const *) a;
+    F64 const y = *(F64 const *) b;
+    return (x > y) - (x < y);
+}
+
+/* runs fun over ops operations, once to warm up and then reps timed
+   times, and writes one json line with the per op median, p99 and min.
+   pending collections are part of the timing, and allocs counts the
+   objects the collector manages. */
+static void bench_run(char const * name, U64 size, BenchFun fun, void * data, U64 ops, int reps)
+{
+    LISP_ASSERT(ops > 0 && reps > 0);
+    F64 * samples = (F64 *) LISP_MALLOC(sizeof(F64) * (size_t) reps);
+    if (!samples)
+    {
+        LISP_FAIL("bench allocation failed\n");
+    }
+
+    for (int i = 0; i < LISP_BENCH_WARMUP; i++)
+    {
+        fun(data, ops);
+        gc_maybe_collect();
+    }
+
+    U64 const allocs = lisp_cons_total_allocs(&global.cons);
+    for (int i = 0; i < reps; i++)
+    {
+        F64 const start = bench_now();
+        fun(data, ops);
+        gc_maybe_collect();
+        samples[i] = (bench_now() - start) * 1e9 / (F64) ops;
+    }
+    F64 const allocs_per_op = (F64) (lisp_cons_total_allocs(&global.cons) - allocs) / ((F64) ops * reps);
+
+    qsort(samples, (size_t) reps, sizeof(F64), bench_compare);
+    /* nearest rank */
+    int const p99 = (99 * reps + 99) / 100 - 1;
+
+    fprintf(LISP_BENCH_FILE,
+            "{\"name\": \"%s\", \"size\": %" PRIu64 ", \"ops\": %" PRIu64 ", \"reps\": %d, "
+            "\"median_ns\": %.2f, \"p99_ns\": %.2f, \"min_ns\": %.2f, \"allocs\": %.2f}\n",
+            name, size, ops, reps, samples[reps / 2], samples[p99], samples[0], allocs_per_op);
+    fflush(LISP_BENCH_FILE);
+
+    LISP_FREE(samples);
+}
+
+/* writes about size bytes of top-level forms that are cheap to evaluate,
+   so that load_file time is dominated by reading */
+void bench_generate_source(char const * path, size_t size)
+{
+    FILE * file = fopen(path, "wb");
+    if (!file)
+    {
+        LISP_FAIL("cannot open %s\n", path);
+    }
+
+    size_t written = 0;
+    for (U64 i = 0; written < size; i++)
+    {
+        int const len = fprintf(file,
+                                "; form %" PRIu64 "\n"
+                                "(def item-%" PRIu64 " '(alpha beta (gamma delta) zero-one-two\n"
+                                "    (epsilon . zeta) eta theta iota kappa lambda-%" PRIu64 "))\n",
+                                i, i % 16, i % 64);
+        written += (size_t) len;
+    }
+
+    fclose(file);
+}
+
+/* files, per byte */
+
+typedef struct
+{
+    char const * path;
+    Expr env;
+} BenchFile;
+
+static void bench_load_file_run(void * data, U64 ops)
+{
+    BenchFile * file = (BenchFile *) data;
+    load_file(file->path, file->env);
+}
+
+void bench_load_file(char const * path, int reps)
+{
+    size_t const size = bench_file_size(path);
+    BenchFile file = { path, make_core_env() };
+    gc_push_root(&file.env);
+    bench_run("load_file", size, bench_load_file_run, &file, size, reps);
+    gc_pop_roots(1);
+}
+
+static void bench_read_file_run(void * data, U64 ops)
+{
+    BenchFile * file = (BenchFile *) data;
+    read_file(file->path);
+}
+
+/* reads the top-level forms of a file without evaluating them */
+void bench_read_file(char const * path, int reps)
+{
+    size_t const size = bench_file_size(path);
+    BenchFile file = { path, nil };
+    bench_run("read_file", size, bench_read_file_run, &file, size, reps);
+}
+
+/* conses */
+
+static void bench_cons_run(void * data, U64 ops)
+{
+    Expr list = nil;
+    for (U64 i = 0; i < ops; i++)
+    {
+        list = cons(make_fixnum((I64) i), list);
+    }
+}
+
+/* allocates garbage conses while live conses stay reachable, which is
+   what the collector has to mark each time */
+void bench_cons(U64 live, int reps)
+{
+    Expr list = nil;
+    gc_push_root(&list);
+    for (U64 i = 0; i < live; i++)
+    {
+        list = cons(make_fixnum((I64) i), list);
+    }
+    bench_run("cons", live, bench_cons_run, NULL, 1000 * 1000, reps);
+    gc_pop_roots(1);
+}
+
+typedef struct
+{
+    Expr list;
+    I64 sum;
+} BenchListWalk;
+
+static void bench_list_walk_run(void * data, U64 ops)
+{
+    BenchListWalk * walk = (BenchListWalk *) data;
+    walk->sum = 0;
+    for (Expr tmp = walk->list; tmp; tmp = cdr(tmp))
+    {
+        walk->sum += fixnum_value(car(tmp));
+    }
+}
+
+/* walks a list of num fixnums with car and cdr, which is what most of the
+   evaluator spends its time doing */
+void bench_list_walk(U64 num, int reps)
+{
+    BenchListWalk walk = { nil, 0 };
+    gc_push_root(&walk.list);
+    for (U64 i = 0; i < num; i++)
+    {
+        walk.list = cons(make_fixnum((I64) i), walk.list);
+    }
+    bench_run("list_walk", num, bench_list_walk_run, &walk, num, reps);
+    gc_pop_roots(1);
+}
+
+/* symbols */
+
+#define LISP_BENCH_NAME_SIZE 32
+
+typedef struct
+{
+    U64 num;
+    char * names;
+} BenchSymbols;
+
+static void bench_make_symbol_run(void * data, U64 ops)
+{
+    BenchSymbols * symbols = (BenchSymbols *) data;
+    for (U64 i = 0; i < ops; i++)
+    {
+        make_symbol(symbols->names + (i % symbols->num) * LISP_BENCH_NAME_SIZE);
+    }
+}
+
+/* looks up existing symbols in a table of at least num of them */
+void bench_make_symbol(U64 num, int reps)
+{
+    BenchSymbols symbols = { num, (char *) LISP_MALLOC(num * LISP_BENCH_NAME_SIZE) };
+    if (!symbols.names)
+    {
+        LISP_FAIL("bench allocation failed\n");
+    }
+    for (U64 i = 0; i < num; i++)
+    {
+        char * name = symbols.names + i * LISP_BENCH_NAME_SIZE;
+        snprintf(name, LISP_BENCH_NAME_SIZE, "sym-%" PRIu64, i);
+        make_symbol(name);
+    }
+    bench_run("make_symbol", num, bench_make_symbol_run, &symbols, 1000 * 1000, reps);
+    LISP_FREE(symbols.names);
+}
+
+/* envs */
+
+typedef struct
+{
+    Expr env;
+    Expr var;
+} BenchEnvGet;
+
+static void bench_env_get_run(void * data, U64 ops)
+{
+    BenchEnvGet * get = (BenchEnvGet *) data;
+    for (U64 i = 0; i < ops; i++)
+    {
+        env_get(get->env, get->var);
+    }
+}
+
+/* looks up a variable depth frames out, or a global when depth is 0 */
+void bench_env_get(U64 depth, int reps)
+{
+    BenchEnvGet get = { make_core_env(), intern("bench-var") };
+    gc_push_root(&get.env);
+    env_def(get.env, get.var, make_fixnum(1));
+    for (U64 i = 0; i < depth; i++)
+    {
+        get.env = make_env(get.env);
+        env_def(get.env, i ? intern("other") : get.var, make_fixnum(2));
+    }
+    bench_run("env_get", depth, bench_env_get_run, &get, 1000 * 1000, reps);
+    gc_pop_roots(1);
+}
+
+/* reading and printing */
+
+/* a list of size elements of the kinds the reader distinguishes, to be
+   freed by the caller */
+static char * bench_source(U64 size)
+{
+    char const * const items[] = { "alpha-beta", "12345", "\"some text\"", "(x . y)", "'quoted" };
+    Expr const out = make_string_output_stream();
+    stream_put_char(out, '(');
+    for (U64 i = 0; i < size; i++)
+    {
+        if (i)
+        {
+            stream_put_char(out, ' ');
+        }
+        stream_put_string(out, items[i % 5]);
+    }
+    stream_put_char(out, ')');
+
+    size_t len = 0;
+    char const * str = stream_output(out, &len);
+    char * src = (char *) LISP_MALLOC(len + 1);
+    if (!src)
+    {
+        LISP_FAIL("bench allocation failed\n");
+    }
+    memcpy(src, str, len + 1);
+    stream_release(out);
+    return src;
+}
+
+typedef struct
+{
+    char const * src;
+    size_t len;
+    Expr exp;
+} BenchExpr;
+
+static void bench_parse_expr_run(void * data, U64 ops)
+{
+    BenchExpr * bench = (BenchExpr *) data;
+    for (U64 i = 0; i < ops; i++)
+    {
+        Expr const in = lisp_make_buffer_input_stream(&global.stream, bench->len, bench->src);
+        Expr exp = nil;
+        maybe_parse_expr(in, &exp);
+        stream_release(in);
+    }
+}
+
+/* parses a list of size elements */
+void bench_parse_expr(U64 size, int reps)
+{
+    char * src = bench_source(size);
+    BenchExpr bench = { src, strlen(src), nil };
+    bench_run("parse_expr", size, bench_parse_expr_run, &bench, 1000 * 1000 / size + 1, reps);
+    LISP_FREE(src);
+}
+
+static void bench_render_expr_run(void * data, U64 ops)
+{
+    BenchExpr * bench = (BenchExpr *) data;
+    Expr const out = make_string_output_stream();
+    for (U64 i = 0; i < ops; i++)
+    {
+        render_expr(bench->exp, out);
+        lisp_stream_clear_output(&global.stream, out);
+    }
+    stream_release(out);
+}
+
+/* renders a list of size elements */
+void bench_render_expr(U64 size, int reps)
+{
+    char * src = bench_source(size);
+    BenchExpr bench = { NULL, 0, read_one_from_string(src) };
+    LISP_FREE(src);
+    gc_push_root(&bench.exp);
+    bench_run("render_expr", size, bench_render_expr_run, &bench, 1000 * 1000 / size + 1, reps);
+    gc_pop_roots(1);
+}
+
+/* calls */
+
+typedef struct
+{
+    Expr fun;
+    Expr args;
+} BenchApply;
+
+static void bench_apply_run(void * data, U64 ops)
+{
+    BenchApply * bench = (BenchApply *) data;
+    for (U64 i = 0; i < ops; i++)
+    {
+        apply(bench->fun, bench->args);
+    }
+}
+
+/* applies a builtin, a closure and a compiled closure to num arguments */
+void bench_apply(U64 num, int reps)
+{
+    Expr env = make_core_env();
+    Expr lambda = nil;
+    BenchApply bench = { nil, nil };
+    gc_push_root(&env);
+    gc_push_root(&lambda);
+    gc_push_root(&bench.fun);
+    gc_push_root(&bench.args);
+
+    Expr const out = make_string_output_stream();
+    stream_put_string(out, "(lambda (");
+    for (U64 i = 0; i < num; i++)
+    {
+        stream_put_string(out, " x");
+        stream_put_u64(out, i);
+    }
+    stream_put_string(out, ") x0)");
+    size_t len = 0;
+    lambda = read_one_from_string(stream_output(out, &len));
+    stream_release(out);
+
+    for (U64 i = 0; i < num; i++)
+    {
+        bench.args = cons(make_fixnum((I64) i), bench.args);
+    }
+
+    bench.fun = env_get(env, intern("+"));
+    bench_run("apply/builtin", num, bench_apply_run, &bench, 1000 * 1000, reps);
+
+    bench.fun = eval(lambda, env);
+    bench_run("apply/closure", num, bench_apply_run, &bench, 1000 * 1000, reps);
+
+    vm_compile(bench.fun);
+    bench_run("apply/compiled", num, bench_apply_run, &bench, 1000 * 1000, reps);
+
+    gc_pop_roots(4);
+}
+
+typedef struct
+{
+    Expr exp;
+    Expr env;
+} BenchEval;
+
+static void bench_eval_run(void * data, U64 ops)
+{
+    BenchEval * bench = (BenchEval *) data;
+    for (U64 i = 0; i < ops; i++)
+    {
+        eval(bench->exp, bench->env);
+    }
+}
+
+/* evaluates (fib n), interpreted or compiled */
+void bench_fib(I64 n, bool compiled, int reps)
+{
+    BenchEval bench = { nil, make_core_env() };
+    gc_push_root(&bench.exp);
+    gc_push_root(&bench.env);
+
+    char src[128];
+    snprintf(src, sizeof(src), "(def fib %s(lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))%s",
+             compiled ? "(compile " : "", compiled ? ")" : "");
+    eval(read_one_from_string(src), bench.env);
+
+    snprintf(src, sizeof(src), "(fib %" PRIi64 ")", n);
+    bench.exp = read_one_from_string(src);
+    bench_run(compiled ? "fib/compiled" : "fib/eval", (U64) n, bench_eval_run, &bench, 1, reps);
+
+    gc_pop_roots(2);
+}
+
+/* encodings */
+
+typedef struct
+{
+    Expr data;
+    Expr out;
+    char const * str;
+    size_t len;
+} BenchBinary;
+
+static void bench_write_text_run(void * data, U64 ops)
+{
+    BenchBinary * bench = (BenchBinary *) data;
+    lisp_stream_clear_output(&global.stream, bench->out);
+    render_expr(bench->data, bench->out);
+}
+
+static void bench_read_text_run(void * data, U64 ops)
+{
+    BenchBinary * bench = (BenchBinary *) data;
+    read_one_from_string(bench->str);
+}
+
+static void bench_write_binary_run(void * data, U64 ops)
+{
+    BenchBinary * bench = (BenchBinary *) data;
+    lisp_stream_clear_output(&global.stream, bench->out);
+    write_binary(bench->data, bench->out);
+}
+
+static void bench_read_binary_run(void * data, U64 ops)
+{
+    BenchBinary * bench = (BenchBinary *) data;
+    read_binary(bench->str, bench->len, NULL);
+}
+
+/* round trips a list of num records through text and through the binary
+   encoding, reporting encode and decode separately */
+void bench_binary(U64 num, int reps)
+{
+    BenchBinary bench = { nil, make_string_output_stream(), NULL, 0 };
+    gc_push_root(&bench.data);
+    for (U64 i = 0; i < num; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "field-%" PRIu64, i % 64);
+        Expr const record = cons(make_string("some string value"),
+                                 list_3(intern(name), make_fixnum((I64) i), cons(intern("key"), make_fixnum(-(I64) i))));
+        bench.data = cons(record, bench.data);
+    }
+
+    bench_run("text/write", num, bench_write_text_run, &bench, num, reps);
+    bench.str = lisp_stream_output(&global.stream, bench.out, &bench.len);
+    bench_run("text/read", num, bench_read_text_run, &bench, num, reps);
+
+    bench_run("binary/write", num, bench_write_binary_run, &bench, num, reps);
+    bench.str = lisp_stream_output(&global.stream, bench.out, &bench.len);
+    bench_run("binary/read", num, bench_read_binary_run, &bench, num, reps);
+
+    stream_release(bench.out);
+    gc_pop_roots(1);
+}
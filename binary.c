@@ -0,0 +1,368 @@
+
+#include "common.h"
+
+/* a message is the magic, a version byte and one expression. integers are
+   varints, fixnums zigzag encoded so small negatives stay short. a symbol
+   is written by name the first time and by its index in the message after
+   that. a list is its length, its elements and its tail. */
+
+static char const lisp_binary_magic[] = { 'L', 'S', 'B', LISP_BINARY_VERSION };
+
+enum
+{
+    BINARY_NIL,
+    BINARY_FIXNUM,
+    BINARY_SYMBOL,          /* length and name, takes the next index */
+    BINARY_SYMBOL_REF,      /* index of a symbol named earlier */
+    BINARY_STRING,          /* length and bytes */
+    BINARY_LIST,            /* length, elements, tail */
+};
+
+void binary_init(BinaryState * binary)
+{
+    memset(binary, 0, sizeof(BinaryState));
+}
+
+void binary_quit(BinaryState * binary)
+{
+    LISP_FREE(binary->buffer);
+    LISP_FREE(binary->ids);
+    LISP_FREE(binary->symbols);
+    memset(binary, 0, sizeof(BinaryState));
+}
+
+static void _binary_push_symbol(BinaryState * binary, Expr exp)
+{
+    if (binary->num_symbols == binary->max_symbols)
+    {
+        binary->max_symbols = binary->max_symbols ? binary->max_symbols * 2 : 256;
+        binary->symbols = (Expr *) LISP_REALLOC(binary->symbols, sizeof(Expr) * binary->max_symbols);
+        if (!binary->symbols)
+        {
+            LISP_FAIL("binary symbol table allocation failed\n");
+        }
+    }
+    binary->symbols[binary->num_symbols++] = exp;
+}
+
+/* writer */
+
+/* a message is built in a buffer kept by the state and written to the
+   stream at once */
+
+typedef struct
+{
+    SystemState * sys;
+    char * data;
+    size_t len;
+    size_t cap;
+} BinaryWriter;
+
+static void _binary_reserve(BinaryWriter * w, size_t len)
+{
+    if (w->len + len <= w->cap)
+    {
+        return;
+    }
+    size_t cap = w->cap ? w->cap : 4096;
+    while (cap < w->len + len)
+    {
+        cap *= 2;
+    }
+    w->data = (char *) LISP_REALLOC(w->data, cap);
+    if (!w->data)
+    {
+        LISP_FAIL("binary buffer allocation failed\n");
+    }
+    w->cap = cap;
+}
+
+static void _binary_put_u64(BinaryWriter * w, U64 val)
+{
+    _binary_reserve(w, 10);
+    while (val >= 0x80)
+    {
+        w->data[w->len++] = (char) (val | 0x80);
+        val >>= 7;
+    }
+    w->data[w->len++] = (char) val;
+}
+
+static void _binary_put_tag(BinaryWriter * w, U64 tag)
+{
+    _binary_reserve(w, 1);
+    w->data[w->len++] = (char) tag;
+}
+
+static void _binary_put_bytes(BinaryWriter * w, char const * data, size_t len)
+{
+    _binary_put_u64(w, len);
+    _binary_reserve(w, len);
+    memcpy(w->data + w->len, data, len);
+    w->len += len;
+}
+
+static void _binary_write_symbol(BinaryWriter * w, Expr exp)
+{
+    SystemState * sys = w->sys;
+    BinaryState * binary = &sys->binary;
+    U64 const index = expr_data(exp);
+
+    if (index >= binary->num_ids)
+    {
+        U64 num = binary->num_ids ? binary->num_ids : 256;
+        while (num <= index)
+        {
+            num *= 2;
+        }
+        binary->ids = (U32 *) LISP_REALLOC(binary->ids, sizeof(U32) * num);
+        if (!binary->ids)
+        {
+            LISP_FAIL("binary symbol table allocation failed\n");
+        }
+        memset(binary->ids + binary->num_ids, 0, sizeof(U32) * (num - binary->num_ids));
+        binary->num_ids = num;
+    }
+
+    U32 const id = binary->ids[index];
+    if (id)
+    {
+        _binary_put_tag(w, BINARY_SYMBOL_REF);
+        _binary_put_u64(w, id - 1);
+        return;
+    }
+
+    _binary_push_symbol(binary, exp);
+    binary->ids[index] = (U32) binary->num_symbols;
+    _binary_put_tag(w, BINARY_SYMBOL);
+    _binary_put_bytes(w, lisp_symbol_name(&sys->symbol, exp), lisp_symbol_length(&sys->symbol, exp));
+}
+
+static void _binary_write(BinaryWriter * w, Expr exp)
+{
+    SystemState * sys = w->sys;
+    switch (expr_type(exp))
+    {
+    case TYPE_NIL:
+        _binary_put_tag(w, BINARY_NIL);
+        break;
+    case TYPE_FIXNUM:
+        {
+            I64 const val = fixnum_value(exp);
+            _binary_put_tag(w, BINARY_FIXNUM);
+            _binary_put_u64(w, ((U64) val << 1) ^ (U64) (val >> 63));
+        }
+        break;
+    case TYPE_SYMBOL:
+        _binary_write_symbol(w, exp);
+        break;
+    case TYPE_LOCAL:
+        /* resolved variable references are written as their names */
+        _binary_write_symbol(w, local_name(exp));
+        break;
+    case TYPE_STRING:
+        _binary_put_tag(w, BINARY_STRING);
+        _binary_put_bytes(w, lisp_string_value(&sys->string, exp), lisp_string_length(&sys->string, exp));
+        break;
+    case TYPE_CONS:
+        {
+            U64 len = 0;
+            Expr tail = exp;
+            for (; is_cons(tail); tail = lisp_cdr(&sys->cons, tail))
+            {
+                ++len;
+            }
+            _binary_put_tag(w, BINARY_LIST);
+            _binary_put_u64(w, len);
+            for (Expr tmp = exp; tmp != tail; tmp = lisp_cdr(&sys->cons, tmp))
+            {
+                _binary_write(w, lisp_car(&sys->cons, tmp));
+            }
+            _binary_write(w, tail);
+        }
+        break;
+    default:
+        LISP_FAIL("cannot write %s in binary\n", lisp_repr(w->sys, exp));
+        break;
+    }
+}
+
+void lisp_write_binary(SystemState * sys, Expr exp, Expr out)
+{
+    BinaryState * binary = &sys->binary;
+    BinaryWriter w = { sys, binary->buffer, 0, binary->buffer_size };
+    _binary_reserve(&w, sizeof(lisp_binary_magic));
+    memcpy(w.data, lisp_binary_magic, sizeof(lisp_binary_magic));
+    w.len = sizeof(lisp_binary_magic);
+    _binary_write(&w, exp);
+
+    binary->buffer = w.data;
+    binary->buffer_size = w.cap;
+    lisp_stream_write(&sys->stream, out, w.data, w.len);
+
+    /* forget the symbols of this message */
+    for (U64 i = 0; i < binary->num_symbols; i++)
+    {
+        binary->ids[expr_data(binary->symbols[i])] = 0;
+    }
+    binary->num_symbols = 0;
+}
+
+/* reader */
+
+typedef struct
+{
+    SystemState * sys;
+    U8 const * data;
+    size_t len;
+    size_t pos;
+} BinaryReader;
+
+static void _binary_truncated()
+{
+    LISP_FAIL("malformed binary data\n");
+}
+
+static U64 _binary_get_u64(BinaryReader * r)
+{
+    U64 val = 0;
+    for (U64 shift = 0; shift < 64; shift += 7)
+    {
+        if (r->pos == r->len)
+        {
+            _binary_truncated();
+        }
+        U8 const byte = r->data[r->pos++];
+        val |= (U64) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return val;
+        }
+    }
+    _binary_truncated();
+    return 0;
+}
+
+static char const * _binary_get_bytes(BinaryReader * r, size_t * len)
+{
+    U64 const n = _binary_get_u64(r);
+    if (n > r->len - r->pos)
+    {
+        _binary_truncated();
+    }
+    char const * ret = (char const *) r->data + r->pos;
+    r->pos += n;
+    *len = n;
+    return ret;
+}
+
+static Expr _binary_read(BinaryReader * r)
+{
+    SystemState * sys = r->sys;
+    if (r->pos == r->len)
+    {
+        _binary_truncated();
+    }
+
+    size_t len = 0;
+    switch (r->data[r->pos++])
+    {
+    case BINARY_NIL:
+        return nil;
+    case BINARY_FIXNUM:
+        {
+            U64 const val = _binary_get_u64(r);
+            I64 const num = (I64) (val >> 1) ^ -(I64) (val & 1);
+            if (!fixnum_in_range(num))
+            {
+                _binary_truncated();
+            }
+            return make_fixnum(num);
+        }
+    case BINARY_SYMBOL:
+        {
+            char const * name = _binary_get_bytes(r, &len);
+            Expr const exp = lisp_make_symbol_n(&sys->symbol, name, len);
+            _binary_push_symbol(&sys->binary, exp);
+            return exp;
+        }
+    case BINARY_SYMBOL_REF:
+        {
+            U64 const id = _binary_get_u64(r);
+            if (id >= sys->binary.num_symbols)
+            {
+                _binary_truncated();
+            }
+            return sys->binary.symbols[id];
+        }
+    case BINARY_STRING:
+        {
+            char const * str = _binary_get_bytes(r, &len);
+            if (sys->binary.intern_strings)
+            {
+                return lisp_intern_string_n(&sys->string, str, len);
+            }
+            return lisp_make_string_n(&sys->string, str, len);
+        }
+    case BINARY_LIST:
+        {
+            U64 const num = _binary_get_u64(r);
+            if (!num || num > r->len - r->pos)
+            {
+                _binary_truncated();
+            }
+            Expr head = nil;
+            Expr tail = nil;
+            for (U64 i = 0; i < num; i++)
+            {
+                Expr const next = lisp_cons(&sys->cons, _binary_read(r), nil);
+                if (head)
+                {
+                    lisp_rplacd(&sys->cons, tail, next);
+                }
+                else
+                {
+                    head = next;
+                }
+                tail = next;
+            }
+            lisp_rplacd(&sys->cons, tail, _binary_read(r));
+            return head;
+        }
+    default:
+        _binary_truncated();
+        return nil;
+    }
+}
+
+/* reads the message at the start of data, used is set to its size */
+Expr lisp_read_binary(SystemState * sys, char const * data, size_t len, size_t * used)
+{
+    if (len < sizeof(lisp_binary_magic) || memcmp(data, lisp_binary_magic, sizeof(lisp_binary_magic)))
+    {
+        LISP_FAIL("not binary lisp data\n");
+    }
+
+    BinaryReader r = { sys, (U8 const *) data, len, sizeof(lisp_binary_magic) };
+    Expr const ret = _binary_read(&r);
+    sys->binary.num_symbols = 0;
+    if (used)
+    {
+        *used = r.pos;
+    }
+    return ret;
+}
+
+#if LISP_GLOBAL_API
+
+void write_binary(Expr exp, Expr out)
+{
+    lisp_write_binary(&global, exp, out);
+}
+
+Expr read_binary(char const * data, size_t len, size_t * used)
+{
+    return lisp_read_binary(&global, data, len, used);
+}
+
+#endif
@@ -17,6 +17,15 @@ bool is_builtin(Expr exp)
 
 Expr lisp_make_builtin(BuiltinState * builtin, char const * name, BuiltinFun fun)
 {
+    /* every core env registers the same functions, share their entries */
+    for (U64 i = 0; i < builtin->num; i++)
+    {
+        if (builtin->info[i].fun == fun && !strcmp(builtin->info[i].name, name))
+        {
+            return make_expr(TYPE_BUILTIN, i);
+        }
+    }
+
     LISP_ASSERT(builtin->num < LISP_MAX_BUILTINS);
     U64 const index = builtin->num++;
     BuiltinInfo * info = builtin->info + index;
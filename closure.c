@@ -0,0 +1,127 @@
+
+#include "common.h"
+
+static void _closure_maybe_realloc(ClosureState * closure)
+{
+    if (closure->num < closure->max)
+    {
+        return;
+    }
+
+    closure->max = closure->max ? closure->max * 2 : 64;
+    closure->closures = (Closure *) LISP_REALLOC(closure->closures, sizeof(Closure) * closure->max);
+    if (!closure->closures)
+    {
+        LISP_FAIL("closure memory allocation failed\n");
+    }
+}
+
+void closure_init(ClosureState * closure)
+{
+    memset(closure, 0, sizeof(ClosureState));
+}
+
+void closure_quit(ClosureState * closure)
+{
+    LISP_FREE(closure->closures);
+    memset(closure, 0, sizeof(ClosureState));
+}
+
+bool is_closure(Expr exp)
+{
+    return expr_type(exp) == TYPE_CLOSURE;
+}
+
+Expr lisp_make_closure(ClosureState * closure, ConsState * cons, U64 kind, Expr env, Expr params, Expr body)
+{
+    lisp_cons_count_alloc(cons, 1);
+
+    U64 index;
+    if (closure->free)
+    {
+        index = closure->free - 1;
+        closure->free = closure->closures[index].env;
+        --closure->num_free;
+    }
+    else
+    {
+        _closure_maybe_realloc(closure);
+        index = closure->num++;
+    }
+
+    Closure * info = closure->closures + index;
+    info->env = env;
+    info->params = params;
+    info->body = body;
+    info->kind = kind;
+    info->code = NULL;
+    return make_expr(TYPE_CLOSURE, index);
+}
+
+Closure * lisp_closure(ClosureState * closure, Expr exp)
+{
+    LISP_ASSERT(is_closure(exp));
+    U64 const index = expr_data(exp);
+    LISP_ASSERT_DEBUG(index < closure->num);
+    return closure->closures + index;
+}
+
+void lisp_closure_free(ClosureState * closure, U64 index)
+{
+    Closure * info = closure->closures + index;
+    info->params = nil;
+    info->body = nil;
+    info->code = NULL;
+    info->env = closure->free;
+    closure->free = index + 1;
+    ++closure->num_free;
+}
+
+bool lisp_is_function(ClosureState * closure, Expr exp)
+{
+    return is_closure(exp) && lisp_closure(closure, exp)->kind == CLOSURE_FUNCTION;
+}
+
+bool lisp_is_macro(ClosureState * closure, Expr exp)
+{
+    return is_closure(exp) && lisp_closure(closure, exp)->kind == CLOSURE_MACRO;
+}
+
+#if LISP_GLOBAL_API
+
+Expr make_closure(U64 kind, Expr env, Expr params, Expr body)
+{
+    return lisp_make_closure(&global.closure, &global.cons, kind, env, params, body);
+}
+
+Closure * closure_info(Expr exp)
+{
+    return lisp_closure(&global.closure, exp);
+}
+
+bool is_function(Expr exp)
+{
+    return lisp_is_function(&global.closure, exp);
+}
+
+bool is_macro(Expr exp)
+{
+    return lisp_is_macro(&global.closure, exp);
+}
+
+Expr closure_env(Expr exp)
+{
+    return closure_info(exp)->env;
+}
+
+Expr closure_args(Expr exp)
+{
+    return closure_info(exp)->params;
+}
+
+Expr closure_body(Expr exp)
+{
+    return closure_info(exp)->body;
+}
+
+#endif
@@ -22,6 +22,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <signal.h>
 #include <string.h>
 
 #define LISP_RED     "\x1b[31m"
@@ -90,6 +91,28 @@ void test_finish(TestState * test);
 void test_group(TestState * test, char const * text);
 void test_assert_try(TestState * test, bool exp, char const * msg);
 
+/* bench.h */
+
+/* each benchmark writes one json line per result, with the median, p99
+   and min time in ns per op and the collected allocations per op */
+
+#ifndef LISP_BENCH_FILE_SIZE
+#define LISP_BENCH_FILE_SIZE (100 * 1000 * 1000)
+#endif
+
+void bench_generate_source(char const * path, size_t size);
+void bench_load_file(char const * path, int reps);
+void bench_read_file(char const * path, int reps);
+void bench_cons(U64 live, int reps);
+void bench_list_walk(U64 num, int reps);
+void bench_make_symbol(U64 num, int reps);
+void bench_env_get(U64 depth, int reps);
+void bench_parse_expr(U64 size, int reps);
+void bench_render_expr(U64 size, int reps);
+void bench_apply(U64 num, int reps);
+void bench_fib(I64 n, bool compiled, int reps);
+void bench_binary(U64 num, int reps);
+
 /* error.h */
 
 #define LISP_FAIL(...)    error_fail(__VA_ARGS__);
@@ -103,16 +126,38 @@ void test_assert_try(TestState * test, bool exp, char const * msg);
 #define LISP_ASSERT_DEBUG(x)
 #endif
 
+#define LISP_ERROR_MSG_SIZE 1024
+
 void error_fail(char const * fmt, ...);
 void error_warn(char const * fmt, ...);
 
+/* a thread can take over its own failures, to report them elsewhere
+   instead of ending the process. the handler must not return. */
+typedef void (* ErrorHandler)(void * data, char const * msg);
+
+void error_set_handler(ErrorHandler handler, void * data);
+
 /* expr.h */
 
 typedef U64 Expr;
 
-Expr make_expr(U64 type, U64 data);
-U64 expr_type(Expr exp);
-U64 expr_data(Expr exp);
+/* for compile-time constants, use make_expr everywhere else */
+#define LISP_MAKE_EXPR(type, data) ((Expr) (((U64) (data) << 8) | ((U64) (type) & 0xff)))
+
+inline static Expr make_expr(U64 type, U64 data)
+{
+    return (data << 8) | (type & 0xff);
+}
+
+inline static U64 expr_type(Expr exp)
+{
+    return exp & 0xff;
+}
+
+inline static U64 expr_data(Expr exp)
+{
+    return exp >> 8;
+}
 
 enum
 {
@@ -124,6 +169,10 @@ enum
     TYPE_STREAM,
     TYPE_SPECIAL,
     TYPE_BUILTIN,
+    TYPE_FIXNUM,
+    TYPE_LOCAL,
+    TYPE_ENV,
+    TYPE_CLOSURE,
 };
 
 enum
@@ -142,24 +191,104 @@ inline static bool is_nil(Expr exp)
     return exp == nil;
 }
 
+/* fixnum.h */
+
+/* signed integers stored in the 56 data bits of an Expr */
+
+#define LISP_FIXNUM_BITS 56
+#define LISP_FIXNUM_MAX  ((I64) (((U64) 1 << (LISP_FIXNUM_BITS - 1)) - 1))
+#define LISP_FIXNUM_MIN  (-LISP_FIXNUM_MAX - 1)
+
+inline static bool is_fixnum(Expr exp)
+{
+    return expr_type(exp) == TYPE_FIXNUM;
+}
+
+inline static bool fixnum_in_range(I64 val)
+{
+    return val >= LISP_FIXNUM_MIN && val <= LISP_FIXNUM_MAX;
+}
+
+inline static Expr make_fixnum(I64 val)
+{
+    LISP_ASSERT_DEBUG(fixnum_in_range(val));
+    return make_expr(TYPE_FIXNUM, (U64) val);
+}
+
+inline static I64 fixnum_value(Expr exp)
+{
+    /* arithmetic shift restores the sign */
+    return (I64) exp >> 8;
+}
+
 /* symbol.h */
 
-#define LISP_SYMBOL_T intern("t")
+/* well-known symbols are interned in this order by symbol_init,
+   so their values are known at compile time */
+
+#define LISP_SYMBOLS(X) \
+    X(T, "t") \
+    X(QUOTE, "quote") \
+    X(IF, "if") \
+    X(BACKQUOTE, "backquote") \
+    X(UNQUOTE, "unquote") \
+    X(UNQUOTE_SPLICING, "unquote-splicing") \
+    X(LIT, "lit") \
+    X(CLO, "clo") \
+    X(MAC, "mac") \
+    X(ENV, "*env*") \
+    X(DOT, ".")
 
-#define LISP_SYM_QUOTE intern("quote")
-#define LISP_SYM_IF intern("if")
-#define LISP_SYM_BACKQUOTE intern("backquote")
-#define LISP_SYM_UNQUOTE intern("unquote")
-#define LISP_SYM_UNQUOTE_SPLICING intern("unquote-splicing")
+enum
+{
+#define LISP_SYMBOL_INDEX(id, name) SYMBOL_##id,
+    LISP_SYMBOLS(LISP_SYMBOL_INDEX)
+#undef LISP_SYMBOL_INDEX
+    NUM_WELL_KNOWN_SYMBOLS
+};
+
+#define LISP_SYM_T                LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_T)
+#define LISP_SYM_QUOTE            LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_QUOTE)
+#define LISP_SYM_IF               LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_IF)
+#define LISP_SYM_BACKQUOTE        LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_BACKQUOTE)
+#define LISP_SYM_UNQUOTE          LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_UNQUOTE)
+#define LISP_SYM_UNQUOTE_SPLICING LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_UNQUOTE_SPLICING)
+#define LISP_SYM_LIT              LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_LIT)
+#define LISP_SYM_CLO              LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_CLO)
+#define LISP_SYM_MAC              LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_MAC)
+#define LISP_SYM_ENV              LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_ENV)
+#define LISP_SYM_DOT              LISP_MAKE_EXPR(TYPE_SYMBOL, SYMBOL_DOT)
+
+#define LISP_SYMBOL_T LISP_SYM_T
 
 #define LISP_MAX_SYMBOLS -1
 #define LISP_DEF_SYMBOLS 16
 
+#define LISP_SYMBOL_CHUNK_SIZE 4096
+
+typedef struct
+{
+    char const * name;
+    U32 len;
+    U32 hash;
+} SymbolInfo;
+
+typedef struct SymbolChunk SymbolChunk;
+
 typedef struct
 {
     U64 num;
     U64 max;
-    char ** names;
+    SymbolInfo * info;
+
+    /* open addressing index, holds symbol index + 1 or 0 when empty */
+    U64 num_slots;
+    U64 * slots;
+
+    /* names are packed into chunks that never move */
+    SymbolChunk * chunk;
+    size_t chunk_used;
+    size_t chunk_size;
 } SymbolState;
 
 void symbol_init(SymbolState * symbol);
@@ -171,11 +300,15 @@ inline static bool is_symbol(Expr exp)
 }
 
 Expr lisp_make_symbol(SymbolState * symbol, char const * name);
+Expr lisp_make_symbol_n(SymbolState * symbol, char const * name, size_t len);
 char const * lisp_symbol_name(SymbolState * symbol, Expr exp);
+size_t lisp_symbol_length(SymbolState * symbol, Expr exp);
 
 #if LISP_GLOBAL_API
 Expr make_symbol(char const * name);
+Expr make_symbol_n(char const * name, size_t len);
 char const * symbol_name(Expr exp);
+size_t symbol_length(Expr exp);
 #endif
 
 /* cons.h */
@@ -193,68 +326,142 @@ typedef struct
     U64 num;
     U64 max;
     struct Pair * pairs;
+
+    U64 free;           /* head of the free list, index + 1 or 0 when empty */
+    U64 num_free;
+    U64 num_allocs;     /* since the last collection */
+    U64 total_allocs;   /* before the last collection */
+    U64 threshold;
+    bool gc_pending;
 } ConsState;
 
 void cons_init(ConsState * cons);
 void cons_quit(ConsState * cons);
 
-bool is_cons(Expr exp);
+inline static bool is_cons(Expr exp)
+{
+    return expr_type(exp) == TYPE_CONS;
+}
 
-Expr lisp_cons(ConsState * cons, Expr a, Expr b);
-Expr lisp_car(ConsState * cons, Expr exp);
-Expr lisp_cdr(ConsState * cons, Expr exp);
-void lisp_rplaca(ConsState * cons, Expr exp, Expr val);
-void lisp_rplacd(ConsState * cons, Expr exp, Expr val);
+/* counts an allocation towards the next collection, other pools that
+   the collector manages call this as well */
+inline static void lisp_cons_count_alloc(ConsState * cons, U64 count)
+{
+    cons->num_allocs += count;
+    if (cons->num_allocs >= cons->threshold)
+    {
+        cons->gc_pending = true;
+    }
+}
 
-#if LISP_GLOBAL_API
+/* every allocation counted so far */
+inline static U64 lisp_cons_total_allocs(ConsState * cons)
+{
+    return cons->total_allocs + cons->num_allocs;
+}
 
-Expr cons(Expr a, Expr b);
-Expr car(Expr exp);
-Expr cdr(Expr exp);
-void rplaca(Expr exp, Expr val);
-void rplacd(Expr exp, Expr val);
+Expr lisp_cons(ConsState * cons, Expr a, Expr b);
 
-inline static Expr caar(Expr exp)
+/* the type check stays in release builds, since the data of anything
+   else would index the pair pool. the bounds check is debug only. */
+inline static struct Pair * lisp_cons_pair(ConsState * cons, Expr exp)
 {
-    return car(car(exp));
+    LISP_ASSERT(is_cons(exp));
+    U64 const index = expr_data(exp);
+    LISP_ASSERT_DEBUG(index < cons->num);
+    return cons->pairs + index;
 }
 
-inline static Expr cadr(Expr exp)
+inline static Expr lisp_car(ConsState * cons, Expr exp)
 {
-    return car(cdr(exp));
+    return lisp_cons_pair(cons, exp)->a;
 }
 
-inline static Expr cdar(Expr exp)
+inline static Expr lisp_cdr(ConsState * cons, Expr exp)
 {
-    return cdr(car(exp));
+    return lisp_cons_pair(cons, exp)->b;
 }
 
-inline static Expr cddr(Expr exp)
+inline static void lisp_rplaca(ConsState * cons, Expr exp, Expr val)
 {
-    return cdr(cdr(exp));
+    lisp_cons_pair(cons, exp)->a = val;
 }
 
-inline static Expr caddr(Expr exp)
+inline static void lisp_rplacd(ConsState * cons, Expr exp, Expr val)
 {
-    return car(cdr(cdr(exp)));
+    lisp_cons_pair(cons, exp)->b = val;
 }
 
-inline static Expr cdddr(Expr exp)
+inline static Expr lisp_cadr(ConsState * cons, Expr exp)
 {
-    return cdr(cdr(cdr(exp)));
+    return lisp_car(cons, lisp_cdr(cons, exp));
 }
 
-inline static Expr cadddr(Expr exp)
+inline static Expr lisp_cddr(ConsState * cons, Expr exp)
 {
-    return car(cdr(cdr(cdr(exp))));
+    return lisp_cdr(cons, lisp_cdr(cons, exp));
 }
 
-inline static Expr cddddr(Expr exp)
+inline static Expr lisp_caddr(ConsState * cons, Expr exp)
 {
-    return cdr(cdr(cdr(cdr(exp))));
+    return lisp_car(cons, lisp_cddr(cons, exp));
 }
 
+/* gc.h */
+
+/* the collector is precise: it only sees conses, environment frames and
+   closures reachable from the registered roots, and it only runs at safe
+   points (on entry to eval). C code that holds any of them across a call
+   to eval must root it. */
+
+#ifndef LISP_GC
+#define LISP_GC 1
+#endif
+
+#ifndef LISP_GC_MIN_THRESHOLD
+#define LISP_GC_MIN_THRESHOLD (64 * 1024)
+#endif
+
+typedef struct
+{
+    U64 num_roots;
+    U64 max_roots;
+    Expr ** roots;
+
+    U64 num_marks;
+    U64 * marks;
+
+    U64 num_env_marks;
+    U64 * env_marks;
+
+    U64 num_closure_marks;
+    U64 * closure_marks;
+
+    U64 num_stack;
+    U64 max_stack;
+    Expr * stack;
+
+    U64 num_collections;
+} GcState;
+
+void gc_init(GcState * gc);
+void gc_quit(GcState * gc);
+
+void lisp_gc_push_root(GcState * gc, Expr * root);
+void lisp_gc_pop_roots(GcState * gc, U64 count);
+void lisp_gc_remove_root(GcState * gc, Expr * root);
+
+void lisp_gc_collect(SystemState * system);
+
+inline static void lisp_gc_maybe_collect(SystemState * system, ConsState * cons)
+{
+#if LISP_GC
+    if (cons->gc_pending)
+    {
+        lisp_gc_collect(system);
+    }
 #endif
+}
 
 /* gensym.h */
 
@@ -272,12 +479,38 @@ Expr lisp_gensym(GensymState * gensym);
 
 /* string.h */
 
-#define LISP_MAX_STRINGS        500000
+/* strings are immutable. they are stored as length-prefixed records with
+   their hash in chunks that never move, and the table of records grows
+   on demand. string literals from the reader are deduplicated. */
+
+#define LISP_DEF_STRINGS 64
+
+#define LISP_STRING_CHUNK_SIZE 16384
+
+typedef struct
+{
+    U32 len;
+    U32 hash;
+    char data[];        /* zero terminated */
+} StringRecord;
+
+typedef struct StringChunk StringChunk;
 
 typedef struct
 {
-    U64 count;
-    char ** values;
+    U64 num;
+    U64 max;
+    StringRecord ** records;
+
+    /* open addressing index of the deduplicated strings, holds string
+       index + 1 or 0 when empty */
+    U64 num_unique;
+    U64 num_slots;
+    U64 * slots;
+
+    StringChunk * chunk;
+    size_t chunk_used;
+    size_t chunk_size;
 } StringState;
 
 void string_init(StringState * string);
@@ -285,22 +518,50 @@ void string_quit(StringState * string);
 
 bool is_string(Expr exp);
 
+Expr lisp_make_string_n(StringState * string, char const * str, size_t len);
+Expr lisp_make_string(StringState * string, char const * str);
+Expr lisp_intern_string_n(StringState * string, char const * str, size_t len);
+bool lisp_string_is_interned(StringState * string, Expr exp);
+char const * lisp_string_value(StringState * string, Expr exp);
+U64 lisp_string_length(StringState * string, Expr exp);
+
+#if LISP_GLOBAL_API
 Expr make_string(char const * str);
+Expr make_string_n(char const * str, size_t len);
+Expr intern_string_n(char const * str, size_t len);
 char const * string_value(Expr exp);
 U64 string_length(Expr exp);
+#endif
 
 /* stream.h */
 
 #define LISP_MAX_STREAMS 64
 
+#ifndef LISP_STREAM_READ_SIZE
+#define LISP_STREAM_READ_SIZE (64 * 1024)
+#endif
+
+#ifndef LISP_STREAM_WRITE_SIZE
+#define LISP_STREAM_WRITE_SIZE (16 * 1024)
+#endif
+
 typedef struct
 {
     FILE * file;
     bool close_on_quit;
-
-    char * buffer;
-    size_t size;
-    size_t cursor;
+    bool interactive; /* refill line by line so reads do not block */
+    bool line_flush;  /* write out the buffer after each newline */
+    bool growable;    /* string output stream that owns its buffer */
+
+    /* output window, written out to file, grown or fixed */
+    char * write_buffer;
+    size_t write_size;
+    size_t write_cursor;
+
+    /* input window, refilled from file or covering a whole string */
+    char const * read_buffer;
+    size_t read_size;
+    size_t read_cursor;
 } StreamInfo;
 
 typedef struct
@@ -321,38 +582,122 @@ bool is_stream(Expr exp);
 Expr lisp_make_file_input_stream(StreamState * stream, FILE * file, bool close_on_quit);
 Expr lisp_make_file_output_stream(StreamState * stream, FILE * file, bool close_on_quit);
 Expr lisp_make_string_input_stream(StreamState * stream, char const * str);
+Expr lisp_make_buffer_input_stream(StreamState * stream, size_t size, char const * buffer);
 Expr lisp_make_buffer_output_stream(StreamState * stream, size_t size, char * buffer);
+Expr lisp_make_string_output_stream(StreamState * stream);
+
+char lisp_stream_peek_char_slow(StreamState * stream, Expr exp);
+void lisp_stream_skip_char_slow(StreamState * stream, Expr exp);
+
+inline static StreamInfo * lisp_stream_info(StreamState * stream, Expr exp)
+{
+    LISP_ASSERT_DEBUG(is_stream(exp));
+    U64 const index = expr_data(exp);
+    LISP_ASSERT_DEBUG(index < stream->num);
+    return stream->info + index;
+}
+
+inline static char lisp_stream_peek_char(StreamState * stream, Expr exp)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    if (info->read_cursor < info->read_size)
+    {
+        return info->read_buffer[info->read_cursor];
+    }
+    return lisp_stream_peek_char_slow(stream, exp);
+}
+
+inline static void lisp_stream_skip_char(StreamState * stream, Expr exp)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    if (info->read_cursor < info->read_size)
+    {
+        ++info->read_cursor;
+        return;
+    }
+    lisp_stream_skip_char_slow(stream, exp);
+}
+
+/* exposes the unread input of a stream that holds all of it in memory,
+   so tokens can be sliced without copying; false for file streams */
+inline static bool lisp_stream_peek_span(StreamState * stream, Expr exp, char const ** ptr, size_t * len)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    if (info->file || !info->read_buffer)
+    {
+        return false;
+    }
+    *ptr = info->read_buffer + info->read_cursor;
+    *len = info->read_size - info->read_cursor;
+    return true;
+}
+
+inline static void lisp_stream_skip_span(StreamState * stream, Expr exp, size_t len)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    LISP_ASSERT_DEBUG(info->read_cursor + len <= info->read_size);
+    info->read_cursor += len;
+}
+
+inline static char lisp_stream_get_char(StreamState * stream, Expr exp)
+{
+    char const ret = lisp_stream_peek_char(stream, exp);
+    lisp_stream_skip_char(stream, exp);
+    return ret;
+}
 
 bool lisp_stream_at_end(StreamState * stream, Expr exp);
 
+void lisp_stream_put_char_slow(StreamState * stream, Expr exp, char ch);
+
+inline static void lisp_stream_put_char(StreamState * stream, Expr exp, char ch)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    if (info->write_cursor < info->write_size && (ch != '\n' || !info->line_flush))
+    {
+        info->write_buffer[info->write_cursor++] = ch;
+        return;
+    }
+    lisp_stream_put_char_slow(stream, exp, ch);
+}
+
+void lisp_stream_write(StreamState * stream, Expr exp, char const * data, size_t len);
+void lisp_stream_put_string(StreamState * stream, Expr exp, char const * str);
+void lisp_stream_put_u64(StreamState * stream, Expr exp, U64 val);
+void lisp_stream_put_i64(StreamState * stream, Expr exp, I64 val);
+void lisp_stream_put_x64(StreamState * stream, Expr exp, U64 val);
+void lisp_stream_flush(StreamState * stream, Expr exp);
+
+/* NUL-terminated contents of a string or buffer output stream,
+   valid until the next write or release */
+char const * lisp_stream_output(StreamState * stream, Expr exp, size_t * len);
+
+/* drops the contents of a string or buffer output stream, keeps its buffer */
+void lisp_stream_clear_output(StreamState * stream, Expr exp);
+
 void lisp_stream_release(StreamState * stream, Expr exp);
 
+#if LISP_GLOBAL_API
 Expr make_file_input_stream_from_path(char const * path);
 Expr make_string_input_stream(char const * str);
+Expr make_string_output_stream();
 
-char stream_peek_char(Expr exp);
-void stream_skip_char(Expr exp);
-
-void stream_put_char(Expr exp, char ch);
+void stream_write(Expr exp, char const * data, size_t len);
 void stream_put_string(Expr exp, char const * str);
 void stream_put_u64(Expr exp, U64 val);
+void stream_put_i64(Expr exp, I64 val);
 void stream_put_x64(Expr exp, U64 val);
-
-inline static char stream_get_char(Expr exp)
-{
-    /* TODO inline implementation */
-    char const ret = stream_peek_char(exp);
-    stream_skip_char(exp);
-    return ret;
-}
+void stream_flush(Expr exp);
+char const * stream_output(Expr exp, size_t * len);
 
 void stream_release(Expr exp);
+#endif
 
 /* special.h */
 
 #define LISP_MAX_SPECIALS 64
 
-typedef Expr (* SpecialFun)(Expr args, Expr kwargs, Expr env); // TODO should we pass the system state?
+typedef Expr (* SpecialFun)(SystemState * system, Expr args, Expr kwargs, Expr env);
 
 typedef struct
 {
@@ -376,13 +721,15 @@ Expr lisp_make_special(SpecialState * special, char const * name, SpecialFun fun
 char const * lisp_special_name(SpecialState * special, Expr exp);
 SpecialFun lisp_special_fun(SpecialState * special, Expr exp);
 
+#if LISP_GLOBAL_API
 Expr make_special(char const * name, SpecialFun fun);
+#endif
 
 /* builtin.h */
 
 #define LISP_MAX_BUILTINS 64
 
-typedef Expr (* BuiltinFun)(Expr args, Expr kwargs, Expr env); // TODO should we pass the system state?
+typedef Expr (* BuiltinFun)(SystemState * system, Expr args, Expr kwargs, Expr env);
 
 typedef struct
 {
@@ -406,7 +753,100 @@ Expr lisp_make_builtin(BuiltinState * builtin, char const * name, BuiltinFun fun
 char const * lisp_builtin_name(BuiltinState * builtin, Expr exp);
 BuiltinFun lisp_builtin_fun(BuiltinState * builtin, Expr exp);
 
+#if LISP_GLOBAL_API
 Expr make_builtin(char const * name, BuiltinFun fun);
+#endif
+
+/* lex.h */
+
+/* scanners for input that is in memory as a whole. most tokens are
+   short, so the first bytes are classified through a table inline. longer
+   runs go to a scanner picked by checking the cpu once at startup, which
+   classifies blocks of 32 (avx2) or 16 (sse2) bytes at a time. */
+
+#define LISP_LEX_INLINE 16
+
+enum
+{
+    LEX_WHITESPACE      = 1 << 0,
+    LEX_DELIMITER       = 1 << 1,
+    LEX_STRING_SPECIAL  = 1 << 2,
+    LEX_LINE_END        = 1 << 3,
+};
+
+extern U8 const lisp_lex_classes[256];
+
+#ifndef LISP_LEX_SIMD
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LISP_LEX_SIMD 1
+#else
+#define LISP_LEX_SIMD 0
+#endif
+#endif
+
+typedef size_t (* LexScanFun)(char const * p, size_t n);
+
+typedef struct
+{
+    char const * isa;
+    LexScanFun skip_whitespace;
+    LexScanFun find_delimiter;      /* the end of a symbol or number */
+    LexScanFun find_string_special; /* '"', '\\' or a zero byte */
+    LexScanFun find_line_end;       /* '\n' or a zero byte */
+} LexState;
+
+void lex_init(LexState * lex);
+void lex_quit(LexState * lex);
+
+bool lex_select(LexState * lex, char const * isa);
+
+/* skips the bytes of p[0..n) that are in (in_class) or out of cls and
+   returns the offset of the first other byte, or n */
+inline static size_t lisp_lex_scan(LexState * lex, char const * p, size_t n, U8 cls, bool in_class, LexScanFun scan)
+{
+    size_t const head = n < LISP_LEX_INLINE ? n : LISP_LEX_INLINE;
+    for (size_t i = 0; i < head; i++)
+    {
+        if (((lisp_lex_classes[(U8) p[i]] & cls) != 0) != in_class)
+        {
+            return i;
+        }
+    }
+    return head + scan(p + head, n - head);
+}
+
+inline static size_t lisp_lex_skip_whitespace(LexState * lex, char const * p, size_t n)
+{
+    return lisp_lex_scan(lex, p, n, LEX_WHITESPACE, true, lex->skip_whitespace);
+}
+
+inline static size_t lisp_lex_find_delimiter(LexState * lex, char const * p, size_t n)
+{
+    return lisp_lex_scan(lex, p, n, LEX_DELIMITER, false, lex->find_delimiter);
+}
+
+inline static size_t lisp_lex_find_string_special(LexState * lex, char const * p, size_t n)
+{
+    return lisp_lex_scan(lex, p, n, LEX_STRING_SPECIAL, false, lex->find_string_special);
+}
+
+inline static size_t lisp_lex_find_line_end(LexState * lex, char const * p, size_t n)
+{
+    return lisp_lex_scan(lex, p, n, LEX_LINE_END, false, lex->find_line_end);
+}
+
+size_t lisp_lex_skip_blank_slow(LexState * lex, char const * p, size_t n);
+
+/* whitespace and comments, as the reader skips them */
+inline static size_t lisp_lex_skip_blank(LexState * lex, char const * p, size_t n)
+{
+    size_t const i = lisp_lex_skip_whitespace(lex, p, n);
+    if (i == n || p[i] != ';')
+    {
+        return i;
+    }
+    return i + lisp_lex_skip_blank_slow(lex, p + i, n - i);
+}
 
 /* reader.h */
 
@@ -418,9 +858,58 @@ bool lisp_maybe_parse_expr(SystemState * system, Expr in, Expr * exp);
 
 Expr lisp_read_one_from_string(SystemState * system, char const * src);
 
+/* a push parser is fed input in chunks of any size as it arrives and keeps
+   its partial lists, strings and symbols between calls. it registers gc
+   roots into itself, so it must not move between init and quit. */
+
+typedef enum ParserStatus
+{
+    PARSER_NEED_MORE,       /* no complete form yet */
+    PARSER_FORM,            /* at least one form can be taken */
+} ParserStatus;
+
+typedef struct ParserFrame
+{
+    U64 kind;               /* a list or a quote prefix */
+    U64 dot;                /* how far a list is past its '.' */
+    Expr prefix;            /* the symbol a prefix wraps its form with */
+} ParserFrame;
+
+typedef struct Parser
+{
+    U64 state;
+    U64 num_hex;
+    char hex;
+
+    Expr lists;             /* (head . tail) of each open list, innermost first */
+    Expr forms;             /* complete forms not taken yet */
+    Expr forms_tail;
+
+    U64 num_frames;
+    U64 max_frames;
+    ParserFrame * frames;
+
+    size_t num_token;
+    size_t max_token;
+    char * token;
+} Parser;
+
+void lisp_parser_init(SystemState * system, Parser * parser);
+void lisp_parser_quit(SystemState * system, Parser * parser);
+
+ParserStatus lisp_parser_feed(SystemState * system, Parser * parser, char const * data, size_t len);
+bool lisp_parser_finish(SystemState * system, Parser * parser);
+bool lisp_parser_next(SystemState * system, Parser * parser, Expr * exp);
+
 #if LISP_GLOBAL_API
 bool maybe_parse_expr(Expr in, Expr * exp);
 Expr read_one_from_string(char const * src);
+
+void parser_init(Parser * parser);
+void parser_quit(Parser * parser);
+ParserStatus parser_feed(Parser * parser, char const * data, size_t len);
+bool parser_finish(Parser * parser);
+bool parser_next(Parser * parser, Expr * exp);
 #endif
 
 /* printer.h */
@@ -429,25 +918,103 @@ Expr read_one_from_string(char const * src);
 #define LISP_PRINTER_RENDER_QUOTE 1
 #endif
 
+void lisp_render_expr(SystemState * system, Expr exp, Expr out);
+
+#if LISP_GLOBAL_API
 void render_expr(Expr exp, Expr out);
+#endif
+
+/* binary.h */
+
+/* a compact binary encoding of data, for exchange with other programs.
+   symbols, strings, fixnums and lists, including dotted ones, round trip. */
+
+#define LISP_BINARY_VERSION 1
+
+typedef struct
+{
+    /* symbol index to its id in the message being written + 1, or 0 */
+    U64 num_ids;
+    U32 * ids;
+
+    /* the symbols of the message being written or read, by id */
+    U64 num_symbols;
+    U64 max_symbols;
+    Expr * symbols;
+
+    /* a message is built here before it is written out */
+    size_t buffer_size;
+    char * buffer;
+
+    /* read strings share equal records, as string literals do */
+    bool intern_strings;
+} BinaryState;
+
+void binary_init(BinaryState * binary);
+void binary_quit(BinaryState * binary);
+
+void lisp_write_binary(SystemState * system, Expr exp, Expr out);
+Expr lisp_read_binary(SystemState * system, char const * data, size_t len, size_t * used);
+
+#if LISP_GLOBAL_API
+void write_binary(Expr exp, Expr out);
+Expr read_binary(char const * data, size_t len, size_t * used);
+#endif
 
 /* util.h */
 
-char * get_temp_buf(size_t size);
+#define LISP_TEMP_BUF_COUNT 4
 
-bool is_named_call(Expr exp, Expr name);
+typedef struct
+{
+    /* scratch buffers handed out in turn, for strings like the result
+       of repr that only need to outlive a few more calls */
+    U64 temp_index;
+    size_t temp_size[LISP_TEMP_BUF_COUNT];
+    char * temp_buf[LISP_TEMP_BUF_COUNT];
+} UtilState;
+
+void util_init(UtilState * util);
+void util_quit(UtilState * util);
+
+char * lisp_get_temp_buf(UtilState * util, size_t size);
+
+U32 hash_bytes(char const * str, size_t len);
+
+bool lisp_is_named_call(ConsState * cons, Expr exp, Expr name);
 
 inline static bool eq(Expr a, Expr b)
 {
     return a == b;
 }
 
+bool lisp_equal(ConsState * cons, Expr a, Expr b);
+
+char const * lisp_repr(SystemState * system, Expr exp);
+void lisp_println(SystemState * system, Expr exp);
+
+Expr lisp_intern(SymbolState * symbol, char const * name);
+Expr lisp_intern_n(SymbolState * symbol, char const * name, size_t len);
+
+Expr lisp_list_1(ConsState * cons, Expr exp1);
+Expr lisp_list_2(ConsState * cons, Expr exp1, Expr exp2);
+Expr lisp_list_3(ConsState * cons, Expr exp1, Expr exp2, Expr exp3);
+
+Expr lisp_nreverse(ConsState * cons, Expr seq);
+Expr lisp_append(ConsState * cons, Expr seq1, Expr seq2);
+
+#if LISP_GLOBAL_API
+char * get_temp_buf(size_t size);
+
+bool is_named_call(Expr exp, Expr name);
+
 bool equal(Expr a, Expr b);
 
 char const * repr(Expr exp);
 void println(Expr exp);
 
 Expr intern(char const * name);
+Expr intern_n(char const * name, size_t len);
 
 Expr list_1(Expr exp1);
 Expr list_2(Expr exp1, Expr exp2);
@@ -458,46 +1025,598 @@ Expr second(Expr seq);
 
 Expr nreverse(Expr seq);
 Expr append(Expr seq1, Expr seq2);
+#endif
 
 /* env.h */
 
-Expr make_env(Expr outer);
+/* frames live in a pool and hold their bindings in one array, in the
+   order they were defined. binding arrays come in power of two sizes
+   and are recycled through per-size free lists.
 
-void env_def(Expr env, Expr var, Expr val);
-void env_del(Expr env, Expr var);
+   global frames also keep a value cell per symbol, indexed by symbol
+   index, so that looking up a global is an array access. */
 
-bool env_can_set(Expr env, Expr var);
+#ifndef LISP_ENV_SIZE_CLASSES
+#define LISP_ENV_SIZE_CLASSES 12
+#endif
 
-Expr env_get(Expr env, Expr var);
-void env_set(Expr env, Expr var, Expr val);
+#define LISP_ENV_DEF_SIZE 4
 
-void env_destructuring_bind(Expr env, Expr vars, Expr vals);
+typedef struct
+{
+    Expr var;
+    Expr val;
+} EnvBinding;
 
-/* core.h */
+typedef struct
+{
+    Expr outer;         /* or the next free frame, index + 1 */
+    U32 num;
+    U32 max;
+    EnvBinding * bindings;
 
-Expr make_core_env();
+    bool global;
+    U64 num_cells;
+    EnvBinding * cells; /* var is nil while the symbol is unbound */
+} EnvFrame;
 
-/* eval.h */
+typedef struct
+{
+    U64 num;
+    U64 max;
+    EnvFrame * frames;
 
-Expr eval(Expr exp, Expr env);
+    U64 free;           /* head of the free list, index + 1 or 0 when empty */
+    U64 num_free;
 
-/* system.h */
+    EnvBinding * free_bindings[LISP_ENV_SIZE_CLASSES];
+} EnvState;
+
+void env_init(EnvState * env);
+void env_quit(EnvState * env);
+
+bool is_env(Expr exp);
+
+Expr lisp_make_env(EnvState * env, ConsState * cons, Expr outer, U64 size);
+EnvFrame * lisp_env_frame(EnvState * env, Expr exp);
+void lisp_env_free(EnvState * env, U64 index);
+
+Expr lisp_make_global_env(SystemState * system);
+
+bool lisp_env_is_global(SystemState * system, Expr env);
+
+void lisp_env_def(SystemState * system, Expr env, Expr var, Expr val);
+void lisp_env_del(SystemState * system, Expr env, Expr var);
+
+bool lisp_env_can_set(SystemState * system, Expr env, Expr var);
+
+Expr lisp_env_get(SystemState * system, Expr env, Expr var);
+void lisp_env_set(SystemState * system, Expr env, Expr var, Expr val);
+
+void lisp_env_destructuring_bind(SystemState * system, Expr env, Expr vars, Expr vals);
+
+Expr lisp_env_get_local(SystemState * system, Expr env, Expr loc);
+
+U64 lisp_env_count_vars(SystemState * system, Expr vars);
+
+#if LISP_GLOBAL_API
+Expr make_env(Expr outer);
+Expr make_env_sized(Expr outer, U64 size);
+Expr make_global_env();
+
+bool env_is_global(Expr env);
+
+void env_def(Expr env, Expr var, Expr val);
+void env_del(Expr env, Expr var);
+
+bool env_can_set(Expr env, Expr var);
+
+Expr env_get(Expr env, Expr var);
+void env_set(Expr env, Expr var, Expr val);
+
+void env_destructuring_bind(Expr env, Expr vars, Expr vals);
+
+Expr env_get_local(Expr env, Expr loc);
+
+U64 env_count_vars(Expr vars);
+#endif
+
+/* closure.h */
+
+/* functions and macros are records in a pool, so telling them apart from
+   other values is a single tag check. the compiled body is cached in the
+   closure, the code itself belongs to the vm. */
+
+enum
+{
+    CLOSURE_FUNCTION,
+    CLOSURE_MACRO,
+};
+
+typedef struct
+{
+    Expr env;           /* or the next free closure, index + 1 */
+    Expr params;
+    Expr body;
+    U64 kind;
+    struct VmCode const * code;
+} Closure;
+
+typedef struct
+{
+    U64 num;
+    U64 max;
+    Closure * closures;
+
+    U64 free;           /* head of the free list, index + 1 or 0 when empty */
+    U64 num_free;
+} ClosureState;
+
+void closure_init(ClosureState * closure);
+void closure_quit(ClosureState * closure);
+
+bool is_closure(Expr exp);
+
+Expr lisp_make_closure(ClosureState * closure, ConsState * cons, U64 kind, Expr env, Expr params, Expr body);
+Closure * lisp_closure(ClosureState * closure, Expr exp);
+void lisp_closure_free(ClosureState * closure, U64 index);
+
+bool lisp_is_function(ClosureState * closure, Expr exp);
+bool lisp_is_macro(ClosureState * closure, Expr exp);
+
+#if LISP_GLOBAL_API
+Expr make_closure(U64 kind, Expr env, Expr params, Expr body);
+Closure * closure_info(Expr exp);
+
+bool is_function(Expr exp);
+bool is_macro(Expr exp);
+Expr closure_env(Expr exp);
+Expr closure_args(Expr exp);
+Expr closure_body(Expr exp);
+#endif
+
+/* core.h */
+
+Expr lisp_make_core_env(SystemState * system);
+
+#if LISP_GLOBAL_API
+Expr make_core_env();
+#endif
+
+bool core_find_special(char const * name, size_t len, char const ** out_name, SpecialFun * out_fun);
+bool core_find_builtin(char const * name, size_t len, char const ** out_name, BuiltinFun * out_fun);
+
+Expr s_quote(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr s_def(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr s_if(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr s_lambda(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr s_syntax(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr s_backquote(SystemState * system, Expr args, Expr kwargs, Expr env);
+
+Expr f_load_file(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr f_compile(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr f_write_binary(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr f_read_binary(SystemState * system, Expr args, Expr kwargs, Expr env);
+Expr f_read_all_parallel(SystemState * system, Expr args, Expr kwargs, Expr env);
+
+/* eval.h */
+
+Expr lisp_eval(SystemState * system, Expr exp, Expr env);
+Expr lisp_apply(SystemState * system, Expr fun, Expr args);
+
+Expr lisp_macro_expand(SystemState * system, Expr macro, Expr exp);
+
+#if LISP_GLOBAL_API
+Expr eval(Expr exp, Expr env);
+Expr apply(Expr fun, Expr args);
+
+Expr macro_expand(Expr macro, Expr exp);
+#endif
+
+/* lexical.h */
+
+/* when a closure is built, references to the parameters of the lambda
+   and of lambdas nested in its body are rewritten into local accessors
+   that name a frame depth and a slot in that frame. the accessor keeps
+   the symbol, so lookups that find a different name in the slot fall
+   back to env_get. the rewrite goes into a copy of the body that the
+   closure keeps, since a form spliced into two lambdas by a macro would
+   need a different rewrite for each. */
+
+#ifndef LISP_LEXICAL_ADDRESSING
+#define LISP_LEXICAL_ADDRESSING 1
+#endif
+
+#define LISP_LOCAL_MAX_DEPTH 0xff
+#define LISP_LOCAL_MAX_SLOT 0xffff
+
+inline static bool is_local(Expr exp)
+{
+    return expr_type(exp) == TYPE_LOCAL;
+}
+
+inline static Expr make_local(U64 depth, U64 slot, Expr name)
+{
+    LISP_ASSERT_DEBUG(depth <= LISP_LOCAL_MAX_DEPTH && slot <= LISP_LOCAL_MAX_SLOT);
+    return make_expr(TYPE_LOCAL, (depth << 48) | (slot << 32) | expr_data(name));
+}
+
+inline static U64 local_depth(Expr exp)
+{
+    return expr_data(exp) >> 48;
+}
+
+inline static U64 local_slot(Expr exp)
+{
+    return (expr_data(exp) >> 32) & LISP_LOCAL_MAX_SLOT;
+}
+
+inline static Expr local_name(Expr exp)
+{
+    return make_expr(TYPE_SYMBOL, expr_data(exp) & 0xffffffff);
+}
+
+typedef struct
+{
+    Expr form;          /* the (<params> . <body>) resolved, nil for an empty slot */
+    Expr resolved;
+} LexicalEntry;
+
+typedef struct
+{
+    /* forms resolved since the last collection, and the copies made of
+       them. copies map to themselves. cleared on every collection, since
+       freed conses are reused. */
+    U64 num;
+    U64 num_slots;
+    LexicalEntry * slots;
+} LexicalState;
+
+void lexical_init(LexicalState * lexical);
+void lexical_quit(LexicalState * lexical);
+
+void lisp_lexical_flush(LexicalState * lexical);
+
+/* the (<params> . <body>) to build a closure from */
+Expr lisp_lexical_resolve(SystemState * system, Expr args, Expr env);
+
+/* exp with local accessors turned back into their symbols, copied only
+   where there are any. macros get their arguments as written. */
+Expr lisp_lexical_unresolve(ConsState * cons, Expr exp);
+
+/* vm.h */
+
+/* closure bodies can be compiled to bytecode for a stack machine. code
+   is kept in a table keyed by the body, so all closures made from one
+   lambda form share it. forms the compiler does not handle are left to
+   eval. the stack and frames of the machine are roots for the collector. */
+
+#ifndef LISP_VM_COMPUTED_GOTO
+#ifdef __GNUC__
+#define LISP_VM_COMPUTED_GOTO 1
+#else
+#define LISP_VM_COMPUTED_GOTO 0
+#endif
+#endif
+
+typedef struct VmCode
+{
+    U32 * ops;
+    U64 num_ops;
+    U64 max_ops;
+
+    Expr * consts;
+    U64 num_consts;
+    U64 max_consts;
+
+    I64 num_params;     /* for flat parameter lists, -1 otherwise */
+} VmCode;
+
+typedef struct
+{
+    Expr body;          /* nil for an empty slot */
+    VmCode * code;
+} VmEntry;
+
+typedef struct
+{
+    VmCode const * code;
+    Expr body;
+    Expr env;
+    U64 pc;
+} VmFrame;
+
+typedef struct
+{
+    bool enabled;       /* compile every closure on its first call */
+
+    U64 num_entries;
+    U64 num_slots;
+    VmEntry * slots;
+
+    U64 num_stack;
+    U64 max_stack;
+    Expr * stack;
+
+    U64 num_frames;
+    U64 max_frames;
+    VmFrame * frames;
+} VmState;
+
+void vm_init(VmState * vm);
+void vm_quit(VmState * vm);
+
+/* drops the code whose body is not set in the cons mark bits */
+void lisp_vm_sweep(VmState * vm, U64 const * marks);
+
+bool lisp_vm_runs(SystemState * system, Expr fun);
+void lisp_vm_compile(SystemState * system, Expr fun);
+Expr lisp_vm_apply(SystemState * system, Expr fun, Expr args);
+
+#if LISP_GLOBAL_API
+bool vm_runs(Expr fun);
+void vm_compile(Expr fun);
+Expr vm_apply(Expr fun, Expr args);
+#endif
+
+/* expand.h */
+
+/* macro expansions are cached per call site, on the assumption that a
+   macro's expansion depends only on the form. an entry is only used
+   while the operator still evaluates to the same macro, so redefining
+   the macro expands the call again. entries live as long as their call
+   site does. */
+
+#ifndef LISP_MACRO_CACHE
+#define LISP_MACRO_CACHE 1
+#endif
+
+typedef struct
+{
+    Expr form;          /* the call site, nil for an empty slot */
+    Expr macro;
+    Expr expansion;
+} ExpandEntry;
+
+typedef struct
+{
+    U64 num;
+    U64 num_slots;
+    ExpandEntry * slots;
+} ExpandState;
+
+void expand_init(ExpandState * expand);
+void expand_quit(ExpandState * expand);
+
+bool lisp_expand_lookup(ExpandState * expand, Expr form, Expr macro, Expr * expansion);
+void lisp_expand_insert(ExpandState * expand, Expr form, Expr macro, Expr expansion);
+
+/* drops the entries whose call site is not set in the cons mark bits */
+void lisp_expand_sweep(ExpandState * expand, U64 const * marks);
+
+/* profile.h */
+
+/* calls of closures and builtins keep a shadow stack of the functions
+   running, which a SIGPROF timer samples. a tail call takes over the
+   entry of the function it leaves. frames past the maximum depth are
+   counted but not kept, so samples there go to the deepest one kept.
+   the handler only writes to memory set aside when sampling starts:
+   each function it sees gets an id from a fixed table, and each sample
+   is stored as its depth followed by the ids. */
+
+#ifndef LISP_PROFILE
+#if defined(__unix__) || defined(__APPLE__)
+#define LISP_PROFILE 1
+#else
+#define LISP_PROFILE 0
+#endif
+#endif
+
+#ifndef LISP_PROFILE_HZ
+#define LISP_PROFILE_HZ 1000
+#endif
+
+#ifndef LISP_PROFILE_TOP
+#define LISP_PROFILE_TOP 20
+#endif
+
+#define LISP_PROFILE_MAX_DEPTH 256
+#define LISP_PROFILE_MAX_FUNS 4096                  /* power of two */
+#define LISP_PROFILE_MAX_FRAMES (4 * 1024 * 1024)   /* ids and depths */
+
+typedef struct
+{
+    volatile sig_atomic_t depth;
+    Expr volatile stack[LISP_PROFILE_MAX_DEPTH];
+
+    Expr * funs;        /* by id, nil for a free slot */
+    U32 * frames;
+    U64 num_frames;
+    U64 num_samples;
+    U64 num_dropped;    /* for lack of room */
+    U64 hz;
+} ProfileState;
+
+void profile_init(ProfileState * profile);
+void profile_quit(ProfileState * profile);
+
+inline static void lisp_profile_enter(ProfileState * profile, Expr fun)
+{
+#if LISP_PROFILE
+    sig_atomic_t const depth = profile->depth;
+    if (depth < LISP_PROFILE_MAX_DEPTH)
+    {
+        profile->stack[depth] = fun;
+    }
+    profile->depth = depth + 1;
+#endif
+}
+
+inline static void lisp_profile_replace(ProfileState * profile, Expr fun)
+{
+#if LISP_PROFILE
+    sig_atomic_t const depth = profile->depth;
+    if (depth > 0 && depth <= LISP_PROFILE_MAX_DEPTH)
+    {
+        profile->stack[depth - 1] = fun;
+    }
+#endif
+}
+
+inline static void lisp_profile_leave(ProfileState * profile)
+{
+#if LISP_PROFILE
+    profile->depth = profile->depth - 1;
+#endif
+}
+
+/* only one system samples at a time, and threads of its own should call
+   profile_block_thread so that the signal is taken on the profiled one */
+void lisp_profile_start(SystemState * system, U64 hz);
+void lisp_profile_stop(SystemState * system);
+void profile_block_thread();
+
+/* reports of the samples taken until the last stop. names come from the
+   bindings visible from env, or the lambda list for closures bound
+   nowhere. */
+void lisp_profile_write_folded(SystemState * system, Expr env, FILE * file);
+void lisp_profile_write_top(SystemState * system, Expr env, U64 num, FILE * file);
+
+#if LISP_GLOBAL_API
+void profile_start(U64 hz);
+void profile_stop();
+void profile_write_folded(Expr env, FILE * file);
+void profile_write_top(Expr env, U64 num, FILE * file);
+#endif
+
+/* system.h */
 
 typedef struct SystemState
 {
+    UtilState util;
     SymbolState symbol;
     ConsState cons;
     StreamState stream;
     GensymState gensym;
     StringState string;
+    LexState lex;
+    BinaryState binary;
     SpecialState special;
     BuiltinState builtin;
+    GcState gc;
+    LexicalState lexical;
+    EnvState env;
+    ClosureState closure;
+    ExpandState expand;
+    VmState vm;
+    ProfileState profile;
 } SystemState;
 
 void system_init(SystemState * system);
 void system_quit(SystemState * system);
 
+/* load_file maps source files into memory where possible, so the reader
+   can slice tokens straight from the mapped bytes */
+#ifndef LISP_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define LISP_MMAP 1
+#else
+#define LISP_MMAP 0
+#endif
+#endif
+
+/* calls fun on each top-level form of a file in order, returns their number */
+typedef void (* LoadFormFun)(SystemState * system, Expr exp, void * data);
+
+U64 lisp_load_forms(SystemState * system, char const * path, LoadFormFun fun, void * data);
+
+/* evaluates the forms of a file in env. without an env the file is data
+   only, and its forms are read in parallel where it pays off */
+void lisp_load_file(SystemState * system, char const * path, Expr env);
+
+/* reads the forms of a file without evaluating them, returns their number */
+U64 lisp_read_file(SystemState * system, char const * path);
+
+/* the list of the forms of a file, read in parallel where it pays off */
+Expr lisp_read_all(SystemState * system, char const * path);
+
+#if LISP_GLOBAL_API
 void load_file(char const * path, Expr env);
+U64 read_file(char const * path);
+Expr read_all(char const * path);
+#endif
+
+/* image.h */
+
+/* an image is a snapshot of the pools of a system and one env, loading
+   it into a fresh system gives the env back without reading any source */
+
+#define LISP_IMAGE_VERSION 2
+
+void lisp_image_dump(SystemState * system, Expr env, char const * path);
+Expr lisp_image_load(SystemState * system, char const * path);
+
+#if LISP_GLOBAL_API
+void image_dump(Expr env, char const * path);
+Expr image_load(char const * path);
+#endif
+
+/* pipeline.h */
+
+/* files are read and parsed on a second thread, into a system of its
+   own, while the forms read so far are evaluated. forms cross over in
+   the binary encoding, in batches, through a bounded queue. they are
+   evaluated in the order of the files, and a read error is raised when
+   evaluation reaches it, so the effects are those of loading the files
+   one after the other, as long as loading a file does not change the
+   files after it. */
+
+#ifndef LISP_PIPELINE
+#if defined(__unix__) || defined(__APPLE__)
+#define LISP_PIPELINE 1
+#else
+#define LISP_PIPELINE 0
+#endif
+#endif
+
+#define LISP_PIPELINE_QUEUE_SIZE 16             /* batches, power of two */
+#define LISP_PIPELINE_BATCH_SIZE (64 * 1024)    /* encoded bytes */
+
+void lisp_load_files_pipelined(SystemState * system, char const * const * paths, U64 num, Expr env);
+
+#if LISP_GLOBAL_API
+void load_files_pipelined(char const * const * paths, U64 num, Expr env);
+#endif
+
+/* parallel.h */
+
+/* input in memory is split after top-level lists by a scan that knows
+   strings and comments. the first chunk is read into the system itself,
+   the others are read at the same time on threads of their own, each
+   into a system of its own, and copied over in order. symbols and
+   strings are made in the same order as by reading from the start. */
+
+#ifndef LISP_PARALLEL_READ
+#define LISP_PARALLEL_READ LISP_PIPELINE
+#endif
+
+#define LISP_PARALLEL_MAX_CHUNKS 16
+#define LISP_PARALLEL_MIN_CHUNK (1024 * 1024)
+
+/* the number of chunks worth reading len bytes in, one per cpu at most */
+U64 lisp_parallel_chunks(size_t len);
+
+/* splits data into at most num chunks, ends gets the end of each, and
+   returns how many there are */
+U64 lisp_parallel_split(char const * data, size_t len, U64 num, size_t * ends);
+
+/* hands the forms in data to fun in order, read in at most num chunks,
+   and returns their number. the first chunk is read on the calling
+   thread while the others are read ahead. */
+U64 lisp_load_parallel(SystemState * system, char const * data, size_t len, U64 num, LoadFormFun fun, void * arg);
+
+/* the list of the forms in data, read in at most num chunks */
+Expr lisp_read_all_parallel(SystemState * system, char const * data, size_t len, U64 num);
 
 /* global.h */
 
@@ -508,11 +1627,131 @@ extern SystemState global;
 void global_init();
 void global_quit();
 
+inline static Expr cons(Expr a, Expr b)
+{
+    return lisp_cons(&global.cons, a, b);
+}
+
+inline static Expr car(Expr exp)
+{
+    return lisp_car(&global.cons, exp);
+}
+
+inline static Expr cdr(Expr exp)
+{
+    return lisp_cdr(&global.cons, exp);
+}
+
+inline static void rplaca(Expr exp, Expr val)
+{
+    lisp_rplaca(&global.cons, exp, val);
+}
+
+inline static void rplacd(Expr exp, Expr val)
+{
+    lisp_rplacd(&global.cons, exp, val);
+}
+
+inline static Expr caar(Expr exp)
+{
+    return car(car(exp));
+}
+
+inline static Expr cadr(Expr exp)
+{
+    return car(cdr(exp));
+}
+
+inline static Expr cdar(Expr exp)
+{
+    return cdr(car(exp));
+}
+
+inline static Expr cddr(Expr exp)
+{
+    return cdr(cdr(exp));
+}
+
+inline static Expr caddr(Expr exp)
+{
+    return car(cdr(cdr(exp)));
+}
+
+inline static Expr cdddr(Expr exp)
+{
+    return cdr(cdr(cdr(exp)));
+}
+
+inline static Expr cadddr(Expr exp)
+{
+    return car(cdr(cdr(cdr(exp))));
+}
+
+inline static Expr cddddr(Expr exp)
+{
+    return cdr(cdr(cdr(cdr(exp))));
+}
+
+inline static void gc_push_root(Expr * root)
+{
+    lisp_gc_push_root(&global.gc, root);
+}
+
+inline static void gc_pop_roots(U64 count)
+{
+    lisp_gc_pop_roots(&global.gc, count);
+}
+
+inline static void gc_collect()
+{
+    lisp_gc_collect(&global);
+}
+
+inline static void gc_maybe_collect()
+{
+    lisp_gc_maybe_collect(&global, &global.cons);
+}
+
 inline static bool stream_at_end(Expr exp)
 {
     return lisp_stream_at_end(&global.stream, exp);
 }
 
+inline static char stream_peek_char(Expr exp)
+{
+    return lisp_stream_peek_char(&global.stream, exp);
+}
+
+inline static void stream_skip_char(Expr exp)
+{
+    lisp_stream_skip_char(&global.stream, exp);
+}
+
+inline static char stream_get_char(Expr exp)
+{
+    return lisp_stream_get_char(&global.stream, exp);
+}
+
+inline static void stream_put_char(Expr exp, char ch)
+{
+    lisp_stream_put_char(&global.stream, exp, ch);
+}
+
+inline static bool expand_lookup(Expr form, Expr macro, Expr * expansion)
+{
+    return lisp_expand_lookup(&global.expand, form, macro, expansion);
+}
+
+inline static void expand_insert(Expr form, Expr macro, Expr expansion)
+{
+    lisp_expand_insert(&global.expand, form, macro, expansion);
+}
+
+inline static Expr lexical_resolve(Expr args, Expr env)
+{
+    return lisp_lexical_resolve(&global, args, env);
+}
+
 inline static char const * builtin_name(Expr exp)
 {
     return lisp_builtin_name(&global.builtin, exp);
@@ -35,98 +35,37 @@ static void _cons_maybe_realloc(ConsState * cons)
     LISP_FAIL("cons ran over memory budget\n");
 }
 
-static struct Pair * _cons_lookup(ConsState * cons, U64 index)
-{
-    LISP_ASSERT_DEBUG(index < cons->num);
-    return &cons->pairs[index];
-}
-
 void cons_init(ConsState * cons)
 {
     memset(cons, 0, sizeof(ConsState));
+    cons->threshold = LISP_GC_MIN_THRESHOLD;
 }
 
 void cons_quit(ConsState * cons)
 {
-}
-
-bool is_cons(Expr exp)
-{
-    return expr_type(exp) == TYPE_CONS;
+    LISP_FREE(cons->pairs);
+    memset(cons, 0, sizeof(ConsState));
 }
 
 Expr lisp_cons(ConsState * cons, Expr a, Expr b)
 {
-    _cons_maybe_realloc(cons);
+    lisp_cons_count_alloc(cons, 1);
+
+    U64 index;
+    if (cons->free)
+    {
+        index = cons->free - 1;
+        cons->free = cons->pairs[index].b;
+        --cons->num_free;
+    }
+    else
+    {
+        _cons_maybe_realloc(cons);
+        index = cons->num++;
+    }
 
-    U64 const index = cons->num++;
-    struct Pair * pair = _cons_lookup(cons, index);
+    struct Pair * pair = cons->pairs + index;
     pair->a = a;
     pair->b = b;
     return make_expr(TYPE_CONS, index);
 }
-
-Expr lisp_car(ConsState * cons, Expr exp)
-{
-    LISP_ASSERT(is_cons(exp));
-
-    U64 const index = expr_data(exp);
-    struct Pair * pair = _cons_lookup(cons, index);
-    return pair->a;
-}
-
-Expr lisp_cdr(ConsState * cons, Expr exp)
-{
-    LISP_ASSERT(is_cons(exp));
-
-    U64 const index = expr_data(exp);
-    struct Pair * pair = _cons_lookup(cons, index);
-    return pair->b;
-}
-
-void lisp_rplaca(ConsState * cons, Expr exp, Expr val)
-{
-    LISP_ASSERT(is_cons(exp));
-
-    U64 const index = expr_data(exp);
-    struct Pair * pair = _cons_lookup(cons, index);
-    pair->a = val;
-}
-
-void lisp_rplacd(ConsState * cons, Expr exp, Expr val)
-{
-    LISP_ASSERT(is_cons(exp));
-
-    U64 const index = expr_data(exp);
-    struct Pair * pair = _cons_lookup(cons, index);
-    pair->b = val;
-}
-
-#if LISP_GLOBAL_API
-
-Expr cons(Expr a, Expr b)
-{
-    return lisp_cons(&global.cons, a, b);
-}
-
-Expr car(Expr exp)
-{
-    return lisp_car(&global.cons, exp);
-}
-
-Expr cdr(Expr exp)
-{
-    return lisp_cdr(&global.cons, exp);
-}
-
-void rplaca(Expr exp, Expr val)
-{
-    lisp_rplaca(&global.cons, exp, val);
-}
-
-void rplacd(Expr exp, Expr val)
-{
-    lisp_rplacd(&global.cons, exp, val);
-}
-
-#endif
@@ -1,37 +1,38 @@
-
 #include "common.h"
 
-static void env_defun(Expr env, char const * name, BuiltinFun fun)
+static void env_defun(SystemState * sys, Expr env, char const * name, BuiltinFun fun)
 {
-    env_def(env, intern(name), make_builtin(name, fun));
+    lisp_env_def(sys, env, lisp_intern(&sys->symbol, name), lisp_make_builtin(&sys->builtin, name, fun));
 }
 
-static void env_defspecial(Expr env, char const * name, SpecialFun fun)
+static void env_defspecial(SystemState * sys, Expr env, char const * name, SpecialFun fun)
 {
-    env_def(env, intern(name), make_special(name, fun));
+    lisp_env_def(sys, env, lisp_intern(&sys->symbol, name), lisp_make_special(&sys->special, name, fun));
 }
 
-Expr s_quote(Expr args, Expr kwargs, Expr env)
+Expr s_quote(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    return car(args);
+    return lisp_car(&sys->cons, args);
 }
 
-Expr s_def(Expr args, Expr kwargs, Expr env)
+Expr s_def(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
     // TODO look for env in kwargs
-    env_def(env, car(args), eval(cadr(args), env));
+    ConsState * cons = &sys->cons;
+    lisp_env_def(sys, env, lisp_car(cons, args), lisp_eval(sys, lisp_cadr(cons, args), env));
     return nil;
 }
 
-Expr s_if(Expr args, Expr kwargs, Expr env)
+Expr s_if(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    if (eval(car(args), env) != nil)
+    ConsState * cons = &sys->cons;
+    if (lisp_eval(sys, lisp_car(cons, args), env) != nil)
     {
-        return eval(cadr(args), env);
+        return lisp_eval(sys, lisp_cadr(cons, args), env);
     }
-    else if (cddr(args))
+    else if (lisp_cddr(cons, args))
     {
-        return eval(caddr(args), env);
+        return lisp_eval(sys, lisp_caddr(cons, args), env);
     }
     else
     {
@@ -39,57 +40,81 @@ Expr s_if(Expr args, Expr kwargs, Expr env)
     }
 }
 
-Expr s_lambda(Expr args, Expr kwargs, Expr env)
+Expr s_lambda(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    Expr const fun_args = car(args);
-    Expr const fun_body = cdr(args);
-    return cons(intern("lit"), cons(intern("clo"), cons(env, cons(fun_args, fun_body))));
+    ConsState * cons = &sys->cons;
+    Expr const resolved = lisp_lexical_resolve(sys, args, env);
+    return lisp_make_closure(&sys->closure, cons, CLOSURE_FUNCTION, env, lisp_car(cons, resolved), lisp_cdr(cons, resolved));
 }
 
-bool is_unquote(Expr exp)
+static bool is_unquote(ConsState * cons, Expr exp)
 {
-    return is_named_call(exp, LISP_SYM_UNQUOTE);
+    return lisp_is_named_call(cons, exp, LISP_SYM_UNQUOTE);
 }
 
-bool is_unquote_splicing(Expr exp)
+static bool is_unquote_splicing(ConsState * cons, Expr exp)
 {
-    return is_named_call(exp, LISP_SYM_UNQUOTE_SPLICING);
+    return lisp_is_named_call(cons, exp, LISP_SYM_UNQUOTE_SPLICING);
 }
 
-static Expr backquote(Expr exp, Expr env);
+static Expr backquote(SystemState * sys, Expr exp, Expr env);
+
+static void backquote_push(ConsState * cons, Expr * head, Expr * tail, Expr exp)
+{
+    Expr const next = lisp_cons(cons, exp, nil);
+    if (*head)
+    {
+        lisp_rplacd(cons, *tail, next);
+    }
+    else
+    {
+        *head = next;
+    }
+    *tail = next;
+}
 
-static Expr backquote_list(Expr seq, Expr env)
+static Expr backquote_list(SystemState * sys, Expr seq, Expr env)
 {
-    if (seq)
+    /* partial results are rooted since every step may call eval */
+    ConsState * cons = &sys->cons;
+    Expr head = nil;
+    Expr tail = nil;
+    Expr val = nil;
+    lisp_gc_push_root(&sys->gc, &head);
+    lisp_gc_push_root(&sys->gc, &val);
+
+    for (Expr tmp = seq; tmp; tmp = lisp_cdr(cons, tmp))
     {
-        Expr item = car(seq);
-        Expr rest = cdr(seq);
-        if (is_unquote_splicing(item))
+        Expr const item = lisp_car(cons, tmp);
+        if (is_unquote_splicing(cons, item))
         {
-            return append(eval(cadr(item), env), backquote_list(rest, env));
+            for (val = lisp_eval(sys, lisp_cadr(cons, item), env); val; val = lisp_cdr(cons, val))
+            {
+                backquote_push(cons, &head, &tail, lisp_car(cons, val));
+            }
         }
         else
         {
-            return cons(backquote(item, env), backquote_list(rest, env));
+            val = backquote(sys, item, env);
+            backquote_push(cons, &head, &tail, val);
         }
     }
-    else
-    {
-        return nil;
-    }
+
+    lisp_gc_pop_roots(&sys->gc, 2);
+    return head;
 }
 
-static Expr backquote(Expr exp, Expr env)
+static Expr backquote(SystemState * sys, Expr exp, Expr env)
 {
     if (is_cons(exp))
     {
-        if (is_unquote(exp))
+        if (is_unquote(&sys->cons, exp))
         {
-            return eval(cadr(exp), env);
+            return lisp_eval(sys, lisp_cadr(&sys->cons, exp), env);
         }
         else
         {
-            return backquote_list(exp, env);
+            return backquote_list(sys, exp, env);
         }
     }
     else
@@ -98,59 +123,53 @@ static Expr backquote(Expr exp, Expr env)
     }
 }
 
-Expr s_backquote(Expr args, Expr kwargs, Expr env)
+Expr s_backquote(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    return backquote(car(args), env);
+    return backquote(sys, lisp_car(&sys->cons, args), env);
 }
 
-Expr s_syntax(Expr args, Expr kwargs, Expr env)
+Expr s_syntax(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    Expr const fun_args = car(args);
-    Expr const fun_body = cdr(args);
-    return cons(intern("lit"), cons(intern("mac"), cons(env, cons(fun_args, fun_body))));
+    ConsState * cons = &sys->cons;
+    Expr const resolved = lisp_lexical_resolve(sys, args, env);
+    return lisp_make_closure(&sys->closure, cons, CLOSURE_MACRO, env, lisp_car(cons, resolved), lisp_cdr(cons, resolved));
 }
 
-Expr f_eq(Expr args, Expr kwargs, Expr env)
+static void check_two_args(SystemState * sys, char const * name, Expr args)
 {
-    if (is_nil(args))
+    if (is_nil(args) || is_nil(lisp_cdr(&sys->cons, args)))
     {
-        LISP_FAIL("not enough arguments in call %s\n", repr(cons(intern("eq"), args)));
+        Expr const call = lisp_cons(&sys->cons, lisp_intern(&sys->symbol, name), args);
+        LISP_FAIL("not enough arguments in call %s\n", lisp_repr(sys, call));
     }
-    Expr prv = car(args);
-    Expr tmp = cdr(args);
-    if (is_nil(tmp))
-    {
-        LISP_FAIL("not enough arguments in call %s\n", repr(cons(intern("eq"), args)));
-    }
-    for (; tmp; tmp = cdr(tmp))
+}
+
+Expr f_eq(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    check_two_args(sys, "eq", args);
+    Expr prv = lisp_car(cons, args);
+    for (Expr tmp = lisp_cdr(cons, args); tmp; tmp = lisp_cdr(cons, tmp))
     {
-        Expr const exp = car(tmp);
+        Expr const exp = lisp_car(cons, tmp);
         if (prv != exp)
         {
             return nil;
         }
         prv = exp;
     }
-    return intern("t");
+    return LISP_SYMBOL_T;
 }
 
-Expr f_equal(Expr args, Expr kwargs, Expr env)
+Expr f_equal(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    if (is_nil(args))
-    {
-        LISP_FAIL("not enough arguments in call %s\n", repr(cons(intern("equal"), args)));
-    }
-    Expr prv = car(args);
-    Expr tmp = cdr(args);
-    if (is_nil(tmp))
+    ConsState * cons = &sys->cons;
+    check_two_args(sys, "equal", args);
+    Expr prv = lisp_car(cons, args);
+    for (Expr tmp = lisp_cdr(cons, args); tmp; tmp = lisp_cdr(cons, tmp))
     {
-        LISP_FAIL("not enough arguments in call %s\n", repr(cons(intern("equal"), args)));
-    }
-
-    for (; tmp; tmp = cdr(tmp))
-    {
-        Expr const exp = car(tmp);
-        if (!equal(prv, exp))
+        Expr const exp = lisp_car(cons, tmp);
+        if (!lisp_equal(cons, prv, exp))
         {
             return nil;
         }
@@ -160,84 +179,360 @@ Expr f_equal(Expr args, Expr kwargs, Expr env)
     return LISP_SYMBOL_T;
 }
 
-Expr f_cons(Expr args, Expr kwargs, Expr env)
+Expr f_cons(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
+    ConsState * cons = &sys->cons;
     LISP_ASSERT(args != nil);
-    LISP_ASSERT(cdr(args) != nil);
-    LISP_ASSERT(cddr(args) == nil);
+    LISP_ASSERT(lisp_cdr(cons, args) != nil);
+    LISP_ASSERT(lisp_cddr(cons, args) == nil);
 
-    Expr const exp1 = car(args);
-    Expr const exp2 = cadr(args);
-    return cons(exp1, exp2);
+    Expr const exp1 = lisp_car(cons, args);
+    Expr const exp2 = lisp_cadr(cons, args);
+    return lisp_cons(cons, exp1, exp2);
 }
 
-Expr f_car(Expr args, Expr kwargs, Expr env)
+Expr f_car(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
+    ConsState * cons = &sys->cons;
     LISP_ASSERT(args != nil);
-    LISP_ASSERT(cdr(args) == nil);
+    LISP_ASSERT(lisp_cdr(cons, args) == nil);
 
-    Expr const exp1 = car(args);
-    return car(exp1);
+    Expr const exp1 = lisp_car(cons, args);
+    return lisp_car(cons, exp1);
 }
 
-Expr f_cdr(Expr args, Expr kwargs, Expr env)
+Expr f_cdr(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
+    ConsState * cons = &sys->cons;
     LISP_ASSERT(args != nil);
-    LISP_ASSERT(cdr(args) == nil);
+    LISP_ASSERT(lisp_cdr(cons, args) == nil);
 
-    Expr const exp1 = car(args);
-    return cdr(exp1);
+    Expr const exp1 = lisp_car(cons, args);
+    return lisp_cdr(cons, exp1);
 }
 
-Expr f_println(Expr args, Expr kwargs, Expr env)
+Expr f_println(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    Expr out = global.stream.stdout;
-    for (Expr tmp = args; tmp; tmp = cdr(tmp))
+    Expr out = sys->stream.stdout;
+    for (Expr tmp = args; tmp; tmp = lisp_cdr(&sys->cons, tmp))
     {
         if (tmp != args)
         {
-            stream_put_char(out, ' ');
+            lisp_stream_put_char(&sys->stream, out, ' ');
         }
-        Expr exp = car(tmp);
-        render_expr(exp, out);
+        Expr exp = lisp_car(&sys->cons, tmp);
+        lisp_render_expr(sys, exp, out);
     }
-    stream_put_char(out, '\n');
+    lisp_stream_put_char(&sys->stream, out, '\n');
     return nil;
 }
 
-Expr f_gensym(Expr args, Expr kwargs, Expr env)
+Expr f_gensym(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    return lisp_gensym(&sys->gensym);
+}
+
+static Expr string_arg(SystemState * sys, Expr exp)
 {
-    return lisp_gensym(&global.gensym);
+    if (!is_string(exp))
+    {
+        LISP_FAIL("expected string, got %s\n", lisp_repr(sys, exp));
+    }
+    return exp;
 }
 
-Expr f_load_file(Expr args, Expr kwargs, Expr env)
+Expr f_load_file(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    load_file(string_value(first(args)), env);
+    Expr const path = string_arg(sys, lisp_car(&sys->cons, args));
+    lisp_load_file(sys, lisp_string_value(&sys->string, path), env);
     return nil;
 }
 
-Expr make_core_env()
+Expr f_compile(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    Expr const fun = lisp_car(&sys->cons, args);
+    if (!lisp_is_function(&sys->closure, fun))
+    {
+        LISP_FAIL("expected function, got %s\n", lisp_repr(sys, fun));
+    }
+    lisp_vm_compile(sys, fun);
+    return fun;
+}
+
+/* the encoding is carried in a string, which may hold any bytes */
+Expr f_write_binary(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    Expr const out = lisp_make_string_output_stream(&sys->stream);
+    lisp_write_binary(sys, lisp_car(&sys->cons, args), out);
+    size_t len = 0;
+    char const * data = lisp_stream_output(&sys->stream, out, &len);
+    Expr const ret = lisp_make_string_n(&sys->string, data, len);
+    lisp_stream_release(&sys->stream, out);
+    return ret;
+}
+
+Expr f_read_binary(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    Expr const str = string_arg(sys, lisp_car(&sys->cons, args));
+    return lisp_read_binary(sys, lisp_string_value(&sys->string, str), lisp_string_length(&sys->string, str), NULL);
+}
+
+Expr f_read_all_parallel(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    Expr const path = string_arg(sys, lisp_car(&sys->cons, args));
+    return lisp_read_all(sys, lisp_string_value(&sys->string, path));
+}
+
+static I64 fixnum_arg(SystemState * sys, Expr exp)
+{
+    if (!is_fixnum(exp))
+    {
+        LISP_FAIL("expected number, got %s\n", lisp_repr(sys, exp));
+    }
+    return fixnum_value(exp);
+}
+
+static Expr make_fixnum_checked(I64 val)
+{
+    if (!fixnum_in_range(val))
+    {
+        LISP_FAIL("integer overflow\n");
+    }
+    return make_fixnum(val);
+}
+
+/* operands are at most 56 bits wide, so sums and differences fit in an I64 */
+
+Expr f_add(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    I64 ret = 0;
+    for (Expr tmp = args; tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        ret = fixnum_value(make_fixnum_checked(ret + fixnum_arg(sys, lisp_car(cons, tmp))));
+    }
+    return make_fixnum(ret);
+}
+
+Expr f_sub(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    LISP_ASSERT(args != nil);
+
+    I64 ret = fixnum_arg(sys, lisp_car(cons, args));
+    if (lisp_cdr(cons, args) == nil)
+    {
+        return make_fixnum_checked(-ret);
+    }
+    for (Expr tmp = lisp_cdr(cons, args); tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        ret = fixnum_value(make_fixnum_checked(ret - fixnum_arg(sys, lisp_car(cons, tmp))));
+    }
+    return make_fixnum(ret);
+}
+
+Expr f_mul(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    I64 ret = 1;
+    for (Expr tmp = args; tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        I64 const val = fixnum_arg(sys, lisp_car(cons, tmp));
+        I64 prod = 0;
+#ifdef __GNUC__
+        if (__builtin_mul_overflow(ret, val, &prod))
+        {
+            LISP_FAIL("integer overflow\n");
+        }
+#else
+        if (val != 0 && (ret > INT64_MAX / (val < 0 ? -val : val) || ret < -(INT64_MAX / (val < 0 ? -val : val))))
+        {
+            LISP_FAIL("integer overflow\n");
+        }
+        prod = ret * val;
+#endif
+        ret = fixnum_value(make_fixnum_checked(prod));
+    }
+    return make_fixnum(ret);
+}
+
+Expr f_div(SystemState * sys, Expr args, Expr kwargs, Expr env)
 {
-    Expr env = make_env(nil);
+    ConsState * cons = &sys->cons;
+    LISP_ASSERT(args != nil);
+
+    I64 ret = fixnum_arg(sys, lisp_car(cons, args));
+    for (Expr tmp = lisp_cdr(cons, args); tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        I64 const val = fixnum_arg(sys, lisp_car(cons, tmp));
+        if (val == 0)
+        {
+            LISP_FAIL("division by zero\n");
+        }
+        ret = fixnum_value(make_fixnum_checked(ret / val));
+    }
+    return make_fixnum(ret);
+}
+
+Expr f_mod(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    LISP_ASSERT(args != nil);
+    LISP_ASSERT(lisp_cdr(cons, args) != nil);
+    LISP_ASSERT(lisp_cddr(cons, args) == nil);
+
+    I64 const a = fixnum_arg(sys, lisp_car(cons, args));
+    I64 const b = fixnum_arg(sys, lisp_cadr(cons, args));
+    if (b == 0)
+    {
+        LISP_FAIL("division by zero\n");
+    }
+
+    /* floored, so the result takes the sign of the divisor */
+    I64 ret = a % b;
+    if (ret != 0 && (ret < 0) != (b < 0))
+    {
+        ret += b;
+    }
+    return make_fixnum(ret);
+}
+
+Expr f_num_eq(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    LISP_ASSERT(args != nil);
+
+    I64 const val = fixnum_arg(sys, lisp_car(cons, args));
+    for (Expr tmp = lisp_cdr(cons, args); tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        if (fixnum_arg(sys, lisp_car(cons, tmp)) != val)
+        {
+            return nil;
+        }
+    }
+    return LISP_SYMBOL_T;
+}
+
+Expr f_num_lt(SystemState * sys, Expr args, Expr kwargs, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    LISP_ASSERT(args != nil);
+
+    I64 prev = fixnum_arg(sys, lisp_car(cons, args));
+    for (Expr tmp = lisp_cdr(cons, args); tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        I64 const val = fixnum_arg(sys, lisp_car(cons, tmp));
+        if (!(prev < val))
+        {
+            return nil;
+        }
+        prev = val;
+    }
+    return LISP_SYMBOL_T;
+}
 
-    env_def(env, intern("t"), intern("t"));
+/* the functions of the core env by name, also used to find them again
+   when an image is loaded */
 
-    env_defspecial(env, "quote", s_quote);
-    env_defspecial(env, "if", s_if);
-    env_defspecial(env, "def", s_def);
-    env_defspecial(env, "lambda", s_lambda);
-    env_defspecial(env, "syntax", s_syntax);
-    env_defspecial(env, "backquote", s_backquote);
+static struct
+{
+    char const * name;
+    SpecialFun fun;
+} const core_specials[] =
+{
+    { "quote", s_quote },
+    { "if", s_if },
+    { "def", s_def },
+    { "lambda", s_lambda },
+    { "syntax", s_syntax },
+    { "backquote", s_backquote },
+};
+
+static struct
+{
+    char const * name;
+    BuiltinFun fun;
+} const core_builtins[] =
+{
+    { "eq", f_eq },
+    { "equal", f_equal },
+    { "cons", f_cons },
+    { "car", f_car },
+    { "cdr", f_cdr },
+    { "println", f_println },
+
+    { "+", f_add },
+    { "-", f_sub },
+    { "*", f_mul },
+    { "/", f_div },
+    { "mod", f_mod },
+    { "=", f_num_eq },
+    { "<", f_num_lt },
+
+    { "gensym", f_gensym },
+    { "load-file", f_load_file },
+    { "compile", f_compile },
+    { "write-binary", f_write_binary },
+    { "read-binary", f_read_binary },
+    { "read-all-parallel", f_read_all_parallel },
+};
+
+#define LISP_COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+Expr lisp_make_core_env(SystemState * sys)
+{
+    Expr env = lisp_make_global_env(sys);
 
-    env_defun(env, "eq", f_eq);
-    env_defun(env, "equal", f_equal);
-    env_defun(env, "cons", f_cons);
-    env_defun(env, "car", f_car);
-    env_defun(env, "cdr", f_cdr);
-    env_defun(env, "println", f_println);
+    lisp_env_def(sys, env, LISP_SYMBOL_T, LISP_SYMBOL_T);
 
-    env_defun(env, "gensym", f_gensym);
-    env_defun(env, "load-file", f_load_file);
+    for (size_t i = 0; i < LISP_COUNT_OF(core_specials); i++)
+    {
+        env_defspecial(sys, env, core_specials[i].name, core_specials[i].fun);
+    }
+
+    for (size_t i = 0; i < LISP_COUNT_OF(core_builtins); i++)
+    {
+        env_defun(sys, env, core_builtins[i].name, core_builtins[i].fun);
+    }
 
     return env;
 }
+
+/* finds the special operator or function registered under name, the
+   name returned is the one registered, so it outlives the caller's */
+bool core_find_special(char const * name, size_t len, char const ** out_name, SpecialFun * out_fun)
+{
+    for (size_t i = 0; i < LISP_COUNT_OF(core_specials); i++)
+    {
+        if (strlen(core_specials[i].name) == len && !memcmp(core_specials[i].name, name, len))
+        {
+            *out_name = core_specials[i].name;
+            *out_fun = core_specials[i].fun;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool core_find_builtin(char const * name, size_t len, char const ** out_name, BuiltinFun * out_fun)
+{
+    for (size_t i = 0; i < LISP_COUNT_OF(core_builtins); i++)
+    {
+        if (strlen(core_builtins[i].name) == len && !memcmp(core_builtins[i].name, name, len))
+        {
+            *out_name = core_builtins[i].name;
+            *out_fun = core_builtins[i].fun;
+            return true;
+        }
+    }
+    return false;
+}
+
+#if LISP_GLOBAL_API
+
+Expr make_core_env()
+{
+    return lisp_make_core_env(&global);
+}
+
+#endif
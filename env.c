@@ -1,160 +1,371 @@
 
 #include "common.h"
 
-static Expr env_vars(Expr env);
-static void env_set_vars(Expr env, Expr vars);
-static Expr env_vals(Expr env);
-static void env_set_vals(Expr env, Expr vals);
-static Expr env_outer(Expr env);
+static U64 _env_size_class(U64 size)
+{
+    U64 ret = 0;
+    while (((U64) 1 << ret) < size)
+    {
+        ++ret;
+    }
+    return ret;
+}
 
-static Expr _env_find_local(Expr env, Expr var)
+static EnvBinding * _env_alloc_bindings(EnvState * env, U64 max)
 {
-    Expr vars = env_vars(env);
-    Expr vals = env_vals(env);
-    while (vars)
+    if (max == 0)
     {
-        if (car(vars) == var)
-        {
-            return vals;
-        }
-        vars = cdr(vars);
-        vals = cdr(vals);
+        return NULL;
     }
-    return nil;
+
+    U64 const size_class = _env_size_class(max);
+    if (size_class < LISP_ENV_SIZE_CLASSES && env->free_bindings[size_class])
+    {
+        EnvBinding * ret = env->free_bindings[size_class];
+        memcpy(&env->free_bindings[size_class], ret, sizeof(EnvBinding *));
+        return ret;
+    }
+
+    EnvBinding * ret = (EnvBinding *) LISP_MALLOC(sizeof(EnvBinding) * max);
+    if (!ret)
+    {
+        LISP_FAIL("env memory allocation failed\n");
+    }
+    return ret;
 }
 
-static Expr _env_find_global(Expr env, Expr var)
+static void _env_free_bindings(EnvState * env, EnvBinding * bindings, U64 max)
 {
-    while (env)
+    if (!bindings)
     {
-        Expr const vals = _env_find_local(env, var);
-        if (vals)
-        {
-            return vals;
-        }
-        else
+        return;
+    }
+
+    U64 const size_class = _env_size_class(max);
+    if (size_class < LISP_ENV_SIZE_CLASSES)
+    {
+        /* the free list is threaded through the first binding */
+        memcpy(bindings, &env->free_bindings[size_class], sizeof(EnvBinding *));
+        env->free_bindings[size_class] = bindings;
+    }
+    else
+    {
+        LISP_FREE(bindings);
+    }
+}
+
+static void _env_maybe_realloc(EnvState * env)
+{
+    if (env->num < env->max)
+    {
+        return;
+    }
+
+    env->max = env->max ? env->max * 2 : 64;
+    env->frames = (EnvFrame *) LISP_REALLOC(env->frames, sizeof(EnvFrame) * env->max);
+    if (!env->frames)
+    {
+        LISP_FAIL("env memory allocation failed\n");
+    }
+}
+
+void env_init(EnvState * env)
+{
+    memset(env, 0, sizeof(EnvState));
+}
+
+void env_quit(EnvState * env)
+{
+    for (U64 i = 0; i < env->num; i++)
+    {
+        LISP_FREE(env->frames[i].bindings);
+        LISP_FREE(env->frames[i].cells);
+    }
+    for (U64 i = 0; i < LISP_ENV_SIZE_CLASSES; i++)
+    {
+        while (env->free_bindings[i])
         {
-            env = env_outer(env);
+            EnvBinding * next = NULL;
+            memcpy(&next, env->free_bindings[i], sizeof(EnvBinding *));
+            LISP_FREE(env->free_bindings[i]);
+            env->free_bindings[i] = next;
         }
     }
-    return nil;
+    LISP_FREE(env->frames);
+    memset(env, 0, sizeof(EnvState));
 }
 
-Expr make_env(Expr outer)
+bool is_env(Expr exp)
 {
-    // ((<vars> . <vals>) . <outer>)
-    // TODO add dummy conses as sentinels for vars and vals
-    return cons(cons(nil, nil), outer);
+    return expr_type(exp) == TYPE_ENV;
 }
 
-static Expr env_vars(Expr env)
+Expr lisp_make_env(EnvState * env, ConsState * cons, Expr outer, U64 size)
 {
-    return caar(env);
+    /* sizes are rounded up so that freed arrays fit any frame of the class */
+    U64 const max = size ? (U64) 1 << _env_size_class(size) : 0;
+    lisp_cons_count_alloc(cons, 1 + max);
+
+    U64 index;
+    if (env->free)
+    {
+        index = env->free - 1;
+        env->free = env->frames[index].outer;
+        --env->num_free;
+    }
+    else
+    {
+        _env_maybe_realloc(env);
+        index = env->num++;
+    }
+
+    EnvFrame * frame = env->frames + index;
+    frame->outer = outer;
+    frame->num = 0;
+    frame->max = (U32) max;
+    frame->bindings = _env_alloc_bindings(env, max);
+    frame->global = false;
+    frame->num_cells = 0;
+    frame->cells = NULL;
+    return make_expr(TYPE_ENV, index);
 }
 
-static void env_set_vars(Expr env, Expr vars)
+EnvFrame * lisp_env_frame(EnvState * env, Expr exp)
 {
-    rplaca(car(env), vars);
+    LISP_ASSERT(is_env(exp));
+    U64 const index = expr_data(exp);
+    LISP_ASSERT_DEBUG(index < env->num);
+    return env->frames + index;
 }
 
-static Expr env_vals(Expr env)
+void lisp_env_free(EnvState * env, U64 index)
 {
-    return cdar(env);
+    EnvFrame * frame = env->frames + index;
+    _env_free_bindings(env, frame->bindings, frame->max);
+    frame->bindings = NULL;
+    frame->num = 0;
+    frame->max = 0;
+    LISP_FREE(frame->cells);
+    frame->cells = NULL;
+    frame->num_cells = 0;
+    frame->global = false;
+    frame->outer = env->free;
+    env->free = index + 1;
+    ++env->num_free;
 }
 
-static void env_set_vals(Expr env, Expr vals)
+static EnvFrame * _env_frame(SystemState * sys, Expr env)
 {
-    rplacd(car(env), vals);
+    return lisp_env_frame(&sys->env, env);
 }
 
-static Expr env_outer(Expr env)
+static EnvBinding * _env_find_cell(EnvFrame * frame, Expr var)
 {
-    return cdr(env);
+    U64 const index = expr_data(var);
+    if (index < frame->num_cells && frame->cells[index].var == var)
+    {
+        return frame->cells + index;
+    }
+    return NULL;
 }
 
-void env_def(Expr env, Expr var, Expr val)
+static EnvBinding * _env_make_cell(SystemState * sys, EnvFrame * frame, Expr var)
 {
-    Expr const vals = _env_find_local(env, var);
-    if (vals)
+    U64 const index = expr_data(var);
+    if (index >= frame->num_cells)
     {
-        rplaca(vals, val);
+        U64 num = frame->num_cells ? frame->num_cells * 2 : sys->symbol.num;
+        if (num <= index)
+        {
+            num = index + 1;
+        }
+        frame->cells = (EnvBinding *) LISP_REALLOC(frame->cells, sizeof(EnvBinding) * num);
+        if (!frame->cells)
+        {
+            LISP_FAIL("env memory allocation failed\n");
+        }
+        memset(frame->cells + frame->num_cells, 0, sizeof(EnvBinding) * (num - frame->num_cells));
+        frame->num_cells = num;
     }
-    else
+    EnvBinding * cell = frame->cells + index;
+    cell->var = var;
+    return cell;
+}
+
+static EnvBinding * _env_find_local(SystemState * sys, Expr env, Expr var)
+{
+    EnvFrame * frame = _env_frame(sys, env);
+    if (frame->global && is_symbol(var))
     {
-        env_set_vars(env, cons(var, env_vars(env)));
-        env_set_vals(env, cons(val, env_vals(env)));
+        return _env_find_cell(frame, var);
     }
+    for (U64 i = 0; i < frame->num; i++)
+    {
+        if (frame->bindings[i].var == var)
+        {
+            return frame->bindings + i;
+        }
+    }
+    return NULL;
 }
 
-void env_del(Expr env, Expr var)
+static EnvBinding * _env_find_global(SystemState * sys, Expr env, Expr var)
 {
-    Expr prev_vars = nil;
-    Expr prev_vals = nil;
+    while (env)
+    {
+        EnvBinding * binding = _env_find_local(sys, env, var);
+        if (binding)
+        {
+            return binding;
+        }
+        env = _env_frame(sys, env)->outer;
+    }
+    return NULL;
+}
+
+Expr lisp_make_global_env(SystemState * sys)
+{
+    /* other names, such as gensyms, go into the ordinary bindings */
+    Expr const env = lisp_make_env(&sys->env, &sys->cons, nil, 0);
+    _env_frame(sys, env)->global = true;
+    return env;
+}
+
+bool lisp_env_is_global(SystemState * sys, Expr env)
+{
+    return _env_frame(sys, env)->global;
+}
+
+void lisp_env_def(SystemState * sys, Expr env, Expr var, Expr val)
+{
+    EnvBinding * binding = _env_find_local(sys, env, var);
+    if (binding)
+    {
+        binding->val = val;
+        return;
+    }
 
-    Expr vars = env_vars(env);
-    Expr vals = env_vals(env);
-    while (vars)
+    EnvFrame * frame = _env_frame(sys, env);
+    if (frame->global && is_symbol(var))
     {
-        if (car(vars) == var)
+        _env_make_cell(sys, frame, var)->val = val;
+        return;
+    }
+
+    if (frame->num == frame->max)
+    {
+        U64 const max = frame->max ? frame->max * 2 : LISP_ENV_DEF_SIZE;
+        EnvBinding * bindings = _env_alloc_bindings(&sys->env, max);
+        if (frame->num)
         {
-            if (prev_vars)
-            {
-                LISP_ASSERT(prev_vals);
-                rplacd(prev_vars, cdr(vars));
-                rplacd(prev_vals, cdr(vals));
-            }
-            else
-            {
-                env_set_vars(env, cdr(vars));
-                env_set_vals(env, cdr(vals));
-            }
+            memcpy(bindings, frame->bindings, sizeof(EnvBinding) * frame->num);
+        }
+        _env_free_bindings(&sys->env, frame->bindings, frame->max);
+        frame->bindings = bindings;
+        frame->max = (U32) max;
+    }
+
+    frame->bindings[frame->num].var = var;
+    frame->bindings[frame->num].val = val;
+    ++frame->num;
+}
+
+void lisp_env_del(SystemState * sys, Expr env, Expr var)
+{
+    EnvFrame * frame = _env_frame(sys, env);
+    if (frame->global && is_symbol(var))
+    {
+        EnvBinding * cell = _env_find_cell(frame, var);
+        if (cell)
+        {
+            cell->var = nil;
+            cell->val = nil;
             return;
         }
+    }
 
-        prev_vars = vars;
-        prev_vals = vals;
-        vars = cdr(vars);
-        vals = cdr(vals);
+    for (U64 i = 0; i < frame->num; i++)
+    {
+        if (frame->bindings[i].var == var)
+        {
+            memmove(frame->bindings + i, frame->bindings + i + 1, sizeof(EnvBinding) * (frame->num - i - 1));
+            --frame->num;
+            return;
+        }
     }
 
-    LISP_FAIL("unbound variable %s\n", repr(var));
+    LISP_FAIL("unbound variable %s\n", lisp_repr(sys, var));
 }
 
-bool env_can_set(Expr env, Expr var)
+bool lisp_env_can_set(SystemState * sys, Expr env, Expr var)
 {
-    Expr const tmp = _env_find_global(env, var);
-    return tmp != nil;
+    return _env_find_global(sys, env, var) != NULL;
 }
 
-Expr env_get(Expr env, Expr var)
+Expr lisp_env_get(SystemState * sys, Expr env, Expr var)
 {
-    Expr const vals = _env_find_global(env, var);
-    if (vals)
+    EnvBinding const * binding = _env_find_global(sys, env, var);
+    if (binding)
     {
-        return car(vals);
+        return binding->val;
     }
     else
     {
-        LISP_FAIL("unbound variable %s\n", repr(var));
+        LISP_FAIL("unbound variable %s\n", lisp_repr(sys, var));
         return nil;
     }
 }
 
-void env_set(Expr env, Expr var, Expr val)
+void lisp_env_set(SystemState * sys, Expr env, Expr var, Expr val)
 {
-    Expr const vals = _env_find_global(env, var);
-    if (vals)
+    EnvBinding * binding = _env_find_global(sys, env, var);
+    if (binding)
     {
-        rplaca(vals, val);
+        binding->val = val;
     }
     else
     {
-        LISP_FAIL("unbound variable %s\n", repr(var));
+        LISP_FAIL("unbound variable %s\n", lisp_repr(sys, var));
     }
 }
 
-void env_destructuring_bind(Expr env, Expr vars, Expr vals)
+Expr lisp_env_get_local(SystemState * sys, Expr env, Expr loc)
 {
+    Expr frame = env;
+    for (U64 depth = local_depth(loc); depth && frame; depth--)
+    {
+        frame = _env_frame(sys, frame)->outer;
+    }
+
+    Expr const name = local_name(loc);
+    if (frame)
+    {
+        EnvFrame const * info = _env_frame(sys, frame);
+        U64 const slot = local_slot(loc);
+        if (slot < info->num && info->bindings[slot].var == name)
+        {
+            return info->bindings[slot].val;
+        }
+    }
+
+    /* a binding was deleted, or the frame is not the one resolved against */
+    return lisp_env_get(sys, env, name);
+}
+
+U64 lisp_env_count_vars(SystemState * sys, Expr vars)
+{
+    U64 ret = 0;
+    while (is_cons(vars))
+    {
+        ret += lisp_env_count_vars(sys, lisp_car(&sys->cons, vars));
+        vars = lisp_cdr(&sys->cons, vars);
+    }
+    return vars ? ret + 1 : ret;
+}
+
+void lisp_env_destructuring_bind(SystemState * sys, Expr env, Expr vars, Expr vals)
+{
+    ConsState * cons = &sys->cons;
     if (vars == nil)
     {
         if (vals != nil)
@@ -169,19 +380,83 @@ void env_destructuring_bind(Expr env, Expr vars, Expr vals)
             if (is_cons(vars))
             {
                 LISP_ASSERT(is_cons(vals));
-                env_destructuring_bind(env, car(vars), car(vals));
-                vars = cdr(vars);
-                vals = cdr(vals);
+                lisp_env_destructuring_bind(sys, env, lisp_car(cons, vars), lisp_car(cons, vals));
+                vars = lisp_cdr(cons, vars);
+                vals = lisp_cdr(cons, vals);
             }
             else
             {
-                env_destructuring_bind(env, vars, vals);
+                lisp_env_destructuring_bind(sys, env, vars, vals);
                 break;
             }
         }
     }
     else
     {
-        env_def(env, vars, vals);
+        lisp_env_def(sys, env, vars, vals);
     }
 }
+
+#if LISP_GLOBAL_API
+
+Expr make_env(Expr outer)
+{
+    return make_env_sized(outer, LISP_ENV_DEF_SIZE);
+}
+
+Expr make_env_sized(Expr outer, U64 size)
+{
+    return lisp_make_env(&global.env, &global.cons, outer, size);
+}
+
+Expr make_global_env()
+{
+    return lisp_make_global_env(&global);
+}
+
+bool env_is_global(Expr env)
+{
+    return lisp_env_is_global(&global, env);
+}
+
+void env_def(Expr env, Expr var, Expr val)
+{
+    lisp_env_def(&global, env, var, val);
+}
+
+void env_del(Expr env, Expr var)
+{
+    lisp_env_del(&global, env, var);
+}
+
+bool env_can_set(Expr env, Expr var)
+{
+    return lisp_env_can_set(&global, env, var);
+}
+
+Expr env_get(Expr env, Expr var)
+{
+    return lisp_env_get(&global, env, var);
+}
+
+void env_set(Expr env, Expr var, Expr val)
+{
+    lisp_env_set(&global, env, var, val);
+}
+
+Expr env_get_local(Expr env, Expr loc)
+{
+    return lisp_env_get_local(&global, env, loc);
+}
+
+U64 env_count_vars(Expr vars)
+{
+    return lisp_env_count_vars(&global, vars);
+}
+
+void env_destructuring_bind(Expr env, Expr vars, Expr vals)
+{
+    lisp_env_destructuring_bind(&global, env, vars, vals);
+}
+
+#endif
@@ -1,10 +1,27 @@
-
 #include "common.h"
 
+static _Thread_local ErrorHandler error_handler;
+static _Thread_local void * error_data;
+
+void error_set_handler(ErrorHandler handler, void * data)
+{
+    error_handler = handler;
+    error_data = data;
+}
+
 void error_fail(char const * fmt, ...)
 {
-    FILE * const file = stderr;
     va_list ap;
+    if (error_handler)
+    {
+        char msg[LISP_ERROR_MSG_SIZE];
+        va_start(ap, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+        error_handler(error_data, msg);
+    }
+
+    FILE * const file = stderr;
     va_start(ap, fmt);
     fprintf(file, LISP_RED "[FAIL] " LISP_RESET);
     vfprintf(file, fmt, ap);
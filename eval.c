@@ -1,157 +1,285 @@
-
 #include "common.h"
 
-bool is_op(Expr exp, Expr name)
+bool is_op(ConsState * cons, Expr exp, Expr name)
 {
-    return is_cons(exp) && car(exp) == name;
+    return is_cons(exp) && lisp_car(cons, exp) == name;
 }
 
-bool is_quote(Expr exp)
+bool is_quote(ConsState * cons, Expr exp)
 {
-    return is_op(exp, LISP_SYM_QUOTE);
+    return is_op(cons, exp, LISP_SYM_QUOTE);
 }
 
-bool is_if(Expr exp)
+bool is_if(ConsState * cons, Expr exp)
 {
-    return is_op(exp, LISP_SYM_IF);
+    return is_op(cons, exp, LISP_SYM_IF);
 }
 
-Expr eval(Expr exp, Expr env);
-
-Expr eval_list(Expr exps, Expr env)
+Expr eval_list(SystemState * sys, Expr exps, Expr env)
 {
+    ConsState * cons = &sys->cons;
     Expr ret = nil;
-    for (Expr tmp = exps; tmp; tmp = cdr(tmp))
+    lisp_gc_push_root(&sys->gc, &ret);
+    for (Expr tmp = exps; tmp; tmp = lisp_cdr(cons, tmp))
     {
-        Expr const exp = car(tmp);
-        ret = cons(eval(exp, env), ret);
+        Expr const exp = lisp_car(cons, tmp);
+        Expr const val = lisp_eval(sys, exp, env);
+        ret = lisp_cons(cons, val, ret);
     }
-    return nreverse(ret);
+    lisp_gc_pop_roots(&sys->gc, 1);
+    return lisp_nreverse(cons, ret);
 }
 
-Expr eval_body(Expr exps, Expr env)
+Expr eval_body(SystemState * sys, Expr exps, Expr env)
 {
+    ConsState * cons = &sys->cons;
     Expr ret = nil;
-    for (Expr tmp = exps; tmp; tmp = cdr(tmp))
+    for (Expr tmp = exps; tmp; tmp = lisp_cdr(cons, tmp))
     {
-        Expr const exp = car(tmp);
-        ret = eval(exp, env);
+        Expr const exp = lisp_car(cons, tmp);
+        ret = lisp_eval(sys, exp, env);
     }
     return ret;
 }
 
-/* TODO move these */
-
-/* (lit clo <env> <args> . <body>) */
-
-bool is_closure(Expr exp, Expr kind)
+static void bind_args(SystemState * sys, Expr env, Expr vars, Expr vals)
 {
-    return is_cons(exp) &&
-        eq(intern("lit"), car(exp)) &&
-        is_cons(cdr(exp)) &&
-        eq(kind, cadr(exp));
+    lisp_env_destructuring_bind(sys, env, vars, vals);
 }
 
-bool is_function(Expr exp)
+static Expr wrap_env(SystemState * sys, Expr lenv, Expr vars)
 {
-    return is_closure(exp, intern("clo"));
+    return lisp_make_env(&sys->env, &sys->cons, lenv, lisp_env_count_vars(sys, vars));
 }
 
-bool is_macro(Expr exp)
+static Expr make_call_env_from(SystemState * sys, Expr lenv, Expr vars, Expr vals)
 {
-    return is_closure(exp, intern("mac"));
+    Expr cenv = wrap_env(sys, lenv, vars);
+    bind_args(sys, cenv, vars, vals);
+    return cenv;
 }
 
-Expr closure_env(Expr exp)
+/* the expansion of the macro call exp, cached per call site */
+Expr lisp_macro_expand(SystemState * sys, Expr macro, Expr exp)
 {
-    return caddr(exp);
+    Expr expansion = nil;
+    if (!lisp_expand_lookup(&sys->expand, exp, macro, &expansion))
+    {
+        /* calls resolved before the macro was defined hold locals */
+        Expr const args = lisp_lexical_unresolve(&sys->cons, lisp_cdr(&sys->cons, exp));
+        Closure const * info = lisp_closure(&sys->closure, macro);
+        Expr const menv = make_call_env_from(sys, info->env, info->params, args);
+        expansion = eval_body(sys, lisp_closure(&sys->closure, macro)->body, menv);
+        lisp_expand_insert(&sys->expand, exp, macro, expansion);
+    }
+    return expansion;
 }
 
-Expr closure_args(Expr exp)
+/* tail positions (the last form of a closure body, the branches of if
+   and the expansion of a macro) replace exp and env and go around the
+   loop again instead of recursing, so loops run in constant C stack */
+Expr lisp_eval(SystemState * sys, Expr exp, Expr env)
 {
-    return cadddr(exp);
-}
+    ConsState * cons = &sys->cons;
+    GcState * gc = &sys->gc;
+    ProfileState * profile = &sys->profile;
+    bool framed = false;
+    Expr ret = nil;
+    Expr op = nil;
+    Expr vals = nil;
+    lisp_gc_push_root(gc, &exp);
+    lisp_gc_push_root(gc, &env);
+    lisp_gc_push_root(gc, &op);
+    lisp_gc_push_root(gc, &vals);
 
-Expr closure_body(Expr exp)
-{
-    return cddddr(exp);
-}
+    for (;;)
+    {
+        lisp_gc_maybe_collect(sys, cons);
 
-static void bind_args(Expr env, Expr vars, Expr vals)
-{
-    env_destructuring_bind(env, vars, vals);
-}
+        switch (expr_type(exp))
+        {
+        case TYPE_NIL:
+            ret = nil;
+            break;
+        case TYPE_STRING:
+        case TYPE_FIXNUM:
+            ret = exp;
+            break;
+        case TYPE_SYMBOL:
+            if (exp == LISP_SYM_ENV)
+            {
+                ret = env;
+                break;
+            }
+            ret = lisp_env_get(sys, env, exp);
+            break;
+        case TYPE_LOCAL:
+            ret = lisp_env_get_local(sys, env, exp);
+            break;
+        case TYPE_CONS:
+        {
+            // TODO parse keyword args
+            Expr const kwargs = nil;
 
-static Expr wrap_env(Expr lenv)
-{
-    return make_env(lenv);
-}
+            op = lisp_car(cons, exp);
+            for (;;)
+            {
+                U64 const type = expr_type(op);
+                if (type == TYPE_BUILTIN || type == TYPE_SPECIAL || type == TYPE_CLOSURE)
+                {
+                    break;
+                }
+                Expr const val = lisp_eval(sys, op, env);
+                if (val == op)
+                {
+                    LISP_FAIL("cannot apply %s\n", lisp_repr(sys, op));
+                }
+                op = val;
+            }
 
-static Expr make_call_env_from(Expr lenv, Expr vars, Expr vals)
-{
-    Expr cenv = wrap_env(lenv);
-    bind_args(cenv, vars, vals);
-    return cenv;
-}
+            switch (expr_type(op))
+            {
+            case TYPE_BUILTIN:
+                vals = eval_list(sys, lisp_cdr(cons, exp), env);
+                lisp_profile_enter(profile, op);
+                ret = lisp_builtin_fun(&sys->builtin, op)(sys, vals, kwargs, env);
+                lisp_profile_leave(profile);
+                break;
+            case TYPE_SPECIAL:
+            {
+                SpecialFun const fun = lisp_special_fun(&sys->special, op);
+                if (fun != s_if)
+                {
+                    ret = fun(sys, lisp_cdr(cons, exp), kwargs, env);
+                    break;
+                }
 
-Expr apply(Expr name, Expr args, Expr env)
-{
-    if (is_builtin(name))
+                Expr const args = lisp_cdr(cons, exp);
+                if (lisp_eval(sys, lisp_car(cons, args), env) != nil)
+                {
+                    exp = lisp_cadr(cons, args);
+                }
+                else if (lisp_cddr(cons, args))
+                {
+                    exp = lisp_caddr(cons, args);
+                }
+                else
+                {
+                    ret = nil;
+                    break;
+                }
+                continue;
+            }
+            case TYPE_CLOSURE:
+            {
+                Closure const * info = lisp_closure(&sys->closure, op);
+                if (info->kind == CLOSURE_MACRO)
+                {
+                    exp = lisp_macro_expand(sys, op, exp);
+                    continue;
+                }
+
+                vals = eval_list(sys, lisp_cdr(cons, exp), env);
+                if (framed)
+                {
+                    lisp_profile_replace(profile, op);
+                }
+                else
+                {
+                    lisp_profile_enter(profile, op);
+                    framed = true;
+                }
+                if (lisp_vm_runs(sys, op))
+                {
+                    ret = lisp_vm_apply(sys, op, vals);
+                    break;
+                }
+
+                /* eval_list may have moved the pool */
+                info = lisp_closure(&sys->closure, op);
+                env = make_call_env_from(sys, info->env, info->params, vals);
+
+                Expr body = info->body;
+                if (!body)
+                {
+                    ret = nil;
+                    break;
+                }
+                for (; lisp_cdr(cons, body); body = lisp_cdr(cons, body))
+                {
+                    lisp_eval(sys, lisp_car(cons, body), env);
+                }
+                exp = lisp_car(cons, body);
+                continue;
+            }
+            }
+            break;
+        }
+        default:
+            LISP_FAIL("cannot evaluate %s\n", lisp_repr(sys, exp));
+            break;
+        }
+        break;
+    }
+
+    if (framed)
     {
-        // TODO parse keyword args
-        Expr kwargs = nil;
-        Expr vals = eval_list(args, env);
-        return builtin_fun(name)(vals, kwargs, env);
+        lisp_profile_leave(profile);
     }
-    else if (is_special(name))
+    lisp_gc_pop_roots(gc, 4);
+    return ret;
+}
+
+/* calls fun with the evaluated arguments in args. builtins are given no
+   env, since there is no call site to take one from. */
+Expr lisp_apply(SystemState * sys, Expr fun, Expr args)
+{
+    Expr ret = nil;
+    if (is_builtin(fun))
     {
-        // TODO parse keyword args
-        Expr kwargs = nil;
-        Expr vals = args;
-        return special_fun(name)(vals, kwargs, env);
+        lisp_profile_enter(&sys->profile, fun);
+        ret = lisp_builtin_fun(&sys->builtin, fun)(sys, args, nil, nil);
+        lisp_profile_leave(&sys->profile);
+        return ret;
     }
-    else if (is_function(name))
+    if (!lisp_is_function(&sys->closure, fun))
     {
-        // TODO parse keyword args
-        Expr kwargs = nil;
-        Expr vals = eval_list(args, env);
-        Expr body = closure_body(name);
-        return eval_body(body, make_call_env_from(closure_env(name), closure_args(name), vals));
+        LISP_FAIL("cannot apply %s\n", lisp_repr(sys, fun));
     }
-    else if (is_macro(name))
+
+    lisp_profile_enter(&sys->profile, fun);
+    if (lisp_vm_runs(sys, fun))
     {
-        Expr body = closure_body(name);
-        Expr exp = eval_body(body, make_call_env_from(closure_env(name), closure_args(name), args));
-        return eval(exp, env);
+        ret = lisp_vm_apply(sys, fun, args);
     }
     else
     {
-        // TODO check for unlimited recursion
-        return apply(eval(name, env), args, env);
+        lisp_gc_push_root(&sys->gc, &fun);
+        lisp_gc_push_root(&sys->gc, &args);
+        Closure const * info = lisp_closure(&sys->closure, fun);
+        Expr const env = make_call_env_from(sys, info->env, info->params, args);
+        ret = eval_body(sys, lisp_closure(&sys->closure, fun)->body, env);
+        lisp_gc_pop_roots(&sys->gc, 2);
     }
+    lisp_profile_leave(&sys->profile);
+    return ret;
 }
 
+#if LISP_GLOBAL_API
+
 Expr eval(Expr exp, Expr env)
 {
-    if (exp == nil)
-    {
-        return nil;
-    }
+    return lisp_eval(&global, exp, env);
+}
 
-    switch (expr_type(exp))
-    {
-    case TYPE_STRING:
-        return exp;
-    case TYPE_SYMBOL:
-        if (exp == intern("*env*"))
-        {
-            return env;
-        }
-        return env_get(env, exp);
-    case TYPE_CONS:
-        return apply(car(exp), cdr(exp), env);
-    default:
-        LISP_FAIL("cannot evaluate %s\n", repr(exp));
-        return nil;
-    }
+Expr apply(Expr fun, Expr args)
+{
+    return lisp_apply(&global, fun, args);
+}
+
+Expr macro_expand(Expr macro, Expr exp)
+{
+    return lisp_macro_expand(&global, macro, exp);
 }
+
+#endif
@@ -0,0 +1,118 @@
+
+#include "common.h"
+
+#define LISP_EXPAND_DEF_SLOTS 256
+
+static U64 _expand_hash(Expr form)
+{
+    /* fibonacci hashing spreads consecutive cons indices */
+    return expr_data(form) * UINT64_C(0x9e3779b97f4a7c15);
+}
+
+static ExpandEntry * _expand_find(ExpandState * expand, Expr form)
+{
+    U64 const mask = expand->num_slots - 1;
+    for (U64 slot = _expand_hash(form) & mask;; slot = (slot + 1) & mask)
+    {
+        ExpandEntry * entry = expand->slots + slot;
+        if (entry->form == form || entry->form == nil)
+        {
+            return entry;
+        }
+    }
+}
+
+static void _expand_rehash(ExpandState * expand, U64 num_slots)
+{
+    ExpandEntry * old_slots = expand->slots;
+    U64 const old_num_slots = expand->num_slots;
+
+    expand->slots = (ExpandEntry *) LISP_MALLOC(sizeof(ExpandEntry) * num_slots);
+    if (!expand->slots)
+    {
+        LISP_FAIL("macro cache allocation failed\n");
+    }
+    memset(expand->slots, 0, sizeof(ExpandEntry) * num_slots);
+    expand->num_slots = num_slots;
+
+    for (U64 i = 0; i < old_num_slots; i++)
+    {
+        if (old_slots[i].form)
+        {
+            *_expand_find(expand, old_slots[i].form) = old_slots[i];
+        }
+    }
+    LISP_FREE(old_slots);
+}
+
+void expand_init(ExpandState * expand)
+{
+    memset(expand, 0, sizeof(ExpandState));
+    _expand_rehash(expand, LISP_EXPAND_DEF_SLOTS);
+}
+
+void expand_quit(ExpandState * expand)
+{
+    LISP_FREE(expand->slots);
+    memset(expand, 0, sizeof(ExpandState));
+}
+
+bool lisp_expand_lookup(ExpandState * expand, Expr form, Expr macro, Expr * expansion)
+{
+#if LISP_MACRO_CACHE
+    ExpandEntry const * entry = _expand_find(expand, form);
+    if (entry->form == form && entry->macro == macro)
+    {
+        *expansion = entry->expansion;
+        return true;
+    }
+#endif
+    return false;
+}
+
+void lisp_expand_insert(ExpandState * expand, Expr form, Expr macro, Expr expansion)
+{
+#if LISP_MACRO_CACHE
+    LISP_ASSERT(is_cons(form));
+
+    /* keep the load factor at or below one half */
+    if ((expand->num + 1) * 2 > expand->num_slots)
+    {
+        _expand_rehash(expand, expand->num_slots * 2);
+    }
+
+    ExpandEntry * entry = _expand_find(expand, form);
+    if (entry->form == nil)
+    {
+        ++expand->num;
+    }
+    entry->form = form;
+    entry->macro = macro;
+    entry->expansion = expansion;
+#endif
+}
+
+void lisp_expand_sweep(ExpandState * expand, U64 const * marks)
+{
+    U64 num = 0;
+    for (U64 i = 0; i < expand->num_slots; i++)
+    {
+        ExpandEntry * entry = expand->slots + i;
+        if (entry->form)
+        {
+            U64 const index = expr_data(entry->form);
+            if ((marks[index / 64] >> (index % 64)) & 1)
+            {
+                ++num;
+            }
+            else
+            {
+                memset(entry, 0, sizeof(ExpandEntry));
+            }
+        }
+    }
+
+    /* reinsert the survivors, since removals break the probe sequences */
+    expand->num = num;
+    _expand_rehash(expand, expand->num_slots);
+}
@@ -1,17 +0,0 @@
-
-#include "common.h"
-
-Expr make_expr(U64 type, U64 data)
-{
-    return (data << 8) | (type & 0xff);
-}
-
-U64 expr_type(Expr exp)
-{
-    return exp & 0xff;
-}
-
-U64 expr_data(Expr exp)
-{
-    return exp >> 8;
-}
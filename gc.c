@@ -0,0 +1,329 @@
+
+#include "common.h"
+
+void gc_init(GcState * gc)
+{
+    memset(gc, 0, sizeof(GcState));
+}
+
+void gc_quit(GcState * gc)
+{
+    LISP_FREE(gc->roots);
+    LISP_FREE(gc->marks);
+    LISP_FREE(gc->env_marks);
+    LISP_FREE(gc->closure_marks);
+    LISP_FREE(gc->stack);
+    memset(gc, 0, sizeof(GcState));
+}
+
+void lisp_gc_push_root(GcState * gc, Expr * root)
+{
+    if (gc->num_roots == gc->max_roots)
+    {
+        gc->max_roots = gc->max_roots ? gc->max_roots * 2 : 64;
+        gc->roots = (Expr **) LISP_REALLOC(gc->roots, sizeof(Expr *) * gc->max_roots);
+        if (!gc->roots)
+        {
+            LISP_FAIL("gc root allocation failed\n");
+        }
+    }
+    gc->roots[gc->num_roots++] = root;
+}
+
+void lisp_gc_pop_roots(GcState * gc, U64 count)
+{
+    LISP_ASSERT_DEBUG(count <= gc->num_roots);
+    gc->num_roots -= count;
+}
+
+/* for roots that do not live on the c stack and go away in any order */
+void lisp_gc_remove_root(GcState * gc, Expr * root)
+{
+    for (U64 i = gc->num_roots; i > 0; i--)
+    {
+        if (gc->roots[i - 1] == root)
+        {
+            memmove(gc->roots + i - 1, gc->roots + i, sizeof(Expr *) * (gc->num_roots - i));
+            --gc->num_roots;
+            return;
+        }
+    }
+    LISP_FAIL("gc root not found\n");
+}
+
+static void _gc_push(GcState * gc, Expr exp)
+{
+    if (gc->num_stack == gc->max_stack)
+    {
+        gc->max_stack = gc->max_stack ? gc->max_stack * 2 : 1024;
+        gc->stack = (Expr *) LISP_REALLOC(gc->stack, sizeof(Expr) * gc->max_stack);
+        if (!gc->stack)
+        {
+            LISP_FAIL("gc mark stack allocation failed\n");
+        }
+    }
+    gc->stack[gc->num_stack++] = exp;
+}
+
+static bool _gc_test_and_mark(U64 * marks, U64 index)
+{
+    U64 const word = index / 64;
+    U64 const bit = (U64) 1 << (index % 64);
+    if (marks[word] & bit)
+    {
+        return true;
+    }
+    marks[word] |= bit;
+    return false;
+}
+
+static bool _gc_is_marked(U64 const * marks, U64 index)
+{
+    return (marks[index / 64] >> (index % 64)) & 1;
+}
+
+static void _gc_clear_marks(U64 ** marks, U64 * num_marks, U64 num)
+{
+    U64 const words = (num + 63) / 64;
+    if (words > *num_marks)
+    {
+        *marks = (U64 *) LISP_REALLOC(*marks, sizeof(U64) * words);
+        if (!*marks)
+        {
+            LISP_FAIL("gc mark bits allocation failed\n");
+        }
+        *num_marks = words;
+    }
+    if (words)
+    {
+        memset(*marks, 0, sizeof(U64) * words);
+    }
+}
+
+static bool _gc_is_heap(Expr exp)
+{
+    return is_cons(exp) || is_env(exp) || is_closure(exp);
+}
+
+static void _gc_mark(SystemState * system, Expr root)
+{
+    GcState * gc = &system->gc;
+    ConsState * cons = &system->cons;
+    EnvState * env = &system->env;
+    ClosureState * closure = &system->closure;
+
+    _gc_push(gc, root);
+    while (gc->num_stack)
+    {
+        Expr exp = gc->stack[--gc->num_stack];
+
+        /* follow cdrs and outer frames in a loop so long lists and deep
+           environments do not grow the stack */
+        for (;;)
+        {
+            U64 const index = expr_data(exp);
+            if (is_cons(exp))
+            {
+                LISP_ASSERT_DEBUG(index < cons->num);
+                if (_gc_test_and_mark(gc->marks, index))
+                {
+                    break;
+                }
+                struct Pair * pair = cons->pairs + index;
+                if (_gc_is_heap(pair->a))
+                {
+                    _gc_push(gc, pair->a);
+                }
+                exp = pair->b;
+            }
+            else if (is_env(exp))
+            {
+                LISP_ASSERT_DEBUG(index < env->num);
+                if (_gc_test_and_mark(gc->env_marks, index))
+                {
+                    break;
+                }
+                EnvFrame * frame = env->frames + index;
+                for (U64 i = 0; i < frame->num; i++)
+                {
+                    if (_gc_is_heap(frame->bindings[i].val))
+                    {
+                        _gc_push(gc, frame->bindings[i].val);
+                    }
+                }
+                for (U64 i = 0; i < frame->num_cells; i++)
+                {
+                    if (_gc_is_heap(frame->cells[i].val))
+                    {
+                        _gc_push(gc, frame->cells[i].val);
+                    }
+                }
+                exp = frame->outer;
+            }
+            else if (is_closure(exp))
+            {
+                LISP_ASSERT_DEBUG(index < closure->num);
+                if (_gc_test_and_mark(gc->closure_marks, index))
+                {
+                    break;
+                }
+                Closure const * info = closure->closures + index;
+                if (_gc_is_heap(info->params))
+                {
+                    _gc_push(gc, info->params);
+                }
+                if (_gc_is_heap(info->body))
+                {
+                    _gc_push(gc, info->body);
+                }
+                exp = info->env;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+}
+
+static void _gc_sweep(SystemState * system)
+{
+    GcState * gc = &system->gc;
+    ConsState * cons = &system->cons;
+
+    /* rebuild the free list so that the lowest free index comes first */
+    cons->free = 0;
+    cons->num_free = 0;
+    for (U64 i = cons->num; i-- > 0;)
+    {
+        if (!_gc_is_marked(gc->marks, i))
+        {
+            struct Pair * pair = cons->pairs + i;
+            pair->a = nil;
+            pair->b = cons->free;
+            cons->free = i + 1;
+            ++cons->num_free;
+        }
+    }
+
+    EnvState * env = &system->env;
+    env->free = 0;
+    env->num_free = 0;
+    for (U64 i = env->num; i-- > 0;)
+    {
+        if (!_gc_is_marked(gc->env_marks, i))
+        {
+            lisp_env_free(env, i);
+        }
+    }
+
+    ClosureState * closure = &system->closure;
+    closure->free = 0;
+    closure->num_free = 0;
+    for (U64 i = closure->num; i-- > 0;)
+    {
+        if (!_gc_is_marked(gc->closure_marks, i))
+        {
+            lisp_closure_free(closure, i);
+        }
+    }
+}
+
+/* cached macro expansions and compiled code live as long as their call
+   sites and bodies. marking them can reach more call sites and bodies, so
+   repeat until nothing changes. */
+static void _gc_mark_expansions(SystemState * system)
+{
+    GcState * gc = &system->gc;
+    ExpandState * expand = &system->expand;
+    VmState const * vm = &system->vm;
+
+    U64 live = 0;
+    for (;;)
+    {
+        U64 count = 0;
+        for (U64 i = 0; i < expand->num_slots; i++)
+        {
+            ExpandEntry const * entry = expand->slots + i;
+            if (entry->form && _gc_is_marked(gc->marks, expr_data(entry->form)))
+            {
+                ++count;
+                _gc_mark(system, entry->macro);
+                _gc_mark(system, entry->expansion);
+            }
+        }
+        /* the constants keep guarded operators, so no new closure reuses
+           their index while old expansions are still around */
+        for (U64 i = 0; i < vm->num_slots; i++)
+        {
+            VmEntry const * entry = vm->slots + i;
+            if (entry->body && _gc_is_marked(gc->marks, expr_data(entry->body)))
+            {
+                ++count;
+                VmCode const * code = entry->code;
+                for (U64 k = 0; k < code->num_consts; k++)
+                {
+                    _gc_mark(system, code->consts[k]);
+                }
+            }
+        }
+        if (count == live)
+        {
+            break;
+        }
+        live = count;
+    }
+}
+
+void lisp_gc_collect(SystemState * system)
+{
+    GcState * gc = &system->gc;
+    ConsState * cons = &system->cons;
+
+    _gc_clear_marks(&gc->marks, &gc->num_marks, cons->num);
+    _gc_clear_marks(&gc->env_marks, &gc->num_env_marks, system->env.num);
+    _gc_clear_marks(&gc->closure_marks, &gc->num_closure_marks, system->closure.num);
+
+    for (U64 i = 0; i < gc->num_roots; i++)
+    {
+        _gc_mark(system, *gc->roots[i]);
+    }
+
+    /* the bodies of running code keep it from being swept */
+    VmState const * vm = &system->vm;
+    for (U64 i = 0; i < vm->num_stack; i++)
+    {
+        _gc_mark(system, vm->stack[i]);
+    }
+    for (U64 i = 0; i < vm->num_frames; i++)
+    {
+        _gc_mark(system, vm->frames[i].body);
+        _gc_mark(system, vm->frames[i].env);
+    }
+
+    /* a closure called from compiled code is only held by the profile
+       stack, and samples keep the functions they name */
+    ProfileState const * profile = &system->profile;
+    for (sig_atomic_t i = 0; i < profile->depth && i < LISP_PROFILE_MAX_DEPTH; i++)
+    {
+        _gc_mark(system, profile->stack[i]);
+    }
+    for (U64 i = 0; profile->funs && i < LISP_PROFILE_MAX_FUNS; i++)
+    {
+        _gc_mark(system, profile->funs[i]);
+    }
+
+    _gc_mark_expansions(system);
+
+    _gc_sweep(system);
+    lisp_expand_sweep(&system->expand, gc->marks);
+    lisp_vm_sweep(&system->vm, gc->marks);
+    lisp_lexical_flush(&system->lexical);
+
+    U64 const live = cons->num - cons->num_free;
+    cons->threshold = live > LISP_GC_MIN_THRESHOLD ? live : LISP_GC_MIN_THRESHOLD;
+    cons->total_allocs += cons->num_allocs;
+    cons->num_allocs = 0;
+    cons->gc_pending = false;
+    ++gc->num_collections;
+}
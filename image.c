@@ -0,0 +1,418 @@
+
+/* for mmap */
+#define _POSIX_C_SOURCE 200809L
+
+#include "common.h"
+
+#if LISP_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* an image holds the pools of a system by index, so every Expr in it
+   stays valid when it is loaded into a fresh system. pools of plain
+   Exprs are copied as they are, names and bindings are replayed. caches
+   that a collection would drop anyway, the vm code, the expansion cache
+   and the resolved lambda bits, are not kept. */
+
+static char const lisp_image_magic[8] = { 'L', 'I', 'S', 'P', 'I', 'M', 'G', 0 };
+
+/* writer */
+
+static void _image_put(FILE * file, void const * data, size_t size)
+{
+    if (size && fwrite(data, 1, size, file) != size)
+    {
+        LISP_FAIL("cannot write image\n");
+    }
+}
+
+static void _image_put_u64(FILE * file, U64 val)
+{
+    _image_put(file, &val, sizeof(val));
+}
+
+static void _image_put_name(FILE * file, char const * name, size_t len)
+{
+    _image_put_u64(file, len);
+    _image_put(file, name, len);
+}
+
+void lisp_image_dump(SystemState * sys, Expr env, char const * path)
+{
+    /* only what is reachable from env is worth keeping */
+    lisp_gc_push_root(&sys->gc, &env);
+    lisp_gc_collect(sys);
+    lisp_gc_pop_roots(&sys->gc, 1);
+
+    FILE * file = fopen(path, "wb");
+    if (!file)
+    {
+        LISP_FAIL("cannot open %s\n", path);
+    }
+
+    _image_put(file, lisp_image_magic, sizeof(lisp_image_magic));
+    _image_put_u64(file, LISP_IMAGE_VERSION);
+    _image_put_u64(file, env);
+
+    SymbolState * symbol = &sys->symbol;
+    _image_put_u64(file, symbol->num);
+    for (U64 i = 0; i < symbol->num; i++)
+    {
+        _image_put_name(file, symbol->info[i].name, symbol->info[i].len);
+    }
+
+    StringState * string = &sys->string;
+    _image_put_u64(file, string->num);
+    for (U64 i = 0; i < string->num; i++)
+    {
+        _image_put_name(file, string->records[i]->data, string->records[i]->len);
+        _image_put_u64(file, lisp_string_is_interned(string, make_expr(TYPE_STRING, i)));
+    }
+
+    _image_put_u64(file, sys->special.num);
+    for (U64 i = 0; i < sys->special.num; i++)
+    {
+        _image_put_name(file, sys->special.info[i].name, strlen(sys->special.info[i].name));
+    }
+
+    _image_put_u64(file, sys->builtin.num);
+    for (U64 i = 0; i < sys->builtin.num; i++)
+    {
+        _image_put_name(file, sys->builtin.info[i].name, strlen(sys->builtin.info[i].name));
+    }
+
+    _image_put_u64(file, sys->gensym.counter);
+
+    ConsState * cons = &sys->cons;
+    _image_put_u64(file, cons->num);
+    _image_put_u64(file, cons->free);
+    _image_put_u64(file, cons->num_free);
+    _image_put(file, cons->pairs, sizeof(struct Pair) * cons->num);
+
+    EnvState * envs = &sys->env;
+    _image_put_u64(file, envs->num);
+    _image_put_u64(file, envs->free);
+    _image_put_u64(file, envs->num_free);
+    for (U64 i = 0; i < envs->num; i++)
+    {
+        EnvFrame const * frame = envs->frames + i;
+        _image_put_u64(file, frame->outer);
+        _image_put_u64(file, frame->num);
+        _image_put_u64(file, frame->max);
+        _image_put_u64(file, frame->global);
+        _image_put_u64(file, frame->num_cells);
+        _image_put(file, frame->bindings, sizeof(EnvBinding) * frame->num);
+        _image_put(file, frame->cells, sizeof(EnvBinding) * frame->num_cells);
+    }
+
+    ClosureState * closure = &sys->closure;
+    _image_put_u64(file, closure->num);
+    _image_put_u64(file, closure->free);
+    _image_put_u64(file, closure->num_free);
+    for (U64 i = 0; i < closure->num; i++)
+    {
+        Closure const * info = closure->closures + i;
+        _image_put_u64(file, info->env);
+        _image_put_u64(file, info->params);
+        _image_put_u64(file, info->body);
+        _image_put_u64(file, info->kind);
+    }
+
+    if (fclose(file))
+    {
+        LISP_FAIL("cannot write image\n");
+    }
+}
+
+/* reader */
+
+typedef struct
+{
+    char const * data;
+    size_t size;
+    size_t pos;
+} ImageReader;
+
+static void const * _image_get(ImageReader * r, size_t size)
+{
+    if (size > r->size - r->pos)
+    {
+        LISP_FAIL("truncated image\n");
+    }
+    void const * ret = r->data + r->pos;
+    r->pos += size;
+    return ret;
+}
+
+static U64 _image_get_u64(ImageReader * r)
+{
+    U64 val = 0;
+    memcpy(&val, _image_get(r, sizeof(val)), sizeof(val));
+    return val;
+}
+
+/* num items that take at least size bytes each must fit in the rest of
+   the image, so a corrupt count fails before anything is sized by it */
+static U64 _image_check_count(ImageReader * r, U64 num, size_t size)
+{
+    if (num > (r->size - r->pos) / size)
+    {
+        LISP_FAIL("truncated image\n");
+    }
+    return num;
+}
+
+static U64 _image_get_count(ImageReader * r, size_t size)
+{
+    return _image_check_count(r, _image_get_u64(r), size);
+}
+
+static char const * _image_get_name(ImageReader * r, size_t * len)
+{
+    *len = _image_get_u64(r);
+    return (char const *) _image_get(r, *len);
+}
+
+/* a copy of size bytes of the image, or NULL for none */
+static void * _image_get_copy(ImageReader * r, size_t size, size_t capacity)
+{
+    if (!capacity)
+    {
+        return NULL;
+    }
+    void * ret = LISP_MALLOC(capacity);
+    if (!ret)
+    {
+        LISP_FAIL("image memory allocation failed\n");
+    }
+    memcpy(ret, _image_get(r, size), size);
+    return ret;
+}
+
+static U64 _image_capacity(U64 num, U64 min)
+{
+    U64 ret = min;
+    while (ret < num)
+    {
+        ret *= 2;
+    }
+    return ret;
+}
+
+static void _image_restore(SystemState * sys, ImageReader * r, Expr * env)
+{
+    if (memcmp(_image_get(r, sizeof(lisp_image_magic)), lisp_image_magic, sizeof(lisp_image_magic)))
+    {
+        LISP_FAIL("not an image\n");
+    }
+    if (_image_get_u64(r) != LISP_IMAGE_VERSION)
+    {
+        LISP_FAIL("image version mismatch\n");
+    }
+    *env = _image_get_u64(r);
+
+    /* the pools must be as system_init leaves them, so indices line up */
+    LISP_ASSERT(sys->string.num == 0 && sys->cons.num == 0 && sys->env.num == 0 && sys->closure.num == 0);
+    LISP_ASSERT(sys->special.num == 0 && sys->builtin.num == 0);
+
+    size_t len = 0;
+    U64 const num_symbols = _image_get_count(r, sizeof(U64));
+    for (U64 i = 0; i < num_symbols; i++)
+    {
+        char const * name = _image_get_name(r, &len);
+        if (expr_data(lisp_make_symbol_n(&sys->symbol, name, len)) != i)
+        {
+            LISP_FAIL("image symbols do not line up\n");
+        }
+    }
+
+    U64 const num_strings = _image_get_count(r, sizeof(U64) * 2);
+    for (U64 i = 0; i < num_strings; i++)
+    {
+        char const * str = _image_get_name(r, &len);
+        if (!_image_get_u64(r))
+        {
+            lisp_make_string_n(&sys->string, str, len);
+        }
+        else if (expr_data(lisp_intern_string_n(&sys->string, str, len)) != i)
+        {
+            LISP_FAIL("image strings do not line up\n");
+        }
+    }
+
+    U64 const num_specials = _image_get_count(r, sizeof(U64));
+    for (U64 i = 0; i < num_specials; i++)
+    {
+        char const * name = _image_get_name(r, &len);
+        SpecialFun fun = NULL;
+        if (!core_find_special(name, len, &name, &fun))
+        {
+            LISP_FAIL("image has unknown special operator %.*s\n", (int) len, name);
+        }
+        lisp_make_special(&sys->special, name, fun);
+    }
+
+    U64 const num_builtins = _image_get_count(r, sizeof(U64));
+    for (U64 i = 0; i < num_builtins; i++)
+    {
+        char const * name = _image_get_name(r, &len);
+        BuiltinFun fun = NULL;
+        if (!core_find_builtin(name, len, &name, &fun))
+        {
+            LISP_FAIL("image has unknown function %.*s\n", (int) len, name);
+        }
+        lisp_make_builtin(&sys->builtin, name, fun);
+    }
+
+    sys->gensym.counter = _image_get_u64(r);
+
+    ConsState * cons = &sys->cons;
+    cons->num = _image_get_u64(r);
+    cons->free = _image_get_u64(r);
+    cons->num_free = _image_get_u64(r);
+    _image_check_count(r, cons->num, sizeof(struct Pair));
+    cons->max = _image_capacity(cons->num, LISP_DEF_CONSES);
+    LISP_FREE(cons->pairs);
+    cons->pairs = (struct Pair *) _image_get_copy(r, sizeof(struct Pair) * cons->num, sizeof(struct Pair) * cons->max);
+
+    EnvState * envs = &sys->env;
+    U64 const num_frames = _image_get_u64(r);
+    envs->free = _image_get_u64(r);
+    envs->num_free = _image_get_u64(r);
+    envs->max = _image_capacity(_image_check_count(r, num_frames, sizeof(U64) * 5), 64);
+    envs->frames = (EnvFrame *) LISP_REALLOC(envs->frames, sizeof(EnvFrame) * envs->max);
+    if (!envs->frames)
+    {
+        LISP_FAIL("image memory allocation failed\n");
+    }
+    /* frames count once they are whole, so a corrupt one can be freed */
+    for (U64 i = 0; i < num_frames; i++)
+    {
+        EnvFrame * frame = envs->frames + i;
+        frame->outer = _image_get_u64(r);
+        U64 const num = _image_get_u64(r);
+        U64 const max = _image_get_u64(r);
+        frame->global = _image_get_u64(r) != 0;
+        frame->num_cells = _image_get_u64(r);
+
+        /* freed bindings go by size class, so max is a power of two */
+        if (num > max || max > UINT32_MAX || (max & (max - 1)))
+        {
+            LISP_FAIL("corrupt image\n");
+        }
+        frame->num = (U32) _image_check_count(r, num, sizeof(EnvBinding));
+        frame->max = (U32) max;
+        _image_check_count(r, frame->num_cells, sizeof(EnvBinding));
+        frame->bindings = (EnvBinding *) _image_get_copy(r, sizeof(EnvBinding) * frame->num, sizeof(EnvBinding) * frame->max);
+        frame->cells = (EnvBinding *) _image_get_copy(r, sizeof(EnvBinding) * frame->num_cells, sizeof(EnvBinding) * frame->num_cells);
+        envs->num = i + 1;
+    }
+
+    ClosureState * closure = &sys->closure;
+    closure->num = _image_get_u64(r);
+    closure->free = _image_get_u64(r);
+    closure->num_free = _image_get_u64(r);
+    _image_check_count(r, closure->num, sizeof(U64) * 4);
+    closure->max = _image_capacity(closure->num, 64);
+    closure->closures = (Closure *) LISP_REALLOC(closure->closures, sizeof(Closure) * closure->max);
+    if (!closure->closures)
+    {
+        LISP_FAIL("image memory allocation failed\n");
+    }
+    for (U64 i = 0; i < closure->num; i++)
+    {
+        Closure * info = closure->closures + i;
+        info->env = _image_get_u64(r);
+        info->params = _image_get_u64(r);
+        info->body = _image_get_u64(r);
+        info->kind = _image_get_u64(r);
+        info->code = NULL;
+    }
+
+    if (r->pos != r->size)
+    {
+        LISP_FAIL("trailing data in image\n");
+    }
+}
+
+/* loads the image at path into a system fresh from system_init and
+   returns the env it was dumped with */
+Expr lisp_image_load(SystemState * sys, char const * path)
+{
+    Expr env = nil;
+
+#if LISP_MMAP
+    int const fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        size_t const size = (size_t) st.st_size;
+        void * data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            LISP_FAIL("cannot map %s\n", path);
+        }
+        posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+
+        ImageReader r = { (char const *) data, size, 0 };
+        _image_restore(sys, &r, &env);
+        munmap(data, size);
+        return env;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+#endif
+
+    FILE * file = fopen(path, "rb");
+    if (!file)
+    {
+        LISP_FAIL("cannot open %s\n", path);
+    }
+    char * data = NULL;
+    size_t size = 0;
+    size_t max = 0;
+    for (;;)
+    {
+        if (size == max)
+        {
+            max = max ? max * 2 : LISP_STREAM_READ_SIZE;
+            data = (char *) LISP_REALLOC(data, max);
+            if (!data)
+            {
+                LISP_FAIL("image memory allocation failed\n");
+            }
+        }
+        size_t const len = fread(data + size, 1, max - size, file);
+        if (!len)
+        {
+            break;
+        }
+        size += len;
+    }
+    fclose(file);
+
+    ImageReader r = { data, size, 0 };
+    _image_restore(sys, &r, &env);
+    LISP_FREE(data);
+    return env;
+}
+
+#if LISP_GLOBAL_API
+
+void image_dump(Expr env, char const * path)
+{
+    lisp_image_dump(&global, env, path);
+}
+
+Expr image_load(char const * path)
+{
+    return lisp_image_load(&global, path);
+}
+
+#endif
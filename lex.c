@@ -0,0 +1,314 @@
+
+#include "common.h"
+
+#if LISP_LEX_SIMD
+#include <immintrin.h>
+#endif
+
+U8 const lisp_lex_classes[256] =
+{
+    [0] = LEX_DELIMITER | LEX_STRING_SPECIAL | LEX_LINE_END,
+    [' '] = LEX_WHITESPACE | LEX_DELIMITER,
+    ['\t'] = LEX_WHITESPACE | LEX_DELIMITER,
+    ['\n'] = LEX_WHITESPACE | LEX_DELIMITER | LEX_LINE_END,
+    ['"'] = LEX_DELIMITER | LEX_STRING_SPECIAL,
+    ['\\'] = LEX_STRING_SPECIAL,
+    ['('] = LEX_DELIMITER,
+    [')'] = LEX_DELIMITER,
+    [';'] = LEX_DELIMITER,
+    ['\''] = LEX_DELIMITER,
+};
+
+/* each scanner returns the offset of the first byte of interest in
+   p[0..n), or n if there is none */
+
+static bool _lex_is_whitespace(char ch)
+{
+    return lisp_lex_classes[(U8) ch] & LEX_WHITESPACE;
+}
+
+static bool _lex_is_delimiter(char ch)
+{
+    return lisp_lex_classes[(U8) ch] & LEX_DELIMITER;
+}
+
+static bool _lex_is_string_special(char ch)
+{
+    return lisp_lex_classes[(U8) ch] & LEX_STRING_SPECIAL;
+}
+
+static bool _lex_is_line_end(char ch)
+{
+    return lisp_lex_classes[(U8) ch] & LEX_LINE_END;
+}
+
+/* scalar */
+
+static size_t _lex_skip_whitespace_scalar(char const * p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && _lex_is_whitespace(p[i]))
+    {
+        ++i;
+    }
+    return i;
+}
+
+static size_t _lex_find_delimiter_scalar(char const * p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && !_lex_is_delimiter(p[i]))
+    {
+        ++i;
+    }
+    return i;
+}
+
+static size_t _lex_find_string_special_scalar(char const * p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && !_lex_is_string_special(p[i]))
+    {
+        ++i;
+    }
+    return i;
+}
+
+static size_t _lex_find_line_end_scalar(char const * p, size_t n)
+{
+    size_t i = 0;
+    while (i < n && !_lex_is_line_end(p[i]))
+    {
+        ++i;
+    }
+    return i;
+}
+
+#if LISP_LEX_SIMD
+
+/* a block of width bytes is classified into a bit mask with one bit per
+   byte, the first set bit is the answer. the tail that does not fill a
+   block is finished by the scalar test, so loads never pass the end. */
+#define LISP_LEX_SCAN(width, load, mask, test) \
+    size_t i = 0; \
+    for (; i + width <= n; i += width) \
+    { \
+        U32 const bits = mask(load(p + i)); \
+        if (bits) \
+        { \
+            return i + (size_t) __builtin_ctz(bits); \
+        } \
+    } \
+    for (; i < n; i++) \
+    { \
+        if (test(p[i])) \
+        { \
+            return i; \
+        } \
+    } \
+    return n;
+
+/* sse2 */
+
+static __m128i _lex_load_sse2(char const * p)
+{
+    return _mm_loadu_si128((__m128i const *) p);
+}
+
+static __m128i _lex_eq_sse2(__m128i v, char ch)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(ch));
+}
+
+static __m128i _lex_whitespace_sse2(__m128i v)
+{
+    return _mm_or_si128(_mm_or_si128(_lex_eq_sse2(v, ' '), _lex_eq_sse2(v, '\n')), _lex_eq_sse2(v, '\t'));
+}
+
+static U32 _lex_not_whitespace_mask_sse2(__m128i v)
+{
+    return (U32) _mm_movemask_epi8(_lex_whitespace_sse2(v)) ^ 0xffff;
+}
+
+static U32 _lex_delimiter_mask_sse2(__m128i v)
+{
+    __m128i m = _mm_or_si128(_lex_whitespace_sse2(v), _lex_eq_sse2(v, 0));
+    m = _mm_or_si128(m, _mm_or_si128(_lex_eq_sse2(v, '"'), _lex_eq_sse2(v, ';')));
+    m = _mm_or_si128(m, _mm_or_si128(_lex_eq_sse2(v, '('), _lex_eq_sse2(v, ')')));
+    m = _mm_or_si128(m, _lex_eq_sse2(v, '\''));
+    return (U32) _mm_movemask_epi8(m);
+}
+
+static U32 _lex_string_special_mask_sse2(__m128i v)
+{
+    __m128i const m = _mm_or_si128(_mm_or_si128(_lex_eq_sse2(v, '"'), _lex_eq_sse2(v, '\\')), _lex_eq_sse2(v, 0));
+    return (U32) _mm_movemask_epi8(m);
+}
+
+static U32 _lex_line_end_mask_sse2(__m128i v)
+{
+    return (U32) _mm_movemask_epi8(_mm_or_si128(_lex_eq_sse2(v, '\n'), _lex_eq_sse2(v, 0)));
+}
+
+static size_t _lex_skip_whitespace_sse2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(16, _lex_load_sse2, _lex_not_whitespace_mask_sse2, !_lex_is_whitespace)
+}
+
+static size_t _lex_find_delimiter_sse2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(16, _lex_load_sse2, _lex_delimiter_mask_sse2, _lex_is_delimiter)
+}
+
+static size_t _lex_find_string_special_sse2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(16, _lex_load_sse2, _lex_string_special_mask_sse2, _lex_is_string_special)
+}
+
+static size_t _lex_find_line_end_sse2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(16, _lex_load_sse2, _lex_line_end_mask_sse2, _lex_is_line_end)
+}
+
+/* avx2, compiled for the target on its own so the rest of the program
+   still runs on cpus without it */
+
+#define LISP_LEX_AVX2 __attribute__((target("avx2")))
+
+LISP_LEX_AVX2 static __m256i _lex_load_avx2(char const * p)
+{
+    return _mm256_loadu_si256((__m256i const *) p);
+}
+
+LISP_LEX_AVX2 static __m256i _lex_eq_avx2(__m256i v, char ch)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch));
+}
+
+LISP_LEX_AVX2 static __m256i _lex_whitespace_avx2(__m256i v)
+{
+    return _mm256_or_si256(_mm256_or_si256(_lex_eq_avx2(v, ' '), _lex_eq_avx2(v, '\n')), _lex_eq_avx2(v, '\t'));
+}
+
+LISP_LEX_AVX2 static U32 _lex_not_whitespace_mask_avx2(__m256i v)
+{
+    return ~(U32) _mm256_movemask_epi8(_lex_whitespace_avx2(v));
+}
+
+LISP_LEX_AVX2 static U32 _lex_delimiter_mask_avx2(__m256i v)
+{
+    __m256i m = _mm256_or_si256(_lex_whitespace_avx2(v), _lex_eq_avx2(v, 0));
+    m = _mm256_or_si256(m, _mm256_or_si256(_lex_eq_avx2(v, '"'), _lex_eq_avx2(v, ';')));
+    m = _mm256_or_si256(m, _mm256_or_si256(_lex_eq_avx2(v, '('), _lex_eq_avx2(v, ')')));
+    m = _mm256_or_si256(m, _lex_eq_avx2(v, '\''));
+    return (U32) _mm256_movemask_epi8(m);
+}
+
+LISP_LEX_AVX2 static U32 _lex_string_special_mask_avx2(__m256i v)
+{
+    __m256i const m = _mm256_or_si256(_mm256_or_si256(_lex_eq_avx2(v, '"'), _lex_eq_avx2(v, '\\')), _lex_eq_avx2(v, 0));
+    return (U32) _mm256_movemask_epi8(m);
+}
+
+LISP_LEX_AVX2 static U32 _lex_line_end_mask_avx2(__m256i v)
+{
+    return (U32) _mm256_movemask_epi8(_mm256_or_si256(_lex_eq_avx2(v, '\n'), _lex_eq_avx2(v, 0)));
+}
+
+LISP_LEX_AVX2 static size_t _lex_skip_whitespace_avx2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(32, _lex_load_avx2, _lex_not_whitespace_mask_avx2, !_lex_is_whitespace)
+}
+
+LISP_LEX_AVX2 static size_t _lex_find_delimiter_avx2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(32, _lex_load_avx2, _lex_delimiter_mask_avx2, _lex_is_delimiter)
+}
+
+LISP_LEX_AVX2 static size_t _lex_find_string_special_avx2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(32, _lex_load_avx2, _lex_string_special_mask_avx2, _lex_is_string_special)
+}
+
+LISP_LEX_AVX2 static size_t _lex_find_line_end_avx2(char const * p, size_t n)
+{
+    LISP_LEX_SCAN(32, _lex_load_avx2, _lex_line_end_mask_avx2, _lex_is_line_end)
+}
+
+#undef LISP_LEX_AVX2
+#undef LISP_LEX_SCAN
+
+#endif
+
+/* picks the scanners for isa, false if the cpu or the build lacks it */
+bool lex_select(LexState * lex, char const * isa)
+{
+    if (!strcmp(isa, "scalar"))
+    {
+        lex->isa = "scalar";
+        lex->skip_whitespace = _lex_skip_whitespace_scalar;
+        lex->find_delimiter = _lex_find_delimiter_scalar;
+        lex->find_string_special = _lex_find_string_special_scalar;
+        lex->find_line_end = _lex_find_line_end_scalar;
+        return true;
+    }
+
+#if LISP_LEX_SIMD
+    __builtin_cpu_init();
+    if (!strcmp(isa, "avx2") && __builtin_cpu_supports("avx2"))
+    {
+        lex->isa = "avx2";
+        lex->skip_whitespace = _lex_skip_whitespace_avx2;
+        lex->find_delimiter = _lex_find_delimiter_avx2;
+        lex->find_string_special = _lex_find_string_special_avx2;
+        lex->find_line_end = _lex_find_line_end_avx2;
+        return true;
+    }
+    if (!strcmp(isa, "sse2") && __builtin_cpu_supports("sse2"))
+    {
+        lex->isa = "sse2";
+        lex->skip_whitespace = _lex_skip_whitespace_sse2;
+        lex->find_delimiter = _lex_find_delimiter_sse2;
+        lex->find_string_special = _lex_find_string_special_sse2;
+        lex->find_line_end = _lex_find_line_end_sse2;
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+void lex_init(LexState * lex)
+{
+    memset(lex, 0, sizeof(LexState));
+    if (!lex_select(lex, "avx2") && !lex_select(lex, "sse2"))
+    {
+        lex_select(lex, "scalar");
+    }
+}
+
+void lex_quit(LexState * lex)
+{
+    memset(lex, 0, sizeof(LexState));
+}
+
+/* a comment ends at a newline, or at a zero byte which the reader takes
+   as the end */
+size_t lisp_lex_skip_blank_slow(LexState * lex, char const * p, size_t n)
+{
+    size_t i = 0;
+    for (;;)
+    {
+        i += lisp_lex_skip_whitespace(lex, p + i, n - i);
+        if (i == n || p[i] != ';')
+        {
+            return i;
+        }
+        i += 1 + lisp_lex_find_line_end(lex, p + i + 1, n - i - 1);
+        if (i == n || p[i] == 0)
+        {
+            return i;
+        }
+        ++i;
+    }
+}
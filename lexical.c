@@ -0,0 +1,400 @@
+
+#include "common.h"
+
+#define LISP_LEXICAL_MAX_NAMES 256
+
+typedef struct LexicalScope
+{
+    struct LexicalScope const * outer;
+    U64 num;
+    Expr names[LISP_LEXICAL_MAX_NAMES];
+    /* the frame layout is unknown, so the lambda is left alone */
+    bool opaque;
+    /* the body may add bindings to the frame at runtime, which could
+       shadow outer names, so only the names of this frame resolve */
+    bool barrier;
+} LexicalScope;
+
+enum
+{
+    FORM_CALL,
+    FORM_QUOTE,
+    FORM_LAMBDA,
+    FORM_REFLECT,
+};
+
+#define LISP_LEXICAL_DEF_SLOTS 256
+
+static U64 _lexical_hash(Expr form)
+{
+    /* fibonacci hashing spreads consecutive cons indices */
+    return expr_data(form) * UINT64_C(0x9e3779b97f4a7c15);
+}
+
+static LexicalEntry * _lexical_find(LexicalState * lexical, Expr form)
+{
+    U64 const mask = lexical->num_slots - 1;
+    for (U64 slot = _lexical_hash(form) & mask;; slot = (slot + 1) & mask)
+    {
+        LexicalEntry * entry = lexical->slots + slot;
+        if (entry->form == form || entry->form == nil)
+        {
+            return entry;
+        }
+    }
+}
+
+static void _lexical_rehash(LexicalState * lexical, U64 num_slots)
+{
+    LexicalEntry * old_slots = lexical->slots;
+    U64 const old_num_slots = lexical->num_slots;
+
+    lexical->slots = (LexicalEntry *) LISP_MALLOC(sizeof(LexicalEntry) * num_slots);
+    if (!lexical->slots)
+    {
+        LISP_FAIL("lexical memory allocation failed\n");
+    }
+    memset(lexical->slots, 0, sizeof(LexicalEntry) * num_slots);
+    lexical->num_slots = num_slots;
+
+    for (U64 i = 0; i < old_num_slots; i++)
+    {
+        if (old_slots[i].form)
+        {
+            *_lexical_find(lexical, old_slots[i].form) = old_slots[i];
+        }
+    }
+    LISP_FREE(old_slots);
+}
+
+static void _lexical_insert(LexicalState * lexical, Expr form, Expr resolved)
+{
+    /* keep the load factor at or below one half */
+    if ((lexical->num + 1) * 2 > lexical->num_slots)
+    {
+        _lexical_rehash(lexical, lexical->num_slots * 2);
+    }
+
+    LexicalEntry * entry = _lexical_find(lexical, form);
+    if (entry->form == nil)
+    {
+        ++lexical->num;
+    }
+    entry->form = form;
+    entry->resolved = resolved;
+}
+
+void lexical_init(LexicalState * lexical)
+{
+    memset(lexical, 0, sizeof(LexicalState));
+    _lexical_rehash(lexical, LISP_LEXICAL_DEF_SLOTS);
+}
+
+void lexical_quit(LexicalState * lexical)
+{
+    LISP_FREE(lexical->slots);
+    memset(lexical, 0, sizeof(LexicalState));
+}
+
+void lisp_lexical_flush(LexicalState * lexical)
+{
+    memset(lexical->slots, 0, sizeof(LexicalEntry) * lexical->num_slots);
+    lexical->num = 0;
+}
+
+static I64 _lexical_find_name(LexicalScope const * scope, Expr name)
+{
+    for (U64 i = 0; i < scope->num; i++)
+    {
+        if (scope->names[i] == name)
+        {
+            return (I64) i;
+        }
+    }
+    return -1;
+}
+
+static bool _lexical_is_bound(LexicalScope const * scope, Expr name)
+{
+    for (; scope; scope = scope->outer)
+    {
+        if (_lexical_find_name(scope, name) >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void _lexical_add_name(LexicalScope * scope, Expr name)
+{
+    /* a repeated name would reuse its slot, so the layout is unknown */
+    if (!is_symbol(name) || name == LISP_SYM_ENV ||
+        scope->num == LISP_LEXICAL_MAX_NAMES || _lexical_find_name(scope, name) >= 0)
+    {
+        scope->opaque = true;
+        return;
+    }
+    scope->names[scope->num++] = name;
+}
+
+/* mirrors env_destructuring_bind, which assigns slots in this order */
+static void _lexical_add_names(SystemState * sys, LexicalScope * scope, Expr vars)
+{
+    while (is_cons(vars))
+    {
+        _lexical_add_names(sys, scope, lisp_car(&sys->cons, vars));
+        vars = lisp_cdr(&sys->cons, vars);
+    }
+    if (vars)
+    {
+        _lexical_add_name(scope, vars);
+    }
+}
+
+static int _lexical_classify(SystemState * sys, LexicalScope const * scope, Expr op, Expr env)
+{
+    if (!is_symbol(op) || _lexical_is_bound(scope, op) || !lisp_env_can_set(sys, env, op))
+    {
+        return FORM_CALL;
+    }
+
+    Expr const val = lisp_env_get(sys, env, op);
+    if (is_special(val))
+    {
+        SpecialFun const fun = lisp_special_fun(&sys->special, val);
+        if (fun == s_quote)
+        {
+            return FORM_QUOTE;
+        }
+        if (fun == s_lambda || fun == s_syntax)
+        {
+            return FORM_LAMBDA;
+        }
+        if (fun == s_def || fun == s_backquote)
+        {
+            return FORM_REFLECT;
+        }
+    }
+    else if (lisp_is_macro(&sys->closure, val))
+    {
+        /* the arguments are data to the macro and its expansion may def */
+        return FORM_REFLECT;
+    }
+    else if (is_builtin(val) && lisp_builtin_fun(&sys->builtin, val) == f_load_file)
+    {
+        return FORM_REFLECT;
+    }
+    return FORM_CALL;
+}
+
+/* true if evaluating exp may add bindings to the innermost frame */
+static bool _lexical_extends_frame(SystemState * sys, LexicalScope const * scope, Expr exp, Expr env)
+{
+    if (exp == LISP_SYM_ENV)
+    {
+        return true;
+    }
+    if (!is_cons(exp))
+    {
+        return false;
+    }
+
+    switch (_lexical_classify(sys, scope, lisp_car(&sys->cons, exp), env))
+    {
+    case FORM_QUOTE:
+    case FORM_LAMBDA:
+        return false;
+    case FORM_REFLECT:
+        return true;
+    default:
+        for (Expr tmp = exp; is_cons(tmp); tmp = lisp_cdr(&sys->cons, tmp))
+        {
+            if (_lexical_extends_frame(sys, scope, lisp_car(&sys->cons, tmp), env))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+static Expr _lexical_lookup(LexicalScope const * scope, Expr name)
+{
+    if (name == LISP_SYM_ENV || expr_data(name) > 0xffffffff)
+    {
+        return name;
+    }
+
+    for (U64 depth = 0; scope && depth <= LISP_LOCAL_MAX_DEPTH; scope = scope->outer, depth++)
+    {
+        I64 const index = _lexical_find_name(scope, name);
+        if (index >= 0)
+        {
+            U64 const slot = (U64) index;
+            return slot <= LISP_LOCAL_MAX_SLOT ? make_local(depth, slot, name) : name;
+        }
+
+        if (scope->barrier)
+        {
+            break;
+        }
+    }
+    return name;
+}
+
+static Expr _lexical_resolve_lambda(SystemState * sys, LexicalScope const * outer, Expr args, Expr env);
+
+/* a copy of the list exps with the names in scope resolved. quoted and
+   reflected forms are left shared. */
+static Expr _lexical_resolve_list(SystemState * sys, LexicalScope const * scope, Expr exps, Expr env)
+{
+    ConsState * cons = &sys->cons;
+    Expr head = nil;
+    Expr tail = nil;
+    Expr tmp = exps;
+    for (; is_cons(tmp); tmp = lisp_cdr(cons, tmp))
+    {
+        Expr exp = lisp_car(cons, tmp);
+        if (is_symbol(exp))
+        {
+            exp = _lexical_lookup(scope, exp);
+        }
+        else if (is_cons(exp))
+        {
+            switch (_lexical_classify(sys, scope, lisp_car(cons, exp), env))
+            {
+            case FORM_QUOTE:
+            case FORM_REFLECT:
+                break;
+            case FORM_LAMBDA:
+                exp = lisp_cons(cons, lisp_car(cons, exp), _lexical_resolve_lambda(sys, scope, lisp_cdr(cons, exp), env));
+                break;
+            default:
+                exp = _lexical_resolve_list(sys, scope, exp, env);
+                break;
+            }
+        }
+
+        Expr const next = lisp_cons(cons, exp, nil);
+        if (tail)
+        {
+            lisp_rplacd(cons, tail, next);
+        }
+        else
+        {
+            head = next;
+        }
+        tail = next;
+    }
+    if (tail)
+    {
+        lisp_rplacd(cons, tail, tmp);
+        return head;
+    }
+    return tmp;
+}
+
+/* the resolved copy of args, or args itself when its frame layout is
+   unknown */
+static Expr _lexical_resolve_lambda(SystemState * sys, LexicalScope const * outer, Expr args, Expr env)
+{
+    if (!is_cons(args))
+    {
+        return args;
+    }
+
+    LexicalScope scope;
+    scope.outer = outer;
+    scope.num = 0;
+    scope.opaque = false;
+    scope.barrier = false;
+
+    _lexical_add_names(sys, &scope, lisp_car(&sys->cons, args));
+    if (scope.opaque)
+    {
+        return args;
+    }
+
+    for (Expr tmp = lisp_cdr(&sys->cons, args); is_cons(tmp); tmp = lisp_cdr(&sys->cons, tmp))
+    {
+        if (_lexical_extends_frame(sys, &scope, lisp_car(&sys->cons, tmp), env))
+        {
+            scope.barrier = true;
+            break;
+        }
+    }
+
+    Expr const body = _lexical_resolve_list(sys, &scope, lisp_cdr(&sys->cons, args), env);
+    Expr const resolved = lisp_cons(&sys->cons, lisp_car(&sys->cons, args), body);
+    /* nested lambdas are built from the copy and need no more work */
+    _lexical_insert(&sys->lexical, resolved, resolved);
+    return resolved;
+}
+
+/* args is (<params> . <body>) of a lambda or syntax form. it is copied
+   once per form until the next collection. */
+Expr lisp_lexical_resolve(SystemState * sys, Expr args, Expr env)
+{
+#if LISP_LEXICAL_ADDRESSING
+    LexicalState * lexical = &sys->lexical;
+    if (!is_cons(args))
+    {
+        return args;
+    }
+    LexicalEntry const * entry = _lexical_find(lexical, args);
+    if (entry->form == args)
+    {
+        return entry->resolved;
+    }
+    Expr const resolved = _lexical_resolve_lambda(sys, NULL, args, env);
+    _lexical_insert(lexical, args, resolved);
+    return resolved;
+#else
+    return args;
+#endif
+}
+
+static bool _lexical_has_local(ConsState * cons, Expr exp)
+{
+    for (; is_cons(exp); exp = lisp_cdr(cons, exp))
+    {
+        if (_lexical_has_local(cons, lisp_car(cons, exp)))
+        {
+            return true;
+        }
+    }
+    return is_local(exp);
+}
+
+Expr lisp_lexical_unresolve(ConsState * cons, Expr exp)
+{
+    if (is_local(exp))
+    {
+        return local_name(exp);
+    }
+    if (!_lexical_has_local(cons, exp))
+    {
+        return exp;
+    }
+
+    /* along the list in a loop, so only nesting recurses */
+    Expr head = nil;
+    Expr tail = nil;
+    Expr tmp = exp;
+    for (; is_cons(tmp); tmp = lisp_cdr(cons, tmp))
+    {
+        Expr const next = lisp_cons(cons, lisp_lexical_unresolve(cons, lisp_car(cons, tmp)), nil);
+        if (tail)
+        {
+            lisp_rplacd(cons, tail, next);
+        }
+        else
+        {
+            head = next;
+        }
+        tail = next;
+    }
+    lisp_rplacd(cons, tail, lisp_lexical_unresolve(cons, tmp));
+    return head;
+}
@@ -1,6 +1,8 @@
 
 #include "common.h"
 
+#include <setjmp.h>
+
 static void fail(char const * fmt, ...)
 {
     if (fmt)
@@ -14,7 +16,13 @@ static void fail(char const * fmt, ...)
             "usage: lisp <command> <options>\n"
             "commands:\n"
             "  unit ......... run unit tests\n"
-            "  load {FILE} .. load source files\n"
+            "  load {FILE} .. load source files, --vm compiles every function,\n"
+            "                 --pipeline reads ahead on a second thread,\n"
+            "                 --data only reads them, in parallel when large\n"
+            "  profile {FILE} load source files sampling the lisp call stack,\n"
+            "                 --out sets where folded stacks go (profile.folded),\n"
+            "                 --vm compiles every function\n"
+            "  bench [FILE] . run benchmarks, one json line per result\n"
         );
     exit(1);
 }
@@ -45,6 +53,17 @@ static void unit_test_nil(TestState * test)
     LISP_TEST_ASSERT(test, is_nil(nil));
 }
 
+static void unit_test_fixnum(TestState * test)
+{
+    LISP_TEST_GROUP(test, "fixnum");
+    LISP_TEST_ASSERT(test, is_fixnum(make_fixnum(0)));
+    LISP_TEST_ASSERT(test, fixnum_value(make_fixnum(42)) == 42);
+    LISP_TEST_ASSERT(test, fixnum_value(make_fixnum(-42)) == -42);
+    LISP_TEST_ASSERT(test, fixnum_value(make_fixnum(LISP_FIXNUM_MAX)) == LISP_FIXNUM_MAX);
+    LISP_TEST_ASSERT(test, fixnum_value(make_fixnum(LISP_FIXNUM_MIN)) == LISP_FIXNUM_MIN);
+    LISP_TEST_ASSERT(test, !fixnum_in_range(LISP_FIXNUM_MAX + 1));
+}
+
 static void unit_test_symbol(TestState * test)
 {
     LISP_TEST_GROUP(test, "symbol");
@@ -56,6 +75,66 @@ static void unit_test_symbol(TestState * test)
 
     LISP_TEST_ASSERT(test, intern("foo") == intern("foo"));
     LISP_TEST_ASSERT(test, intern("foo") != intern("bar"));
+
+    LISP_TEST_ASSERT(test, intern("t") == LISP_SYM_T);
+    LISP_TEST_ASSERT(test, intern("quote") == LISP_SYM_QUOTE);
+    LISP_TEST_ASSERT(test, intern("*env*") == LISP_SYM_ENV);
+    LISP_TEST_ASSERT(test, intern(".") == LISP_SYM_DOT);
+
+    LISP_TEST_ASSERT(test, intern_n("foobar", 3) == intern("foo"));
+    LISP_TEST_ASSERT(test, intern_n("nilly", 3) == nil);
+    LISP_TEST_ASSERT(test, symbol_length(intern("foo")) == 3);
+
+    {
+        /* force the index to grow a few times */
+        char name[16];
+        for (int i = 0; i < 1000; i++)
+        {
+            sprintf(name, "sym%d", i);
+            intern(name);
+        }
+        LISP_TEST_ASSERT(test, !strcmp("sym123", symbol_name(intern("sym123"))));
+        LISP_TEST_ASSERT(test, intern("sym999") == intern("sym999"));
+        LISP_TEST_ASSERT(test, intern("foo") == intern_n("foo", 3));
+    }
+}
+
+static void unit_test_string(TestState * test)
+{
+    LISP_TEST_GROUP(test, "string");
+
+    Expr const foo = make_string("foo");
+    LISP_TEST_ASSERT(test, is_string(foo));
+    LISP_TEST_ASSERT(test, !strcmp("foo", string_value(foo)));
+    LISP_TEST_ASSERT(test, string_length(foo) == 3);
+    LISP_TEST_ASSERT(test, make_string("foo") != foo);
+
+    Expr const nul = make_string_n("a\0b", 3);
+    LISP_TEST_ASSERT(test, string_length(nul) == 3);
+    LISP_TEST_ASSERT(test, !memcmp("a\0b", string_value(nul), 4));
+
+    /* literals are deduplicated */
+    LISP_TEST_ASSERT(test, intern_string_n("bar", 3) == intern_string_n("barbaz", 3));
+    LISP_TEST_ASSERT(test, intern_string_n("bar", 3) != intern_string_n("baz", 3));
+    LISP_TEST_ASSERT(test, read_one_from_string("\"qux\"") == read_one_from_string("\"qux\""));
+
+    /* long strings get a chunk of their own */
+    {
+        static char buffer[LISP_STRING_CHUNK_SIZE * 2];
+        memset(buffer, 'x', sizeof(buffer));
+        Expr const big = make_string_n(buffer, sizeof(buffer));
+        LISP_TEST_ASSERT(test, string_length(big) == sizeof(buffer));
+        LISP_TEST_ASSERT(test, string_value(big)[sizeof(buffer)] == 0);
+    }
+
+    /* the table grows on demand */
+    U64 const num = global.string.num;
+    for (U64 i = 0; i < 1000; i++)
+    {
+        make_string("x");
+    }
+    LISP_TEST_ASSERT(test, global.string.num == num + 1000);
+    LISP_TEST_ASSERT(test, !strcmp("foo", string_value(foo)));
 }
 
 static void unit_test_cons(TestState * test)
@@ -74,6 +153,30 @@ static void unit_test_stream(TestState * test)
     LISP_TEST_ASSERT(test, is_stream(global.stream.stderr));
 }
 
+static void unit_test_stream_output(TestState * test)
+{
+    LISP_TEST_GROUP(test, "stream output");
+
+    Expr out = make_string_output_stream();
+    for (int i = 0; i < 10000; i++)
+    {
+        stream_put_char(out, 'a' + i % 26);
+    }
+    stream_put_string(out, "end");
+    size_t len = 0;
+    char const * str = stream_output(out, &len);
+    LISP_TEST_ASSERT(test, len == 10003);
+    LISP_TEST_ASSERT(test, str[25] == 'z' && !strcmp(str + 10000, "end"));
+    stream_release(out);
+
+    char buffer[8];
+    out = lisp_make_buffer_output_stream(&global.stream, sizeof(buffer), buffer);
+    stream_put_string(out, "foo");
+    stream_put_char(out, '!');
+    stream_release(out);
+    LISP_TEST_ASSERT(test, !strcmp("foo!", buffer));
+}
+
 static void unit_test_reader(TestState * test)
 {
     Expr foo = intern("foo");
@@ -87,12 +190,198 @@ static void unit_test_reader(TestState * test)
     LISP_TEST_ASSERT(test, equal(read_one_from_string("`foo"), make_backquote(foo)));
     LISP_TEST_ASSERT(test, equal(read_one_from_string(",foo"), list_2(intern("unquote"), foo)));
     LISP_TEST_ASSERT(test, equal(read_one_from_string(",@foo"), list_2(intern("unquote-splicing"), foo)));
+
+    LISP_TEST_ASSERT(test, !strcmp("abc", string_value(read_one_from_string("\"abc\""))));
+    LISP_TEST_ASSERT(test, !strcmp("a\"c\n", string_value(read_one_from_string("\"a\\\"c\\n\""))));
+
+    LISP_TEST_ASSERT(test, read_one_from_string("123") == make_fixnum(123));
+    LISP_TEST_ASSERT(test, read_one_from_string("-7") == make_fixnum(-7));
+    LISP_TEST_ASSERT(test, read_one_from_string("+7") == make_fixnum(7));
+    LISP_TEST_ASSERT(test, read_one_from_string("-") == intern("-"));
+    LISP_TEST_ASSERT(test, read_one_from_string("1+") == intern("1+"));
+
+    {
+        /* buffer input streams need not be NUL-terminated */
+        Expr in = lisp_make_buffer_input_stream(&global.stream, 9, "(foo bar)baz");
+        Expr exp = nil;
+        LISP_TEST_ASSERT(test, maybe_parse_expr(in, &exp));
+        LISP_TEST_ASSERT(test, equal(exp, list_2(foo, intern("bar"))));
+        LISP_TEST_ASSERT(test, !maybe_parse_expr(in, &exp));
+        stream_release(in);
+
+        in = lisp_make_buffer_input_stream(&global.stream, 3, "foobar");
+        LISP_TEST_ASSERT(test, maybe_parse_expr(in, &exp) && exp == foo);
+        stream_release(in);
+    }
+}
+
+static void unit_test_parser(TestState * test)
+{
+    LISP_TEST_GROUP(test, "parser");
+
+    /* any split of the input gives the forms the stream reader gives */
+    static char const src[] =
+        "(foo (bar . 12) \"a\\x41\\n\\\"b\") ; comment\n"
+        "'(x ,y ,@z `w) -34 \"\" (a . (b c))\tsym";
+    char const * const forms[] =
+    {
+        "(foo (bar . 12) \"aA\\n\\\"b\")",
+        "'(x ,y ,@z `w)",
+        "-34",
+        "\"\"",
+        "(a b c)",
+        "sym",
+    };
+    size_t const num_forms = sizeof(forms) / sizeof(forms[0]);
+    size_t const len = sizeof(src) - 1;
+
+    size_t const steps[] = { len, 1, 2, 3, 7 };
+    for (size_t k = 0; k < sizeof(steps) / sizeof(steps[0]); k++)
+    {
+        Parser parser;
+        parser_init(&parser);
+        bool ok = true;
+        size_t num = 0;
+        for (size_t i = 0; i < len; i += steps[k])
+        {
+            size_t const n = i + steps[k] < len ? steps[k] : len - i;
+            parser_feed(&parser, src + i, n);
+
+            /* collections between chunks keep the partial forms */
+            gc_collect();
+
+            Expr exp = nil;
+            while (parser_next(&parser, &exp))
+            {
+                ok = ok && num < num_forms && equal(exp, read_one_from_string(forms[num]));
+                ++num;
+            }
+        }
+        LISP_TEST_ASSERT(test, num == num_forms - 1);
+        LISP_TEST_ASSERT(test, parser_finish(&parser));
+
+        /* the last symbol only ends at the end of input */
+        Expr exp = nil;
+        ok = ok && parser_next(&parser, &exp) && equal(exp, read_one_from_string(forms[num++]));
+        LISP_TEST_ASSERT(test, ok && num == num_forms);
+        LISP_TEST_ASSERT(test, !parser_next(&parser, &exp));
+        parser_quit(&parser);
+    }
+
+    {
+        Parser parser;
+        parser_init(&parser);
+        LISP_TEST_ASSERT(test, parser_feed(&parser, "(a \"b", 5) == PARSER_NEED_MORE);
+        LISP_TEST_ASSERT(test, !parser_finish(&parser));
+        LISP_TEST_ASSERT(test, parser_feed(&parser, "\")", 2) == PARSER_FORM);
+        LISP_TEST_ASSERT(test, parser_finish(&parser));
+        parser_quit(&parser);
+
+        /* parsers may be released in any order */
+        Parser a, b;
+        parser_init(&a);
+        parser_init(&b);
+        U64 const num_roots = global.gc.num_roots;
+        parser_quit(&a);
+        LISP_TEST_ASSERT(test, global.gc.num_roots == num_roots - 2);
+        parser_quit(&b);
+    }
+}
+
+static void unit_test_lex(TestState * test)
+{
+    LISP_TEST_GROUP(test, "lex");
+
+    /* every scanner agrees with the scalar one, at every offset and length
+       around the block sizes */
+    static char const alphabet[] = "ab \n\t;\"\\()'x\0yz-";
+    char buffer[256];
+    U32 seed = 1;
+    for (size_t i = 0; i < sizeof(buffer); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        /* mostly plain bytes, so the scanners run past a block now and then */
+        buffer[i] = (seed >> 16) % 8 ? 'a' + (char) ((seed >> 20) % 26) : alphabet[(seed >> 20) % (sizeof(alphabet) - 1)];
+    }
+
+    LexState scalar;
+    lex_select(&scalar, "scalar");
+
+    char const * const isas[] = { "sse2", "avx2" };
+    for (size_t k = 0; k < sizeof(isas) / sizeof(isas[0]); k++)
+    {
+        LexState lex;
+        if (!lex_select(&lex, isas[k]))
+        {
+            continue;
+        }
+
+        bool same = true;
+        for (size_t start = 0; start < 64; start++)
+        {
+            for (size_t len = 0; start + len <= sizeof(buffer); len++)
+            {
+                char const * p = buffer + start;
+                same = same &&
+                    lex.skip_whitespace(p, len) == scalar.skip_whitespace(p, len) &&
+                    lex.find_delimiter(p, len) == scalar.find_delimiter(p, len) &&
+                    lex.find_string_special(p, len) == scalar.find_string_special(p, len) &&
+                    lex.find_line_end(p, len) == scalar.find_line_end(p, len) &&
+                    lisp_lex_skip_blank(&lex, p, len) == lisp_lex_skip_blank(&scalar, p, len);
+            }
+        }
+        LISP_TEST_ASSERT(test, same);
+    }
+
+    LISP_TEST_ASSERT(test, lisp_lex_skip_blank(&scalar, "  ; c\n\t x", 9) == 8);
+    LISP_TEST_ASSERT(test, lisp_lex_skip_blank(&scalar, "; c", 3) == 3);
+    LISP_TEST_ASSERT(test, lisp_lex_find_delimiter(&scalar, "foo-bar)", 8) == 7);
+    LISP_TEST_ASSERT(test, lisp_lex_find_string_special(&scalar, "abc\\\"", 5) == 3);
+
+    /* long tokens go past the inline prefix */
+    LISP_TEST_ASSERT(test, !strcmp("a-rather-long-symbol-name-indeed", repr(read_one_from_string("a-rather-long-symbol-name-indeed"))));
+    LISP_TEST_ASSERT(test, !strcmp("a long string with an \\\" escape and a long tail after it",
+                                   string_value(read_one_from_string("\"a long string with an \\\\\\\" escape and a long tail after it\""))));
+    LISP_TEST_ASSERT(test, read_one_from_string("                                  ; a long comment that spans a block\n  42") == make_fixnum(42));
 }
 
 static void unit_test_printer(TestState * test)
 {
     LISP_TEST_GROUP(test, "printer");
     LISP_TEST_ASSERT(test, !strcmp("nil", repr(nil)));
+    LISP_TEST_ASSERT(test, !strcmp("-36028797018963968", repr(make_fixnum(LISP_FIXNUM_MIN))));
+
+    {
+        /* longer than any fixed temp buffer */
+        Expr exp = nil;
+        for (int i = 0; i < 2000; i++)
+        {
+            exp = cons(intern("foo"), exp);
+        }
+        LISP_TEST_ASSERT(test, strlen(repr(exp)) == 2000 * 4 + 1);
+    }
+}
+
+static void unit_test_binary(TestState * test)
+{
+    LISP_TEST_GROUP(test, "binary");
+
+    Expr const exp = read_one_from_string("(foo (bar . -5) \"a\\x00b\" foo nil 36028797018963967 (foo bar . baz))");
+    Expr const out = make_string_output_stream();
+    write_binary(exp, out);
+    write_binary(intern("bar"), out);
+    size_t len = 0;
+    char const * data = stream_output(out, &len);
+
+    size_t used = 0;
+    Expr const copy = read_binary(data, len, &used);
+    LISP_TEST_ASSERT(test, !strcmp(repr(copy), repr(exp)));
+    LISP_TEST_ASSERT(test, string_length(caddr(copy)) == 3);
+
+    /* symbols are named once per message, and each message stands alone */
+    LISP_TEST_ASSERT(test, used < len && read_binary(data + used, len - used, NULL) == intern("bar"));
+    LISP_TEST_ASSERT(test, len - used == 4 + 1 + 1 + 3);
+    stream_release(out);
 }
 
 static void unit_test_util(TestState * test)
@@ -154,6 +443,44 @@ static void unit_test_env(TestState * test)
         LISP_TEST_ASSERT(test,  env_can_set(env2, foo));
         LISP_TEST_ASSERT(test, !env_can_set(env2, bar));
     }
+    {
+        /* frames grow past their initial size and keep definition order */
+        Expr env = make_env_sized(nil, 1);
+        for (int i = 0; i < 100; i++)
+        {
+            env_def(env, intern_n("abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz" + i % 26, 1 + i / 26), make_fixnum(i));
+        }
+        LISP_TEST_ASSERT(test, env_get(env, intern("z")) == make_fixnum(25));
+        LISP_TEST_ASSERT(test, env_get(env, intern("xyz")) == make_fixnum(75));
+
+        env_del(env, intern("a"));
+        LISP_TEST_ASSERT(test, !env_can_set(env, intern("a")));
+        LISP_TEST_ASSERT(test, env_get(env, intern("b")) == make_fixnum(1));
+        LISP_TEST_ASSERT(test, env_count_vars(read_one_from_string("(a (b c) . d)")) == 4);
+    }
+    {
+        /* globals live in value cells indexed by symbol */
+        Expr genv = make_global_env();
+        Expr lenv = make_env(genv);
+        Expr const foo = intern("foo");
+        Expr const sym = lisp_gensym(&global.gensym);
+        LISP_TEST_ASSERT(test, env_is_global(genv) && !env_is_global(lenv));
+        LISP_TEST_ASSERT(test, !env_can_set(lenv, foo));
+
+        env_def(genv, foo, make_fixnum(1));
+        env_def(genv, sym, make_fixnum(2));
+        env_def(genv, intern("symbol-interned-after-the-cells"), make_fixnum(3));
+        LISP_TEST_ASSERT(test, env_get(lenv, foo) == make_fixnum(1));
+        LISP_TEST_ASSERT(test, env_get(lenv, sym) == make_fixnum(2));
+        LISP_TEST_ASSERT(test, env_get(lenv, intern("symbol-interned-after-the-cells")) == make_fixnum(3));
+
+        env_set(lenv, foo, make_fixnum(4));
+        LISP_TEST_ASSERT(test, env_get(genv, foo) == make_fixnum(4));
+
+        env_del(genv, foo);
+        LISP_TEST_ASSERT(test, !env_can_set(lenv, foo));
+        LISP_TEST_ASSERT(test, env_can_set(lenv, sym));
+    }
 }
 
 static char const * eval_src(char const * src, Expr env)
@@ -212,37 +539,563 @@ static void unit_test_eval(TestState * test)
         LISP_TEST_ASSERT(test, !strcmp("foo", eval_src("`,'foo", env)));
 
         LISP_TEST_ASSERT(test, !strcmp("(foo bar)", eval_src("`(,@'(foo bar))", env)));
+
+        LISP_TEST_ASSERT(test, !strcmp("42", eval_src("42", env)));
+        LISP_TEST_ASSERT(test, !strcmp("6", eval_src("(+ 1 2 3)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("-1", eval_src("(- 1 2)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("-5", eval_src("(- 5)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("24", eval_src("(* 2 3 4)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("-3", eval_src("(/ -7 2)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("2", eval_src("(mod -7 3)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("t", eval_src("(< 1 2 3)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("nil", eval_src("(< 1 3 2)", env)));
+        LISP_TEST_ASSERT(test, !strcmp("t", eval_src("(= 2 2)", env)));
+    }
+}
+
+static void unit_test_closure(TestState * test)
+{
+    LISP_TEST_GROUP(test, "closure");
+
+    Expr env = make_core_env();
+    gc_push_root(&env);
+
+    Expr const fun = eval(read_one_from_string("(lambda (x) x)"), env);
+    LISP_TEST_ASSERT(test, is_closure(fun));
+    LISP_TEST_ASSERT(test, is_function(fun));
+    LISP_TEST_ASSERT(test, !is_macro(fun));
+    LISP_TEST_ASSERT(test, closure_env(fun) == env);
+    LISP_TEST_ASSERT(test, equal(closure_args(fun), list_1(intern("x"))));
+    LISP_TEST_ASSERT(test, !strncmp("#:<function ", repr(fun), 12));
+
+    Expr const mac = eval(read_one_from_string("(syntax (x) x)"), env);
+    LISP_TEST_ASSERT(test, is_macro(mac));
+    LISP_TEST_ASSERT(test, !is_function(mac));
+    LISP_TEST_ASSERT(test, !strncmp("#:<macro ", repr(mac), 9));
+
+    LISP_TEST_ASSERT(test, !is_closure(list_1(nil)));
+    LISP_TEST_ASSERT(test, !is_function(intern("x")));
+
+    gc_pop_roots(1);
+}
+
+static void unit_test_lexical(TestState * test)
+{
+    LISP_TEST_GROUP(test, "lexical");
+
+    Expr env = make_core_env();
+    Expr const a = intern("a");
+    Expr const b = intern("b");
+
+    {
+        /* (lambda (a b) (cons b (lambda () a))) */
+        Expr const fun = eval(read_one_from_string("(lambda (a b) (cons b (lambda () a)))"), env);
+        Expr const call = car(closure_body(fun));
+        LISP_TEST_ASSERT(test, second(call) == make_local(0, 1, b));
+        LISP_TEST_ASSERT(test, caddr(caddr(call)) == make_local(1, 0, a));
+        LISP_TEST_ASSERT(test, !strcmp("(cons b (lambda nil a))", repr(call)));
+    }
+
+    LISP_TEST_ASSERT(test, !strcmp("(x . y)", eval_src("((lambda (a) ((lambda (b) (cons a b)) 'y)) 'x)", env)));
+    LISP_TEST_ASSERT(test, !strcmp("(1 2 3)", eval_src("((lambda ((a b) . c) (cons a (cons b c))) '(1 2) 3)", env)));
+    LISP_TEST_ASSERT(test, !strcmp("(a . b)", eval_src("((lambda (a a) (cons 'a a)) 'a 'b)", env)));
+
+    /* def shifts the slots of the frame it extends */
+    LISP_TEST_ASSERT(test, !strcmp("(x . y)", eval_src("((lambda (a) (def b 'y) (cons a b)) 'x)", env)));
+    /* and may shadow names from outer frames */
+    LISP_TEST_ASSERT(test, !strcmp("inner", eval_src("(((lambda (a) (lambda () (def a 'inner) a)) 'outer))", env)));
+}
+
+static void unit_test_expand(TestState * test)
+{
+    LISP_TEST_GROUP(test, "expand");
+
+    Expr env = make_core_env();
+    Expr form = read_one_from_string("(m a)");
+    Expr expansion = nil;
+    gc_push_root(&env);
+    gc_push_root(&form);
+
+    eval_src("(def m (syntax (x) (cons 'quote (cons x nil))))", env);
+    LISP_TEST_ASSERT(test, eval(form, env) == intern("a"));
+    LISP_TEST_ASSERT(test, expand_lookup(form, env_get(env, intern("m")), &expansion));
+    LISP_TEST_ASSERT(test, equal(expansion, make_quote(intern("a"))));
+    LISP_TEST_ASSERT(test, eval(form, env) == intern("a"));
+
+    /* redefining the macro expands the call again */
+    eval_src("(def m (syntax (x) ''b))", env);
+    LISP_TEST_ASSERT(test, eval(form, env) == intern("b"));
+
+    /* entries live as long as their call site */
+    gc_collect();
+    LISP_TEST_ASSERT(test, expand_lookup(form, env_get(env, intern("m")), &expansion));
+    U64 const num = global.expand.num;
+    gc_pop_roots(1);
+    gc_collect();
+    LISP_TEST_ASSERT(test, global.expand.num == num - 1);
+
+    gc_pop_roots(1);
+}
+
+static void unit_test_vm(TestState * test)
+{
+    LISP_TEST_GROUP(test, "vm");
+
+    Expr env = make_core_env();
+    gc_push_root(&env);
+
+    eval_src("(def fib (compile (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))))", env);
+    LISP_TEST_ASSERT(test, vm_runs(env_get(env, intern("fib"))));
+    LISP_TEST_ASSERT(test, !strcmp("55", eval_src("(fib 10)", env)));
+
+    /* tail calls run in constant stack */
+    eval_src("(def loop (compile (lambda (n acc) (if (= n 0) acc (loop (- n 1) (+ acc 1))))))", env);
+    LISP_TEST_ASSERT(test, !strcmp("100000", eval_src("(loop 100000 0)", env)));
+
+    /* forms the compiler leaves to eval */
+    LISP_TEST_ASSERT(test, !strcmp("(1 2)", eval_src("((compile (lambda ((a b)) `(,a ,b))) '(1 2))", env)));
+    LISP_TEST_ASSERT(test, !strcmp("(x . y)", eval_src("((compile (lambda (a) (def b 'y) (cons a b))) 'x)", env)));
+    LISP_TEST_ASSERT(test, !strcmp("3", eval_src("((compile (lambda (f) (f 1 2))) +)", env)));
+    LISP_TEST_ASSERT(test, !strcmp("a", eval_src("((compile (lambda (if) (if a))) quote)", env)));
+    LISP_TEST_ASSERT(test, !strcmp("nil", eval_src("((compile (lambda ())))", env)));
+
+    /* macro expansions are compiled in, until the macro changes */
+    eval_src("(def m (syntax (x) (cons 'quote (cons x nil))))", env);
+    eval_src("(def f (compile (lambda () (m a))))", env);
+    LISP_TEST_ASSERT(test, !strcmp("a", eval_src("(f)", env)));
+    eval_src("(def m (syntax (x) ''b))", env);
+    LISP_TEST_ASSERT(test, !strcmp("b", eval_src("(f)", env)));
+
+    /* the guarded macro stays alive, a new one never takes its index */
+    gc_collect();
+    eval_src("(def m (syntax () ''one))", env);
+    eval_src("(def g (compile (lambda () (m))))", env);
+    LISP_TEST_ASSERT(test, !strcmp("one", eval_src("(g)", env)));
+    eval_src("(def m (syntax () ''two))", env);
+    LISP_TEST_ASSERT(test, !strcmp("two", eval_src("(g)", env)));
+    gc_collect();
+    eval_src("(def m (syntax () ''three))", env);
+    LISP_TEST_ASSERT(test, !strcmp("three", eval_src("(g)", env)));
+
+    /* so are inline special forms, as eval would see the new binding */
+    {
+        Expr redef = make_core_env();
+        gc_push_root(&redef);
+        eval_src("(def k (compile (lambda () (if 1 (quote 2) 3))))", redef);
+        LISP_TEST_ASSERT(test, !strcmp("2", eval_src("(k)", redef)));
+        eval_src("(def if (lambda (a b c) (cons a nil)))", redef);
+        LISP_TEST_ASSERT(test, !strcmp("(1)", eval_src("(k)", redef)));
+        eval_src("(def q (compile (lambda () (quote 2))))", redef);
+        LISP_TEST_ASSERT(test, !strcmp("2", eval_src("(q)", redef)));
+        eval_src("(def quote (lambda (x) (cons x x)))", redef);
+        LISP_TEST_ASSERT(test, !strcmp("(2 . 2)", eval_src("(q)", redef)));
+        gc_pop_roots(1);
+    }
+
+    /* a compound operator is evaluated once */
+    eval_src("(def h (compile (lambda () ((if (gensym) quote) x))))", env);
+    U64 const counter = global.gensym.counter;
+    LISP_TEST_ASSERT(test, !strcmp("x", eval_src("(h)", env)));
+    LISP_TEST_ASSERT(test, global.gensym.counter == counter + 1);
+
+    /* code lives as long as the lambda form it was compiled from */
+    gc_collect();
+    U64 const num = global.vm.num_entries;
+    eval_src("(compile (lambda (x) x))", env);
+    LISP_TEST_ASSERT(test, global.vm.num_entries == num + 1);
+    gc_collect();
+    LISP_TEST_ASSERT(test, global.vm.num_entries == num);
+
+    gc_pop_roots(1);
+}
+
+typedef struct
+{
+    jmp_buf fail;
+    char error[LISP_ERROR_MSG_SIZE];
+} ImageFail;
+
+static void image_failed(void * data, char const * msg)
+{
+    ImageFail * f = (ImageFail *) data;
+    snprintf(f->error, sizeof(f->error), "%s", msg);
+    longjmp(f->fail, 1);
+}
+
+/* loads an image of the words after the header, returns the error or "" */
+static char const * image_load_words(ImageFail * f, U64 const * words, size_t num)
+{
+    char const * path = "image.tmp.img";
+    FILE * file = fopen(path, "wb");
+    fwrite("LISPIMG", 1, 8, file);
+    fwrite(words, sizeof(U64), num, file);
+    fclose(file);
+
+    SystemState sys;
+    system_init(&sys);
+    f->error[0] = 0;
+    error_set_handler(image_failed, f);
+    if (!setjmp(f->fail))
+    {
+        lisp_image_load(&sys, path);
+    }
+    error_set_handler(NULL, NULL);
+    system_quit(&sys);
+    remove(path);
+    return f->error;
+}
+
+static void unit_test_image(TestState * test)
+{
+    LISP_TEST_GROUP(test, "image");
+
+    Expr env = make_core_env();
+    gc_push_root(&env);
+    eval(read_one_from_string("(def image-test (cons 'a \"b\"))"), env);
+    eval(read_one_from_string("(def image-fun (lambda (x) (cons x x)))"), env);
+
+    char const * path = "image.tmp.img";
+    image_dump(env, path);
+
+    /* a second system gets the same pools back */
+    SystemState sys;
+    system_init(&sys);
+    Expr const copy = lisp_image_load(&sys, path);
+    remove(path);
+
+    LISP_TEST_ASSERT(test, copy == env);
+    LISP_TEST_ASSERT(test, sys.cons.num == global.cons.num && sys.cons.free == global.cons.free);
+    LISP_TEST_ASSERT(test, !memcmp(sys.cons.pairs, global.cons.pairs, sizeof(struct Pair) * global.cons.num));
+    LISP_TEST_ASSERT(test, sys.symbol.num == global.symbol.num && sys.string.num == global.string.num);
+    LISP_TEST_ASSERT(test, sys.closure.num == global.closure.num && sys.env.num == global.env.num);
+
+    EnvFrame const * frame = lisp_env_frame(&sys.env, copy);
+    Expr const val = frame->cells[expr_data(intern("image-test"))].val;
+    LISP_TEST_ASSERT(test, !strcmp(lisp_string_value(&sys.string, lisp_cdr(&sys.cons, val)), "b"));
+
+    /* literals read after loading still share the ones in the image */
+    LISP_TEST_ASSERT(test, sys.string.num_unique == global.string.num_unique);
+    LISP_TEST_ASSERT(test, lisp_intern_string_n(&sys.string, "b", 1) == lisp_cdr(&sys.cons, val));
+    LISP_TEST_ASSERT(test, !strcmp(lisp_builtin_name(&sys.builtin, frame->cells[expr_data(intern("car"))].val), "car"));
+    LISP_TEST_ASSERT(test, lisp_closure(&sys.closure, frame->cells[expr_data(intern("image-fun"))].val)->kind == CLOSURE_FUNCTION);
+
+    system_quit(&sys);
+
+    /* counts are checked before anything is sized by them */
+    ImageFail f;
+    U64 const symbols[] = { LISP_IMAGE_VERSION, 0, UINT64_MAX };
+    LISP_TEST_ASSERT(test, !strcmp(image_load_words(&f, symbols, sizeof(symbols) / sizeof(U64)), "truncated image\n"));
+    U64 const conses[] = { LISP_IMAGE_VERSION, 0, 0, 0, 0, 0, 0, UINT64_MAX, 0, 0 };
+    LISP_TEST_ASSERT(test, !strcmp(image_load_words(&f, conses, sizeof(conses) / sizeof(U64)), "truncated image\n"));
+    U64 const frames[] = { LISP_IMAGE_VERSION, 0, 0, 0, 0, 0, 0, 0, 0, 0, UINT64_MAX, 0, 0 };
+    LISP_TEST_ASSERT(test, !strcmp(image_load_words(&f, frames, sizeof(frames) / sizeof(U64)), "truncated image\n"));
+    U64 const bindings[] = { LISP_IMAGE_VERSION, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 8, 4, 0, 0, 0, 0, 0, 0 };
+    LISP_TEST_ASSERT(test, !strcmp(image_load_words(&f, bindings, sizeof(bindings) / sizeof(U64)), "corrupt image\n"));
+    gc_pop_roots(1);
+}
+
+static void unit_test_system(TestState * test)
+{
+    LISP_TEST_GROUP(test, "system");
+
+    /* two systems share nothing, and neither touches the global one */
+    U64 const num_conses = global.cons.num;
+    SystemState a;
+    SystemState b;
+    system_init(&a);
+    system_init(&b);
+
+    Expr env_a = lisp_make_core_env(&a);
+    Expr env_b = lisp_make_core_env(&b);
+    lisp_gc_push_root(&a.gc, &env_a);
+    lisp_gc_push_root(&b.gc, &env_b);
+
+    lisp_eval(&a, lisp_read_one_from_string(&a, "(def x (cons 'a 'b))"), env_a);
+    lisp_eval(&b, lisp_read_one_from_string(&b, "(def y 1)"), env_b);
+    lisp_eval(&b, lisp_read_one_from_string(&b, "(def x (+ y 2))"), env_b);
+
+    Expr const x_a = lisp_eval(&a, lisp_read_one_from_string(&a, "x"), env_a);
+    Expr const x_b = lisp_eval(&b, lisp_read_one_from_string(&b, "x"), env_b);
+    LISP_TEST_ASSERT(test, !strcmp(lisp_repr(&a, x_a), "(a . b)"));
+    LISP_TEST_ASSERT(test, x_b == make_fixnum(3));
+    LISP_TEST_ASSERT(test, !lisp_env_can_set(&a, env_a, lisp_intern(&a.symbol, "y")));
+
+    Expr const fun = lisp_eval(&b, lisp_read_one_from_string(&b, "(lambda (u v) (- u v))"), env_b);
+    Expr const args = lisp_list_2(&b.cons, make_fixnum(5), make_fixnum(7));
+    LISP_TEST_ASSERT(test, lisp_apply(&b, fun, args) == make_fixnum(-2));
+    Expr const car_fun = lisp_eval(&a, lisp_intern(&a.symbol, "car"), env_a);
+    LISP_TEST_ASSERT(test, lisp_apply(&a, car_fun, lisp_list_1(&a.cons, x_a)) == lisp_intern(&a.symbol, "a"));
+
+    lisp_gc_collect(&a);
+    LISP_TEST_ASSERT(test, !strcmp(lisp_repr(&a, lisp_env_get(&a, env_a, lisp_intern(&a.symbol, "x"))), "(a . b)"));
+    LISP_TEST_ASSERT(test, global.cons.num == num_conses);
+
+    lisp_gc_pop_roots(&b.gc, 1);
+    lisp_gc_pop_roots(&a.gc, 1);
+    system_quit(&b);
+    system_quit(&a);
+}
+
+static void unit_test_pipeline(TestState * test)
+{
+    LISP_TEST_GROUP(test, "pipeline");
+
+    char const * paths[] = { "pipeline.tmp.1.lisp", "pipeline.tmp.2.lisp" };
+    FILE * file = fopen(paths[0], "wb");
+    /* enough forms to span several batches */
+    for (int i = 0; i < 10000; i++)
+    {
+        fprintf(file, "(def x %d)\n", i);
+    }
+    fputs("(def x 1)\n(def s \"str\")\n(def f (lambda (y) (cons x y)))\n", file);
+    fclose(file);
+    file = fopen(paths[1], "wb");
+    fputs("(def x 2)\n(def t2 \"str\")\n(def r (f '(a . \"b\")))\n", file);
+    fclose(file);
+
+    Expr env = make_core_env();
+    gc_push_root(&env);
+    load_files_pipelined(paths, 2, env);
+    remove(paths[0]);
+    remove(paths[1]);
+
+    /* in order, and string literals are shared as when read directly */
+    LISP_TEST_ASSERT(test, !strcmp(repr(env_get(env, intern("r"))), "(2 a . \"b\")"));
+    LISP_TEST_ASSERT(test, env_get(env, intern("s")) == env_get(env, intern("t2")));
+    gc_pop_roots(1);
+}
+
+typedef struct
+{
+    Expr in;
+    U64 count;
+    bool same;
+} ParallelCheck;
+
+/* each form must match the next one read sequentially */
+static void parallel_check(SystemState * sys, Expr exp, void * data)
+{
+    ParallelCheck * check = (ParallelCheck *) data;
+    Expr other = nil;
+    check->same = check->same && maybe_parse_expr(check->in, &other) && !strcmp(repr(exp), repr(other));
+    ++check->count;
+}
+
+static void unit_test_parallel(TestState * test)
+{
+    LISP_TEST_GROUP(test, "parallel");
+
+    /* parens in strings and comments must not end a chunk */
+    char const * form = "(a \")\" (b . \"\\\")(\")) ; ) (\n'(c 12 nil) \"s\"\n";
+    Expr out = make_string_output_stream();
+    for (int i = 0; i < 500; i++)
+    {
+        stream_put_string(out, form);
     }
+    size_t len = 0;
+    char const * src = stream_output(out, &len);
+
+    size_t ends[LISP_PARALLEL_MAX_CHUNKS];
+    U64 const num = lisp_parallel_split(src, len, 4, ends);
+    LISP_TEST_ASSERT(test, num == 4 && ends[num - 1] == len);
+    LISP_TEST_ASSERT(test, src[ends[0] - 1] == ')' && src[ends[1] - 1] == ')');
+    LISP_TEST_ASSERT(test, lisp_parallel_split(src, len, 1, ends) == 1);
+
+    Expr forms = lisp_read_all_parallel(&global, src, len, 4);
+    gc_push_root(&forms);
+    Expr const in = make_string_input_stream(src);
+    Expr exp = nil;
+    bool same = true;
+    U64 count = 0;
+    for (Expr tmp = forms; tmp; tmp = cdr(tmp), count++)
+    {
+        same = same && maybe_parse_expr(in, &exp) && !strcmp(repr(car(tmp)), repr(exp));
+    }
+    stream_release(in);
+    LISP_TEST_ASSERT(test, same && count == 500 * 3);
+    LISP_TEST_ASSERT(test, caar(cdr(cdr(cdr(forms)))) == intern("a"));
+
+    /* or handed over one at a time */
+    ParallelCheck check = { make_string_input_stream(src), 0, true };
+    LISP_TEST_ASSERT(test, lisp_load_parallel(&global, src, len, 4, parallel_check, &check) == 500 * 3);
+    LISP_TEST_ASSERT(test, check.same && check.count == 500 * 3);
+    stream_release(check.in);
+    stream_release(out);
+
+    /* the builtin reads a file */
+    char const * path = "parallel.tmp.lisp";
+    FILE * file = fopen(path, "wb");
+    fputs("(x 1) (y \"2\")\n", file);
+    fclose(file);
+    Expr env = make_core_env();
+    gc_push_root(&env);
+    Expr const all = eval(read_one_from_string("(read-all-parallel \"parallel.tmp.lisp\")"), env);
+    LISP_TEST_ASSERT(test, read_file(path) == 2);
+    load_file(path, nil);
+    remove(path);
+    LISP_TEST_ASSERT(test, !strcmp(repr(all), "((x 1) (y \"2\"))"));
+    gc_pop_roots(2);
+}
+
+static void unit_test_profile(TestState * test)
+{
+    LISP_TEST_GROUP(test, "profile");
+
+    Expr env = make_core_env();
+    gc_push_root(&env);
+    eval_src("(def fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))", env);
+    eval_src("(def cfib (compile (lambda (n) (if (< n 2) n (+ (cfib (- n 1)) (cfib (- n 2)))))))", env);
+    eval_src("(def count (lambda (n) (if (= n 0) 'done (count (- n 1)))))", env);
+
+    /* calls leave the shadow stack as they found it, tail calls too */
+    eval_src("(fib 10)", env);
+    eval_src("(cfib 10)", env);
+    eval_src("(count 1000)", env);
+    apply(env_get(env, intern("cfib")), list_1(make_fixnum(5)));
+    LISP_TEST_ASSERT(test, global.profile.depth == 0);
+
+    /* without the profiler there are no samples to wait for */
+    profile_start(LISP_PROFILE_HZ);
+#if LISP_PROFILE
+    for (int i = 0; i < 10000 && global.profile.num_samples < 20; i++)
+    {
+        eval_src("(fib 12)", env);
+        eval_src("(cfib 12)", env);
+    }
+#endif
+    profile_stop();
+    LISP_TEST_ASSERT(test, global.profile.depth == 0);
+
+#if LISP_PROFILE
+    LISP_TEST_ASSERT(test, global.profile.num_samples >= 20);
+
+    static char buffer[64 * 1024];
+    FILE * file = tmpfile();
+    profile_write_folded(env, file);
+    rewind(file);
+    size_t const len = fread(buffer, 1, sizeof(buffer) - 1, file);
+    buffer[len] = 0;
+    fclose(file);
+    LISP_TEST_ASSERT(test, !strncmp(buffer, "toplevel", 8) && buffer[len - 1] == '\n');
+    LISP_TEST_ASSERT(test, strstr(buffer, "toplevel;fib;fib") || strstr(buffer, "toplevel;cfib;cfib"));
+#endif
+    gc_pop_roots(1);
+}
+
+static void unit_test_gc(TestState * test)
+{
+    LISP_TEST_GROUP(test, "gc");
+
+    Expr const foo = intern("foo");
+    Expr const bar = intern("bar");
+    Expr keep = list_2(foo, bar);
+    Expr env = make_core_env();
+    gc_push_root(&keep);
+    gc_push_root(&env);
+
+    cons(nil, nil);
+    U64 const num = global.cons.num;
+    gc_collect();
+    LISP_TEST_ASSERT(test, global.cons.num_free > 0);
+    LISP_TEST_ASSERT(test, equal(keep, list_2(foo, bar)));
+
+    /* freed pairs are reused before the pool grows */
+    while (global.cons.num_free)
+    {
+        cons(nil, nil);
+    }
+    LISP_TEST_ASSERT(test, global.cons.num == num);
+
+    /* unreachable frames are reused, reachable ones keep their bindings */
+    make_env(env);
+    U64 const num_frames = global.env.num;
+    gc_collect();
+    LISP_TEST_ASSERT(test, global.env.num_free > 0);
+    make_env(env);
+    LISP_TEST_ASSERT(test, global.env.num == num_frames);
+    LISP_TEST_ASSERT(test, env_get(env, intern("t")) == LISP_SYM_T);
+
+    /* and so are unreachable closures */
+    make_closure(CLOSURE_FUNCTION, env, nil, nil);
+    U64 const num_closures = global.closure.num;
+    gc_collect();
+    LISP_TEST_ASSERT(test, global.closure.num_free > 0);
+    make_closure(CLOSURE_FUNCTION, env, nil, nil);
+    LISP_TEST_ASSERT(test, global.closure.num == num_closures);
+
+    gc_collect();
+    LISP_TEST_ASSERT(test, !strcmp("(foo . bar)", eval_src("(cons 'foo 'bar)", env)));
+    LISP_TEST_ASSERT(test, !strcmp("(foo bar)", eval_src("`(foo ,@'(bar))", env)));
+
+    gc_pop_roots(2);
 }
 
 static void unit_test(TestState * test)
 {
     unit_test_expr(test);
     unit_test_nil(test);
+    unit_test_fixnum(test);
     unit_test_symbol(test);
+    unit_test_string(test);
     unit_test_cons(test);
     unit_test_stream(test);
+    unit_test_stream_output(test);
+    unit_test_lex(test);
     unit_test_reader(test);
+    unit_test_parser(test);
     unit_test_printer(test);
+    unit_test_binary(test);
     unit_test_util(test);
     unit_test_env(test);
     unit_test_eval(test);
+    unit_test_closure(test);
+    unit_test_lexical(test);
+    unit_test_expand(test);
+    unit_test_vm(test);
+    unit_test_image(test);
+    unit_test_system(test);
+    unit_test_pipeline(test);
+    unit_test_parallel(test);
+    unit_test_profile(test);
+    unit_test_gc(test);
+}
+
+/* the env a command runs in, from an image if one was given */
+static Expr make_main_env(char const * image)
+{
+    return image ? image_load(image) : make_core_env();
+}
+
+/* each benchmark starts from a fresh system, since every collection
+   sweeps the whole pool that earlier benchmarks grew */
+static void bench_fresh()
+{
+    global_quit();
+    global_init();
 }
 
 int main(int argc, char ** argv)
 {
-    if (argc < 2)
+    int arg = 1;
+    char const * image = NULL;
+    if (argc > 2 && !strcmp("--image", argv[1]))
+    {
+        image = argv[2];
+        arg = 3;
+    }
+
+    if (argc <= arg)
     {
         fail("missing command\n");
     }
-    char const * cmd = argv[1];
+    char const * cmd = argv[arg++];
     if (!strcmp("unit", cmd))
     {
         global_init();
         TestState _test;
         TestState * test = &_test;
         LISP_TEST_BEGIN(test);
-        for (int i = 2; i < argc; i++)
+        for (int i = arg; i < argc; i++)
         {
             if (!strcmp("--exit-on-fail", argv[i]))
             {
@@ -262,26 +1115,185 @@ int main(int argc, char ** argv)
     else if (!strcmp("load", cmd))
     {
         global_init();
-        Expr env = make_core_env();
-        for (int i = 2; i < argc; i++)
+        Expr env = make_main_env(image);
+        gc_push_root(&env);
+        bool pipeline = false;
+        bool data = false;
+        char const ** paths = (char const **) LISP_MALLOC(sizeof(char const *) * (size_t) argc);
+        U64 num_paths = 0;
+        for (int i = arg; i < argc; i++)
+        {
+            if (!strcmp("--vm", argv[i]))
+            {
+                global.vm.enabled = true;
+            }
+            else if (!strcmp("--pipeline", argv[i]))
+            {
+                pipeline = true;
+            }
+            else if (!strcmp("--data", argv[i]))
+            {
+                data = true;
+            }
+            else
+            {
+                paths[num_paths++] = argv[i];
+            }
+        }
+        if (pipeline && !data)
+        {
+            load_files_pipelined(paths, num_paths, env);
+        }
+        else
+        {
+            for (U64 i = 0; i < num_paths; i++)
+            {
+                load_file(paths[i], data ? nil : env);
+            }
+        }
+        LISP_FREE(paths);
+        gc_pop_roots(1);
+        global_quit();
+    }
+    else if (!strcmp("dump-image", cmd))
+    {
+        /* loads the files into the env and saves it */
+        if (argc <= arg)
+        {
+            fail("missing image path\n");
+        }
+        global_init();
+        Expr env = make_main_env(image);
+        gc_push_root(&env);
+        for (int i = arg + 1; i < argc; i++)
         {
             load_file(argv[i], env);
         }
+        image_dump(env, argv[arg]);
+        gc_pop_roots(1);
+        global_quit();
+    }
+    else if (!strcmp("profile", cmd))
+    {
+        global_init();
+        Expr env = make_main_env(image);
+        gc_push_root(&env);
+        char const * out = "profile.folded";
+        char const ** paths = (char const **) LISP_MALLOC(sizeof(char const *) * (size_t) argc);
+        U64 num_paths = 0;
+        for (int i = arg; i < argc; i++)
+        {
+            if (!strcmp("--vm", argv[i]))
+            {
+                global.vm.enabled = true;
+            }
+            else if (!strcmp("--out", argv[i]))
+            {
+                if (++i == argc)
+                {
+                    fail("missing output path\n");
+                }
+                out = argv[i];
+            }
+            else
+            {
+                paths[num_paths++] = argv[i];
+            }
+        }
+
+        profile_start(LISP_PROFILE_HZ);
+        for (U64 i = 0; i < num_paths; i++)
+        {
+            load_file(paths[i], env);
+        }
+        profile_stop();
+
+        FILE * file = fopen(out, "wb");
+        if (!file)
+        {
+            LISP_FAIL("cannot open %s\n", out);
+        }
+        profile_write_folded(env, file);
+        fclose(file);
+        profile_write_top(env, LISP_PROFILE_TOP, stderr);
+
+        LISP_FREE(paths);
+        gc_pop_roots(1);
+        global_quit();
+    }
+    else if (!strcmp("bench", cmd))
+    {
+        global_init();
+        if (argc > arg)
+        {
+            bench_read_file(argv[arg], 5);
+            bench_load_file(argv[arg], 5);
+        }
+        else
+        {
+            /* hot paths at a few sizes each */
+            for (U64 live = 1000; live <= 1000 * 1000; live *= 1000)
+            {
+                bench_fresh();
+                bench_cons(live, 21);
+            }
+            for (U64 num = 100; num <= 100 * 1000; num *= 1000)
+            {
+                bench_fresh();
+                bench_make_symbol(num, 21);
+            }
+            for (U64 depth = 0; depth <= 64; depth = depth ? depth * 8 : 1)
+            {
+                bench_fresh();
+                bench_env_get(depth, 21);
+            }
+            for (U64 size = 1; size <= 10 * 1000; size *= 100)
+            {
+                bench_fresh();
+                bench_parse_expr(size, 21);
+                bench_render_expr(size, 21);
+            }
+            for (U64 num = 1; num <= 4; num *= 4)
+            {
+                bench_fresh();
+                bench_apply(num, 21);
+            }
+
+            /* workloads */
+            for (I64 n = 15; n <= 20; n += 5)
+            {
+                bench_fresh();
+                bench_fib(n, false, 11);
+                bench_fib(n, true, 11);
+            }
+
+            bench_fresh();
+            char const * path = "bench.tmp.lisp";
+            bench_generate_source(path, LISP_BENCH_FILE_SIZE);
+            bench_read_file(path, 3);
+            bench_load_file(path, 3);
+            remove(path);
+
+            bench_fresh();
+            bench_binary(1000 * 1000, 5);
+            bench_fresh();
+            bench_list_walk(16 * 1000 * 1000, 5);
+        }
         global_quit();
     }
     else if (!strcmp("repl", cmd))
     {
         global_init();
-        Expr env = make_core_env();
+        Expr env = make_main_env(image);
+        gc_push_root(&env);
 
         // TODO make a proper prompt input stream
         Expr in = global.stream.stdin;
     loop:
         {
             /* read */
-            // TODO use global.stream.stdout
-            fprintf(stdout, "> ");
-            fflush(stdout);
+            stream_put_string(global.stream.stdout, "> ");
+            stream_flush(global.stream.stdout);
 
             Expr exp = nil;
             if (!maybe_parse_expr(in, &exp))
@@ -298,6 +1310,7 @@ int main(int argc, char ** argv)
             goto loop;
         }
     done:
+        gc_pop_roots(1);
         global_quit();
     }
     else
@@ -0,0 +1,286 @@
+
+/* for pthreads and sysconf */
+#define _POSIX_C_SOURCE 200809L
+
+#include "common.h"
+
+#if LISP_PARALLEL_READ
+#include <pthread.h>
+#include <setjmp.h>
+#include <unistd.h>
+#endif
+
+/* splitting */
+
+U64 lisp_parallel_chunks(size_t len)
+{
+    U64 num = 1;
+#if LISP_PARALLEL_READ
+    long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num = cpus > 1 ? (U64) cpus : 1;
+#endif
+    if (num > LISP_PARALLEL_MAX_CHUNKS)
+    {
+        num = LISP_PARALLEL_MAX_CHUNKS;
+    }
+    if (num > len / LISP_PARALLEL_MIN_CHUNK)
+    {
+        num = len / LISP_PARALLEL_MIN_CHUNK;
+    }
+    return num ? num : 1;
+}
+
+/* a chunk ends right after a ')' that closes a top-level list, at the
+   first one past an even share of the input. input the reader would
+   reject is left to it in one piece from the first unmatched ')'. */
+U64 lisp_parallel_split(char const * data, size_t len, U64 num, size_t * ends)
+{
+    LISP_ASSERT(num > 0);
+    U64 count = 0;
+    size_t target = len / num;
+    I64 depth = 0;
+    for (size_t i = 0; i < len && count + 1 < num; i++)
+    {
+        switch (data[i])
+        {
+        case 0:
+            /* the reader stops here */
+            i = len;
+            break;
+        case '(':
+            ++depth;
+            break;
+        case ')':
+            if (--depth < 0)
+            {
+                i = len;
+            }
+            else if (depth == 0 && i + 1 >= target && i + 1 < len)
+            {
+                ends[count++] = i + 1;
+                target = len / num * (count + 1);
+            }
+            break;
+        case '"':
+            for (++i; i < len && data[i] != '"' && data[i] != 0; i++)
+            {
+                if (data[i] == '\\')
+                {
+                    ++i;
+                }
+            }
+            break;
+        case ';':
+            while (i < len && data[i] != '\n' && data[i] != 0)
+            {
+                ++i;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    ends[count++] = len;
+    return count;
+}
+
+/* reading */
+
+/* hands the forms in data to fun in order, returns their number */
+static U64 _parallel_read(SystemState * sys, char const * data, size_t len, LoadFormFun fun, void * arg)
+{
+    Expr const in = lisp_make_buffer_input_stream(&sys->stream, len, data);
+    U64 num = 0;
+    Expr exp = nil;
+    while (lisp_maybe_parse_expr(sys, in, &exp))
+    {
+        fun(sys, exp, arg);
+        ++num;
+    }
+    lisp_stream_release(&sys->stream, in);
+    return num;
+}
+
+typedef struct
+{
+    Expr head;
+    Expr tail;
+} ParallelList;
+
+static void _parallel_collect(SystemState * sys, Expr exp, void * data)
+{
+    ParallelList * list = (ParallelList *) data;
+    Expr const next = lisp_cons(&sys->cons, exp, nil);
+    if (list->tail)
+    {
+        lisp_rplacd(&sys->cons, list->tail, next);
+    }
+    else
+    {
+        list->head = next;
+    }
+    list->tail = next;
+}
+
+#if LISP_PARALLEL_READ
+
+typedef struct
+{
+    char const * data;
+    size_t len;
+
+    SystemState sys;
+    ParallelList forms;
+    Expr * symbols;         /* symbol index to the copy, or nil */
+
+    bool failed;
+    char error[LISP_ERROR_MSG_SIZE];
+    jmp_buf fail;
+} ParallelChunk;
+
+static void _parallel_fail(void * data, char const * msg)
+{
+    ParallelChunk * chunk = (ParallelChunk *) data;
+    snprintf(chunk->error, sizeof(chunk->error), "%s", msg);
+    chunk->failed = true;
+    longjmp(chunk->fail, 1);
+}
+
+static void * _parallel_worker(void * data)
+{
+    ParallelChunk * chunk = (ParallelChunk *) data;
+    profile_block_thread();
+    system_init(&chunk->sys);
+    lisp_gc_push_root(&chunk->sys.gc, &chunk->forms.head);
+
+    error_set_handler(_parallel_fail, chunk);
+    if (!setjmp(chunk->fail))
+    {
+        _parallel_read(&chunk->sys, chunk->data, chunk->len, _parallel_collect, &chunk->forms);
+    }
+    error_set_handler(NULL, NULL);
+    return NULL;
+}
+
+static Expr _parallel_copy(SystemState * sys, ParallelChunk * chunk, Expr exp)
+{
+    SystemState * src = &chunk->sys;
+    switch (expr_type(exp))
+    {
+    case TYPE_SYMBOL:
+        {
+            U64 const index = expr_data(exp);
+            if (!chunk->symbols[index])
+            {
+                char const * name = lisp_symbol_name(&src->symbol, exp);
+                chunk->symbols[index] = lisp_make_symbol_n(&sys->symbol, name, lisp_symbol_length(&src->symbol, exp));
+            }
+            return chunk->symbols[index];
+        }
+    case TYPE_STRING:
+        return lisp_intern_string_n(&sys->string, lisp_string_value(&src->string, exp), lisp_string_length(&src->string, exp));
+    case TYPE_CONS:
+        {
+            /* along the list in a loop, so only nesting recurses */
+            Expr head = nil;
+            Expr tail = nil;
+            for (; is_cons(exp); exp = lisp_cdr(&src->cons, exp))
+            {
+                Expr const next = lisp_cons(&sys->cons, _parallel_copy(sys, chunk, lisp_car(&src->cons, exp)), nil);
+                if (tail)
+                {
+                    lisp_rplacd(&sys->cons, tail, next);
+                }
+                else
+                {
+                    head = next;
+                }
+                tail = next;
+            }
+            lisp_rplacd(&sys->cons, tail, _parallel_copy(sys, chunk, exp));
+            return head;
+        }
+    default:
+        /* nil and fixnums are the same in every system */
+        return exp;
+    }
+}
+
+U64 lisp_load_parallel(SystemState * sys, char const * data, size_t len, U64 num, LoadFormFun fun, void * arg)
+{
+    size_t ends[LISP_PARALLEL_MAX_CHUNKS];
+    num = lisp_parallel_split(data, len, num > LISP_PARALLEL_MAX_CHUNKS ? LISP_PARALLEL_MAX_CHUNKS : num, ends);
+    if (num == 1)
+    {
+        return _parallel_read(sys, data, len, fun, arg);
+    }
+
+    ParallelChunk * chunks = (ParallelChunk *) LISP_MALLOC(sizeof(ParallelChunk) * num);
+    if (!chunks)
+    {
+        LISP_FAIL("parallel read allocation failed\n");
+    }
+    memset(chunks, 0, sizeof(ParallelChunk) * num);
+
+    pthread_t threads[LISP_PARALLEL_MAX_CHUNKS];
+    for (U64 i = 1; i < num; i++)
+    {
+        chunks[i].data = data + ends[i - 1];
+        chunks[i].len = ends[i] - ends[i - 1];
+        if (pthread_create(threads + i, NULL, _parallel_worker, chunks + i))
+        {
+            LISP_FAIL("cannot start parallel read thread\n");
+        }
+    }
+
+    /* the first chunk is read here while the others are read ahead */
+    U64 count = _parallel_read(sys, data, ends[0], fun, arg);
+
+    for (U64 i = 1; i < num; i++)
+    {
+        ParallelChunk * chunk = chunks + i;
+        pthread_join(threads[i], NULL);
+        if (chunk->failed)
+        {
+            LISP_FAIL("%s", chunk->error);
+        }
+
+        chunk->symbols = (Expr *) LISP_MALLOC(sizeof(Expr) * chunk->sys.symbol.num);
+        if (!chunk->symbols)
+        {
+            LISP_FAIL("parallel read allocation failed\n");
+        }
+        memset(chunk->symbols, 0, sizeof(Expr) * chunk->sys.symbol.num);
+
+        /* one form at a time, so only the chunks keep the whole file */
+        for (Expr tmp = chunk->forms.head; tmp; tmp = lisp_cdr(&chunk->sys.cons, tmp))
+        {
+            fun(sys, _parallel_copy(sys, chunk, lisp_car(&chunk->sys.cons, tmp)), arg);
+            ++count;
+        }
+
+        LISP_FREE(chunk->symbols);
+        system_quit(&chunk->sys);
+    }
+
+    LISP_FREE(chunks);
+    return count;
+}
+
+#else
+
+U64 lisp_load_parallel(SystemState * sys, char const * data, size_t len, U64 num, LoadFormFun fun, void * arg)
+{
+    return _parallel_read(sys, data, len, fun, arg);
+}
+
+#endif
+
+Expr lisp_read_all_parallel(SystemState * sys, char const * data, size_t len, U64 num)
+{
+    ParallelList list = { nil, nil };
+    lisp_gc_push_root(&sys->gc, &list.head);
+    lisp_load_parallel(sys, data, len, num, _parallel_collect, &list);
+    lisp_gc_pop_roots(&sys->gc, 1);
+    return list.head;
+}
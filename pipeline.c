@@ -0,0 +1,199 @@
+
+/* for pthreads */
+#define _POSIX_C_SOURCE 200809L
+
+#include "common.h"
+
+#if LISP_PIPELINE
+
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+
+typedef struct
+{
+    char * data;            /* encoded forms, or NULL */
+    size_t len;
+    char const * error;     /* a failure after the forms, or NULL */
+    bool last;
+} PipelineBatch;
+
+typedef struct
+{
+    /* single producer, single consumer ring. each side only writes its
+       own index, and publishes the slots it is done with through it. */
+    atomic_size_t head;     /* next slot to fill */
+    atomic_size_t tail;     /* next slot to take */
+    PipelineBatch slots[LISP_PIPELINE_QUEUE_SIZE];
+
+    char const * const * paths;
+    U64 num_paths;
+
+    /* only touched by the producer */
+    SystemState sys;
+    Expr out;
+    bool failed;
+    char error[LISP_ERROR_MSG_SIZE];
+    jmp_buf fail;
+} Pipeline;
+
+static void _pipeline_push(Pipeline * p, PipelineBatch batch)
+{
+    size_t const head = atomic_load_explicit(&p->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&p->tail, memory_order_acquire) == LISP_PIPELINE_QUEUE_SIZE)
+    {
+        sched_yield();
+    }
+    p->slots[head % LISP_PIPELINE_QUEUE_SIZE] = batch;
+    atomic_store_explicit(&p->head, head + 1, memory_order_release);
+}
+
+static PipelineBatch _pipeline_take(Pipeline * p)
+{
+    size_t const tail = atomic_load_explicit(&p->tail, memory_order_relaxed);
+    while (atomic_load_explicit(&p->head, memory_order_acquire) == tail)
+    {
+        sched_yield();
+    }
+    PipelineBatch const batch = p->slots[tail % LISP_PIPELINE_QUEUE_SIZE];
+    atomic_store_explicit(&p->tail, tail + 1, memory_order_release);
+    return batch;
+}
+
+/* hands the forms encoded so far to the consumer */
+static void _pipeline_flush(Pipeline * p, bool last)
+{
+    StreamState * stream = &p->sys.stream;
+    PipelineBatch batch = { NULL, 0, p->failed ? p->error : NULL, last };
+    char const * data = lisp_stream_output(stream, p->out, &batch.len);
+    if (batch.len)
+    {
+        batch.data = (char *) LISP_MALLOC(batch.len);
+        if (!batch.data)
+        {
+            LISP_FAIL("pipeline batch allocation failed\n");
+        }
+        memcpy(batch.data, data, batch.len);
+        lisp_stream_clear_output(stream, p->out);
+    }
+    _pipeline_push(p, batch);
+}
+
+static void _pipeline_form(SystemState * sys, Expr exp, void * data)
+{
+    Pipeline * p = (Pipeline *) data;
+    lisp_write_binary(sys, exp, p->out);
+
+    size_t len = 0;
+    lisp_stream_output(&sys->stream, p->out, &len);
+    if (len >= LISP_PIPELINE_BATCH_SIZE)
+    {
+        _pipeline_flush(p, false);
+    }
+
+    /* the form is encoded, nothing is live between forms */
+    lisp_gc_maybe_collect(sys, &sys->cons);
+}
+
+static void _pipeline_fail(void * data, char const * msg)
+{
+    Pipeline * p = (Pipeline *) data;
+    snprintf(p->error, sizeof(p->error), "%s", msg);
+    p->failed = true;
+    longjmp(p->fail, 1);
+}
+
+static void * _pipeline_produce(void * data)
+{
+    Pipeline * p = (Pipeline *) data;
+    profile_block_thread();
+    system_init(&p->sys);
+    p->out = lisp_make_string_output_stream(&p->sys.stream);
+
+    error_set_handler(_pipeline_fail, p);
+    if (!setjmp(p->fail))
+    {
+        for (U64 i = 0; i < p->num_paths; i++)
+        {
+            lisp_load_forms(&p->sys, p->paths[i], _pipeline_form, p);
+        }
+    }
+    error_set_handler(NULL, NULL);
+
+    /* the forms before a failure are still evaluated */
+    _pipeline_flush(p, true);
+    system_quit(&p->sys);
+    return NULL;
+}
+
+void lisp_load_files_pipelined(SystemState * sys, char const * const * paths, U64 num, Expr env)
+{
+    LISP_ASSERT(env);
+    Pipeline * p = (Pipeline *) LISP_MALLOC(sizeof(Pipeline));
+    if (!p)
+    {
+        LISP_FAIL("pipeline allocation failed\n");
+    }
+    memset(p, 0, sizeof(Pipeline));
+    atomic_init(&p->head, 0);
+    atomic_init(&p->tail, 0);
+    p->paths = paths;
+    p->num_paths = num;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, _pipeline_produce, p))
+    {
+        LISP_FAIL("cannot start pipeline thread\n");
+    }
+
+    lisp_gc_push_root(&sys->gc, &env);
+    for (;;)
+    {
+        PipelineBatch const batch = _pipeline_take(p);
+        for (size_t pos = 0; pos < batch.len;)
+        {
+            size_t used = 0;
+            bool const intern_strings = sys->binary.intern_strings;
+            sys->binary.intern_strings = true;
+            Expr const exp = lisp_read_binary(sys, batch.data + pos, batch.len - pos, &used);
+            sys->binary.intern_strings = intern_strings;
+            pos += used;
+            lisp_eval(sys, exp, env);
+        }
+        LISP_FREE(batch.data);
+
+        if (batch.last)
+        {
+            pthread_join(thread, NULL);
+            if (batch.error)
+            {
+                LISP_FAIL("%s", batch.error);
+            }
+            break;
+        }
+    }
+    lisp_gc_pop_roots(&sys->gc, 1);
+    LISP_FREE(p);
+}
+
+#else
+
+void lisp_load_files_pipelined(SystemState * sys, char const * const * paths, U64 num, Expr env)
+{
+    for (U64 i = 0; i < num; i++)
+    {
+        lisp_load_file(sys, paths[i], env);
+    }
+}
+
+#endif
+
+#if LISP_GLOBAL_API
+
+void load_files_pipelined(char const * const * paths, U64 num, Expr env)
+{
+    lisp_load_files_pipelined(&global, paths, num, env);
+}
+
+#endif
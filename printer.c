@@ -1,86 +1,84 @@
 
 #include "common.h"
 
-static bool is_quote_call(Expr exp)
+static bool is_quote_call(ConsState * cons, Expr exp)
 {
-    return is_named_call(exp, intern("quote"));
+    return lisp_is_named_call(cons, exp, LISP_SYM_QUOTE);
 }
 
-void render_expr(Expr exp, Expr out);
-
-void render_cons(Expr exp, Expr out)
+static void render_cons(SystemState * sys, Expr exp, Expr out)
 {
 #if LISP_PRINTER_RENDER_QUOTE
-    if (is_quote_call(exp))
+    if (is_quote_call(&sys->cons, exp))
     {
-        stream_put_char(out, '\'');
-        render_expr(cadr(exp), out);
+        lisp_stream_put_char(&sys->stream, out, '\'');
+        lisp_render_expr(sys, lisp_cadr(&sys->cons, exp), out);
         return;
     }
 #endif
-    stream_put_char(out, '(');
-    render_expr(car(exp), out);
+    lisp_stream_put_char(&sys->stream, out, '(');
+    lisp_render_expr(sys, lisp_car(&sys->cons, exp), out);
 
-    for (Expr tmp = cdr(exp); tmp; tmp = cdr(tmp))
+    for (Expr tmp = lisp_cdr(&sys->cons, exp); tmp; tmp = lisp_cdr(&sys->cons, tmp))
     {
         if (tmp == exp)
         {
-            stream_put_string(out, " ...");
+            lisp_stream_put_string(&sys->stream, out, " ...");
             break;
         }
         else if (is_cons(tmp))
         {
-            stream_put_char(out, ' ');
-            render_expr(car(tmp), out);
+            lisp_stream_put_char(&sys->stream, out, ' ');
+            lisp_render_expr(sys, lisp_car(&sys->cons, tmp), out);
         }
         else
         {
-            stream_put_string(out, " . ");
-            render_expr(tmp, out);
+            lisp_stream_put_string(&sys->stream, out, " . ");
+            lisp_render_expr(sys, tmp, out);
             break;
         }
     }
 
-    stream_put_char(out, ')');
+    lisp_stream_put_char(&sys->stream, out, ')');
 }
 
-void render_special(Expr exp, Expr out)
+static void render_special(SystemState * sys, Expr exp, Expr out)
 {
-    stream_put_string(out, "#:<special operator");
-    char const * name = special_name(exp);
+    lisp_stream_put_string(&sys->stream, out, "#:<special operator");
+    char const * name = lisp_special_name(&sys->special, exp);
     if (name)
     {
-        stream_put_string(out, " ");
-        stream_put_string(out, name);
+        lisp_stream_put_string(&sys->stream, out, " ");
+        lisp_stream_put_string(&sys->stream, out, name);
     }
-    stream_put_string(out, ">");
+    lisp_stream_put_string(&sys->stream, out, ">");
 }
 
-void render_builtin(Expr exp, Expr out)
+static void render_builtin(SystemState * sys, Expr exp, Expr out)
 {
-    stream_put_string(out, "#:<core function");
-    char const * name = builtin_name(exp);
+    lisp_stream_put_string(&sys->stream, out, "#:<core function");
+    char const * name = lisp_builtin_name(&sys->builtin, exp);
     if (name)
     {
-        stream_put_string(out, " ");
-        stream_put_string(out, name);
+        lisp_stream_put_string(&sys->stream, out, " ");
+        lisp_stream_put_string(&sys->stream, out, name);
     }
-    stream_put_string(out, ">");
+    lisp_stream_put_string(&sys->stream, out, ">");
 }
 
-void render_gensym(Expr exp, Expr out)
+static void render_gensym(SystemState * sys, Expr exp, Expr out)
 {
     LISP_ASSERT_DEBUG(is_gensym(exp));
     U64 const num = expr_data(exp);
-    stream_put_string(out, "#:G");
-    stream_put_u64(out, num);
+    lisp_stream_put_string(&sys->stream, out, "#:G");
+    lisp_stream_put_u64(&sys->stream, out, num);
 }
 
-void render_string(Expr exp, Expr out)
+static void render_string(SystemState * sys, Expr exp, Expr out)
 {
-    stream_put_char(out, '"');
-    char const * str = string_value(exp);
-    size_t const len = string_length(exp);
+    lisp_stream_put_char(&sys->stream, out, '"');
+    char const * str = lisp_string_value(&sys->string, exp);
+    size_t const len = lisp_string_length(&sys->string, exp);
     for (size_t i = 0; i < len; ++i)
     {
         // TODO \u****
@@ -89,62 +87,88 @@ void render_string(Expr exp, Expr out)
         switch (ch)
         {
         case '"':
-            stream_put_char(out, '\\');
-            stream_put_char(out, '"');
+            lisp_stream_put_char(&sys->stream, out, '\\');
+            lisp_stream_put_char(&sys->stream, out, '"');
             break;
         case '\n':
-            stream_put_char(out, '\\');
-            stream_put_char(out, 'n');
+            lisp_stream_put_char(&sys->stream, out, '\\');
+            lisp_stream_put_char(&sys->stream, out, 'n');
             break;
         case '\t':
-            stream_put_char(out, '\\');
-            stream_put_char(out, 't');
+            lisp_stream_put_char(&sys->stream, out, '\\');
+            lisp_stream_put_char(&sys->stream, out, 't');
             break;
         default:
             if (ch == 0x1b) // TODO use a function to test what to escape
             {
-                stream_put_char(out, '\\');
-                stream_put_char(out, 'x');
-                stream_put_x64(out, ch);
+                lisp_stream_put_char(&sys->stream, out, '\\');
+                lisp_stream_put_char(&sys->stream, out, 'x');
+                lisp_stream_put_x64(&sys->stream, out, ch);
             }
             else
             {
-                stream_put_char(out, ch);
+                lisp_stream_put_char(&sys->stream, out, ch);
             }
             break;
         }
     }
-    stream_put_char(out, '"');
+    lisp_stream_put_char(&sys->stream, out, '"');
 }
 
-void render_expr(Expr exp, Expr out)
+void lisp_render_expr(SystemState * sys, Expr exp, Expr out)
 {
     switch (expr_type(exp))
     {
     case TYPE_NIL:
         LISP_ASSERT_DEBUG(expr_data(exp) == 0);
-        stream_put_string(out, "nil");
+        lisp_stream_put_string(&sys->stream, out, "nil");
         break;
     case TYPE_SYMBOL:
-        stream_put_string(out, symbol_name(exp));
+        lisp_stream_write(&sys->stream, out, lisp_symbol_name(&sys->symbol, exp), lisp_symbol_length(&sys->symbol, exp));
         break;
     case TYPE_CONS:
-        render_cons(exp, out);
+        render_cons(sys, exp, out);
         break;
     case TYPE_GENSYM:
-        render_gensym(exp, out);
+        render_gensym(sys, exp, out);
         break;
     case TYPE_STRING:
-        render_string(exp, out);
+        render_string(sys, exp, out);
         break;
     case TYPE_SPECIAL:
-        render_special(exp, out);
+        render_special(sys, exp, out);
         break;
     case TYPE_BUILTIN:
-        render_builtin(exp, out);
+        render_builtin(sys, exp, out);
+        break;
+    case TYPE_LOCAL:
+        /* resolved variable references print as their names */
+        lisp_render_expr(sys, local_name(exp), out);
+        break;
+    case TYPE_ENV:
+        lisp_stream_put_string(&sys->stream, out, "#:<environment ");
+        lisp_stream_put_u64(&sys->stream, out, expr_data(exp));
+        lisp_stream_put_string(&sys->stream, out, ">");
+        break;
+    case TYPE_CLOSURE:
+        lisp_stream_put_string(&sys->stream, out, lisp_is_macro(&sys->closure, exp) ? "#:<macro " : "#:<function ");
+        lisp_stream_put_u64(&sys->stream, out, expr_data(exp));
+        lisp_stream_put_string(&sys->stream, out, ">");
+        break;
+    case TYPE_FIXNUM:
+        lisp_stream_put_i64(&sys->stream, out, fixnum_value(exp));
         break;
     default:
         LISP_FAIL("cannot print expression %016" PRIx64 "\n", exp);
         break;
     }
 }
+
+#if LISP_GLOBAL_API
+
+void render_expr(Expr exp, Expr out)
+{
+    lisp_render_expr(&global, exp, out);
+}
+
+#endif
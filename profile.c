@@ -0,0 +1,438 @@
+
+/* for sigaction, setitimer and pthread_sigmask */
+#define _XOPEN_SOURCE 700
+
+#include "common.h"
+
+#if LISP_PROFILE
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+void profile_init(ProfileState * profile)
+{
+    memset(profile, 0, sizeof(ProfileState));
+}
+
+#if LISP_PROFILE
+
+static ProfileState * volatile _profile_active = NULL;
+
+static void _profile_disarm()
+{
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    _profile_active = NULL;
+}
+
+#endif
+
+void profile_quit(ProfileState * profile)
+{
+#if LISP_PROFILE
+    if (_profile_active == profile)
+    {
+        _profile_disarm();
+    }
+#endif
+    LISP_FREE(profile->funs);
+    LISP_FREE(profile->frames);
+    memset(profile, 0, sizeof(ProfileState));
+}
+
+static U64 _profile_hash(Expr fun)
+{
+    /* fibonacci hashing spreads consecutive indices */
+    return (fun * UINT64_C(0x9e3779b97f4a7c15)) >> 32;
+}
+
+/* the id of fun, or LISP_PROFILE_MAX_FUNS when it has none */
+static U64 _profile_find(ProfileState const * profile, Expr fun, bool insert)
+{
+    U64 const mask = LISP_PROFILE_MAX_FUNS - 1;
+    U64 slot = _profile_hash(fun) & mask;
+    for (U64 i = 0; i < LISP_PROFILE_MAX_FUNS; i++, slot = (slot + 1) & mask)
+    {
+        if (profile->funs[slot] == fun)
+        {
+            return slot;
+        }
+        if (profile->funs[slot] == nil)
+        {
+            if (insert)
+            {
+                profile->funs[slot] = fun;
+                return slot;
+            }
+            break;
+        }
+    }
+    return LISP_PROFILE_MAX_FUNS;
+}
+
+#if LISP_PROFILE
+
+static void _profile_sample(int sig)
+{
+    ProfileState * profile = _profile_active;
+    if (!profile)
+    {
+        return;
+    }
+
+    U64 depth = (U64) profile->depth;
+    if (depth > LISP_PROFILE_MAX_DEPTH)
+    {
+        depth = LISP_PROFILE_MAX_DEPTH;
+    }
+    if (profile->num_frames + depth + 1 > LISP_PROFILE_MAX_FRAMES)
+    {
+        ++profile->num_dropped;
+        return;
+    }
+
+    U32 * sample = profile->frames + profile->num_frames;
+    sample[0] = (U32) depth;
+    for (U64 i = 0; i < depth; i++)
+    {
+        U64 const id = _profile_find(profile, profile->stack[i], true);
+        if (id == LISP_PROFILE_MAX_FUNS)
+        {
+            ++profile->num_dropped;
+            return;
+        }
+        sample[i + 1] = (U32) id;
+    }
+    profile->num_frames += depth + 1;
+    ++profile->num_samples;
+}
+
+#endif
+
+void lisp_profile_start(SystemState * sys, U64 hz)
+{
+    ProfileState * profile = &sys->profile;
+    LISP_ASSERT(hz > 0);
+#if LISP_PROFILE
+    if (_profile_active)
+    {
+        LISP_FAIL("a system is being profiled already\n");
+    }
+#endif
+
+    LISP_FREE(profile->funs);
+    LISP_FREE(profile->frames);
+    profile->funs = (Expr *) LISP_MALLOC(sizeof(Expr) * LISP_PROFILE_MAX_FUNS);
+    profile->frames = (U32 *) LISP_MALLOC(sizeof(U32) * LISP_PROFILE_MAX_FRAMES);
+    if (!profile->funs || !profile->frames)
+    {
+        LISP_FAIL("profile allocation failed\n");
+    }
+    memset(profile->funs, 0, sizeof(Expr) * LISP_PROFILE_MAX_FUNS);
+    profile->num_frames = 0;
+    profile->num_samples = 0;
+    profile->num_dropped = 0;
+    profile->hz = hz;
+
+#if LISP_PROFILE
+    _profile_active = profile;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = _profile_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL))
+    {
+        _profile_active = NULL;
+        LISP_FAIL("cannot handle SIGPROF\n");
+    }
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz >= 1000000 ? 1 : (suseconds_t) (1000000 / hz);
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL))
+    {
+        _profile_disarm();
+        LISP_FAIL("cannot start the profile timer\n");
+    }
+#endif
+}
+
+void lisp_profile_stop(SystemState * sys)
+{
+#if LISP_PROFILE
+    if (_profile_active == &sys->profile)
+    {
+        _profile_disarm();
+    }
+#endif
+}
+
+void profile_block_thread()
+{
+#if LISP_PROFILE
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+#endif
+}
+
+/* reports */
+
+static char * _profile_copy_name(char const * fmt, char const * name)
+{
+    size_t const size = strlen(fmt) + strlen(name) + 1;
+    char * copy = (char *) LISP_MALLOC(size);
+    if (!copy)
+    {
+        LISP_FAIL("profile allocation failed\n");
+    }
+    snprintf(copy, size, fmt, name);
+    return copy;
+}
+
+/* a name per id, to be freed with _profile_free_names */
+static char ** _profile_names(SystemState * sys, Expr env)
+{
+    ProfileState const * profile = &sys->profile;
+    char ** names = (char **) LISP_MALLOC(sizeof(char *) * LISP_PROFILE_MAX_FUNS);
+    if (!names)
+    {
+        LISP_FAIL("profile allocation failed\n");
+    }
+    memset(names, 0, sizeof(char *) * LISP_PROFILE_MAX_FUNS);
+
+    /* the innermost binding names a function */
+    for (Expr tmp = env; tmp; tmp = lisp_env_frame(&sys->env, tmp)->outer)
+    {
+        EnvFrame const * frame = lisp_env_frame(&sys->env, tmp);
+        for (U64 k = 0; k < 2; k++)
+        {
+            EnvBinding const * bindings = k ? frame->cells : frame->bindings;
+            U64 const num = k ? frame->num_cells : frame->num;
+            for (U64 i = 0; i < num; i++)
+            {
+                Expr const val = bindings[i].val;
+                if (!is_symbol(bindings[i].var) || !(is_builtin(val) || is_closure(val)))
+                {
+                    continue;
+                }
+                U64 const id = _profile_find(profile, val, false);
+                if (id < LISP_PROFILE_MAX_FUNS && !names[id])
+                {
+                    names[id] = _profile_copy_name("%s", lisp_symbol_name(&sys->symbol, bindings[i].var));
+                }
+            }
+        }
+    }
+
+    for (U64 id = 0; id < LISP_PROFILE_MAX_FUNS; id++)
+    {
+        Expr const fun = profile->funs[id];
+        if (!fun || names[id])
+        {
+            continue;
+        }
+
+        if (is_builtin(fun))
+        {
+            names[id] = _profile_copy_name("%s", lisp_builtin_name(&sys->builtin, fun));
+        }
+        else
+        {
+            names[id] = _profile_copy_name("(lambda %s)", lisp_repr(sys, lisp_closure(&sys->closure, fun)->params));
+        }
+    }
+    return names;
+}
+
+static void _profile_free_names(char ** names)
+{
+    for (U64 id = 0; id < LISP_PROFILE_MAX_FUNS; id++)
+    {
+        LISP_FREE(names[id]);
+    }
+    LISP_FREE(names);
+}
+
+/* the offset of each sample in the frames */
+static U64 * _profile_samples(ProfileState const * profile)
+{
+    U64 * samples = (U64 *) LISP_MALLOC(sizeof(U64) * (profile->num_samples + 1));
+    if (!samples)
+    {
+        LISP_FAIL("profile allocation failed\n");
+    }
+    U64 offset = 0;
+    for (U64 i = 0; i < profile->num_samples; i++)
+    {
+        samples[i] = offset;
+        offset += profile->frames[offset] + 1;
+    }
+    return samples;
+}
+
+static U32 const * _profile_sort_frames = NULL;
+
+static int _profile_compare_stacks(void const * a, void const * b)
+{
+    U32 const * x = _profile_sort_frames + *(U64 const *) a;
+    U32 const * y = _profile_sort_frames + *(U64 const *) b;
+    U32 const num = x[0] < y[0] ? x[0] : y[0];
+    int const cmp = memcmp(x + 1, y + 1, sizeof(U32) * num);
+    if (cmp)
+    {
+        return cmp;
+    }
+    return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+/* one line per distinct stack, outermost first, with its sample count */
+void lisp_profile_write_folded(SystemState * sys, Expr env, FILE * file)
+{
+    ProfileState const * profile = &sys->profile;
+    if (!profile->num_samples)
+    {
+        return;
+    }
+
+    char ** names = _profile_names(sys, env);
+    U64 * samples = _profile_samples(profile);
+    _profile_sort_frames = profile->frames;
+    qsort(samples, profile->num_samples, sizeof(U64), _profile_compare_stacks);
+
+    for (U64 i = 0, count = 1; i < profile->num_samples; i++, count++)
+    {
+        if (i + 1 < profile->num_samples && !_profile_compare_stacks(samples + i, samples + i + 1))
+        {
+            continue;
+        }
+        U32 const * sample = profile->frames + samples[i];
+        fputs("toplevel", file);
+        for (U32 k = 0; k < sample[0]; k++)
+        {
+            fprintf(file, ";%s", names[sample[k + 1]]);
+        }
+        fprintf(file, " %" PRIu64 "\n", count);
+        count = 0;
+    }
+
+    LISP_FREE(samples);
+    _profile_free_names(names);
+}
+
+static U64 const * _profile_sort_counts = NULL;
+
+static int _profile_compare_counts(void const * a, void const * b)
+{
+    /* by self, then by total, descending */
+    U64 const x = *(U64 const *) a;
+    U64 const y = *(U64 const *) b;
+    U64 const * self = _profile_sort_counts;
+    U64 const * total = _profile_sort_counts + LISP_PROFILE_MAX_FUNS;
+    if (self[x] != self[y])
+    {
+        return self[x] < self[y] ? 1 : -1;
+    }
+    return (total[x] < total[y]) - (total[x] > total[y]);
+}
+
+/* the num functions with the most samples of their own */
+void lisp_profile_write_top(SystemState * sys, Expr env, U64 num, FILE * file)
+{
+    ProfileState const * profile = &sys->profile;
+    fprintf(file, "%" PRIu64 " samples at %" PRIu64 " Hz, %" PRIu64 " dropped\n",
+            profile->num_samples, profile->hz, profile->num_dropped);
+    if (!profile->num_samples)
+    {
+        return;
+    }
+
+    /* self, total and the last sample counted in total, by id */
+    U64 * counts = (U64 *) LISP_MALLOC(sizeof(U64) * LISP_PROFILE_MAX_FUNS * 3);
+    U64 * ids = (U64 *) LISP_MALLOC(sizeof(U64) * LISP_PROFILE_MAX_FUNS);
+    if (!counts || !ids)
+    {
+        LISP_FAIL("profile allocation failed\n");
+    }
+    memset(counts, 0, sizeof(U64) * LISP_PROFILE_MAX_FUNS * 3);
+    U64 * self = counts;
+    U64 * total = counts + LISP_PROFILE_MAX_FUNS;
+    U64 * seen = counts + LISP_PROFILE_MAX_FUNS * 2;
+
+    U64 offset = 0;
+    for (U64 i = 0; i < profile->num_samples; i++)
+    {
+        U32 const * sample = profile->frames + offset;
+        offset += sample[0] + 1;
+        if (!sample[0])
+        {
+            continue;
+        }
+        ++self[sample[sample[0]]];
+        for (U32 k = 0; k < sample[0]; k++)
+        {
+            /* once per sample, however deep the recursion */
+            U32 const id = sample[k + 1];
+            if (seen[id] != i + 1)
+            {
+                seen[id] = i + 1;
+                ++total[id];
+            }
+        }
+    }
+
+    U64 num_ids = 0;
+    for (U64 id = 0; id < LISP_PROFILE_MAX_FUNS; id++)
+    {
+        if (total[id])
+        {
+            ids[num_ids++] = id;
+        }
+    }
+    _profile_sort_counts = counts;
+    qsort(ids, num_ids, sizeof(U64), _profile_compare_counts);
+
+    char ** names = _profile_names(sys, env);
+    F64 const scale = 100.0 / (F64) profile->num_samples;
+    fprintf(file, "%8s %7s %8s %7s  %s\n", "self", "self%", "total", "total%", "function");
+    for (U64 i = 0; i < num_ids && i < num; i++)
+    {
+        U64 const id = ids[i];
+        fprintf(file, "%8" PRIu64 " %6.2f%% %8" PRIu64 " %6.2f%%  %s\n",
+                self[id], (F64) self[id] * scale, total[id], (F64) total[id] * scale, names[id]);
+    }
+
+    _profile_free_names(names);
+    LISP_FREE(ids);
+    LISP_FREE(counts);
+}
+
+#if LISP_GLOBAL_API
+
+void profile_start(U64 hz)
+{
+    lisp_profile_start(&global, hz);
+}
+
+void profile_stop()
+{
+    lisp_profile_stop(&global);
+}
+
+void profile_write_folded(Expr env, FILE * file)
+{
+    lisp_profile_write_folded(&global, env, file);
+}
+
+void profile_write_top(Expr env, U64 num, FILE * file)
+{
+    lisp_profile_write_top(&global, env, num, file);
+}
+
+#endif
@@ -24,34 +24,86 @@ static bool is_symbol_part(char ch)
     return is_symbol_start(ch);
 }
 
-static void skip_whitespace_or_comment(Expr in)
+static bool is_digit(char ch)
 {
+    return ch >= '0' && ch <= '9';
+}
+
+static bool parse_fixnum(char const * str, size_t len, Expr * exp)
+{
+    size_t i = 0;
+    bool neg = false;
+    if (len > 1 && (str[0] == '-' || str[0] == '+'))
+    {
+        neg = str[0] == '-';
+        i = 1;
+    }
+
+    I64 val = 0;
+    for (; i < len; i++)
+    {
+        if (!is_digit(str[i]))
+        {
+            return false;
+        }
+        val = val * 10 + (str[i] - '0');
+        if (val > LISP_FIXNUM_MAX + (I64) neg)
+        {
+            LISP_FAIL("integer out of range: %.*s\n", (int) len, str);
+        }
+    }
+
+    *exp = make_fixnum(neg ? -val : val);
+    return true;
+}
+
+/* a symbol or a number */
+static Expr parse_atom(SystemState * sys, char const * str, size_t len)
+{
+    Expr exp = nil;
+    if (parse_fixnum(str, len, &exp))
+    {
+        return exp;
+    }
+    return lisp_intern_n(&sys->symbol, str, len);
+}
+
+static void skip_whitespace_or_comment(SystemState * sys, Expr in)
+{
+    char const * span;
+    size_t avail;
+    if (lisp_stream_peek_span(&sys->stream, in, &span, &avail))
+    {
+        lisp_stream_skip_span(&sys->stream, in, lisp_lex_skip_blank(&sys->lex, span, avail));
+        return;
+    }
+
 whitespace:
-    while (is_whitespace(stream_peek_char(in)))
+    while (is_whitespace(lisp_stream_peek_char(&sys->stream, in)))
     {
-        stream_skip_char(in);
+        lisp_stream_skip_char(&sys->stream, in);
     }
 
-    if (stream_peek_char(in) != ';')
+    if (lisp_stream_peek_char(&sys->stream, in) != ';')
     {
         return;
     }
 
-    stream_skip_char(in);
+    lisp_stream_skip_char(&sys->stream, in);
 
 comment:
-    if (stream_peek_char(in) == 0)
+    if (lisp_stream_peek_char(&sys->stream, in) == 0)
     {
         return;
     }
 
-    if (stream_peek_char(in) == '\n')
+    if (lisp_stream_peek_char(&sys->stream, in) == '\n')
     {
-        stream_skip_char(in);
+        lisp_stream_skip_char(&sys->stream, in);
         goto whitespace;
     }
 
-    stream_skip_char(in);
+    lisp_stream_skip_char(&sys->stream, in);
     goto comment;
 }
 
@@ -63,24 +115,24 @@ static Expr parse_list(SystemState * sys, Expr in)
     Expr head = nil;
     Expr tail = nil;
 
-    if (stream_peek_char(in) != '(')
+    if (lisp_stream_peek_char(&sys->stream, in) != '(')
     {
-        LISP_FAIL("expected '(', got '%c'\n", stream_peek_char(in));
+        LISP_FAIL("expected '(', got '%c'\n", lisp_stream_peek_char(&sys->stream, in));
         return nil;
     }
 
-    stream_skip_char(in);
+    lisp_stream_skip_char(&sys->stream, in);
 
 list_loop:
-    skip_whitespace_or_comment(in);
+    skip_whitespace_or_comment(sys, in);
 
-    if (stream_peek_char(in) == 0)
+    if (lisp_stream_peek_char(&sys->stream, in) == 0)
     {
         LISP_FAIL("unexpected eof\n");
         return nil;
     }
 
-    if (stream_peek_char(in) == ')')
+    if (lisp_stream_peek_char(&sys->stream, in) == ')')
     {
         goto list_done;
     }
@@ -88,12 +140,12 @@ list_loop:
     exp = parse_expr(sys, in);
 
     // TODO get rid of artifical symbol dependence for dotted lists
-    if (exp == intern("."))
+    if (exp == LISP_SYM_DOT)
     {
         exp = parse_expr(sys, in);
         lisp_rplacd(&sys->cons, tail, exp);
 
-        skip_whitespace_or_comment(in);
+        skip_whitespace_or_comment(sys, in);
 
         goto list_done;
     }
@@ -115,19 +167,19 @@ list_loop:
 
 list_done:
     // TODO use expect_char(in, ')')
-    if (stream_peek_char(in) != ')')
+    if (lisp_stream_peek_char(&sys->stream, in) != ')')
     {
         LISP_FAIL("missing ')'\n");
         return nil;
     }
-    stream_skip_char(in);
+    lisp_stream_skip_char(&sys->stream, in);
 
     return head;
 }
 
-static char parse_hex_digit(Expr in, char val)
+static char parse_hex_digit(SystemState * sys, Expr in, char val)
 {
-    char const ch = stream_get_char(in);
+    char const ch = lisp_stream_get_char(&sys->stream, in);
 
     if (ch >= '0' && ch <= '9')
     {
@@ -163,18 +215,30 @@ static Expr parse_string(SystemState * sys, Expr in)
         STATE_ESCAPE,
     } state = STATE_DEFAULT;
 
-    if (stream_peek_char(in) != '"')
+    if (lisp_stream_peek_char(&sys->stream, in) != '"')
     {
         LISP_FAIL("missing '\"'\n");
         return nil;
     }
-    stream_skip_char(in);
+    lisp_stream_skip_char(&sys->stream, in);
+
+    char const * span;
+    size_t avail;
+    if (lisp_stream_peek_span(&sys->stream, in, &span, &avail))
+    {
+        /* strings without escapes are sliced from the input */
+        size_t const len = lisp_lex_find_string_special(&sys->lex, span, avail);
+        if (len < avail && span[len] == '"')
+        {
+            lisp_stream_skip_span(&sys->stream, in, len + 1);
+            return lisp_intern_string_n(&sys->string, span, len);
+        }
+    }
 
-    char lexeme[4096];
-    Expr tok = lisp_make_buffer_output_stream(&sys->stream, 4096, lexeme);
+    Expr tok = lisp_make_string_output_stream(&sys->stream);
 
 string_loop:
-    if (stream_peek_char(in) == 0)
+    if (lisp_stream_peek_char(&sys->stream, in) == 0)
     {
         LISP_FAIL("unexpected eof in string\n");
         return nil;
@@ -182,52 +246,59 @@ string_loop:
 
     else if (state == STATE_DEFAULT)
     {
-        if (stream_peek_char(in) == '"')
+        if (lisp_stream_peek_char(&sys->stream, in) == '"')
         {
-            stream_skip_char(in);
+            lisp_stream_skip_char(&sys->stream, in);
             goto string_done;
         }
-        else if (stream_peek_char(in) == '\\')
+        else if (lisp_stream_peek_char(&sys->stream, in) == '\\')
         {
-            stream_skip_char(in);
+            lisp_stream_skip_char(&sys->stream, in);
             state = STATE_ESCAPE;
         }
+        else if (lisp_stream_peek_span(&sys->stream, in, &span, &avail))
+        {
+            /* copy the run up to the next escape at once */
+            size_t const len = lisp_lex_find_string_special(&sys->lex, span, avail);
+            lisp_stream_write(&sys->stream, tok, span, len);
+            lisp_stream_skip_span(&sys->stream, in, len);
+        }
         else
         {
-            stream_put_char(tok, stream_get_char(in));
+            lisp_stream_put_char(&sys->stream, tok, lisp_stream_get_char(&sys->stream, in));
         }
     }
 
     else if (state == STATE_ESCAPE)
     {
-        if (stream_peek_char(in) == 'n')
+        if (lisp_stream_peek_char(&sys->stream, in) == 'n')
         {
-            stream_skip_char(in);
-            stream_put_char(tok, '\n');
+            lisp_stream_skip_char(&sys->stream, in);
+            lisp_stream_put_char(&sys->stream, tok, '\n');
         }
 
-        else if (stream_peek_char(in) == 't')
+        else if (lisp_stream_peek_char(&sys->stream, in) == 't')
         {
-            stream_skip_char(in);
-            stream_put_char(tok, '\t');
+            lisp_stream_skip_char(&sys->stream, in);
+            lisp_stream_put_char(&sys->stream, tok, '\t');
         }
 
-        else if (stream_peek_char(in) == 'x')
+        else if (lisp_stream_peek_char(&sys->stream, in) == 'x')
         {
-            stream_skip_char(in);
+            lisp_stream_skip_char(&sys->stream, in);
 
             char val = 0;
-            val = parse_hex_digit(in, val);
-            val = parse_hex_digit(in, val);
+            val = parse_hex_digit(sys, in, val);
+            val = parse_hex_digit(sys, in, val);
 
             /* TODO check for more digits? */
 
-            stream_put_char(tok, val);
+            lisp_stream_put_char(&sys->stream, tok, val);
         }
 
         else
         {
-            stream_put_char(tok, stream_get_char(in));
+            lisp_stream_put_char(&sys->stream, tok, lisp_stream_get_char(&sys->stream, in));
         }
 
         state = STATE_DEFAULT;
@@ -242,58 +313,74 @@ string_loop:
     goto string_loop;
 
 string_done:
-    stream_put_char(tok, 0);
-    Expr const ret = make_string(lexeme);
-    stream_release(tok);
-    return ret;
+    {
+        size_t len = 0;
+        char const * str = lisp_stream_output(&sys->stream, tok, &len);
+        Expr const ret = lisp_intern_string_n(&sys->string, str, len);
+        lisp_stream_release(&sys->stream, tok);
+        return ret;
+    }
 }
 
 static Expr parse_expr(SystemState * sys, Expr in)
 {
-    skip_whitespace_or_comment(in);
+    skip_whitespace_or_comment(sys, in);
 
-    if (stream_peek_char(in) == '(')
+    if (lisp_stream_peek_char(&sys->stream, in) == '(')
     {
         return parse_list(sys, in);
     }
-    else if (stream_peek_char(in) == '"')
+    else if (lisp_stream_peek_char(&sys->stream, in) == '"')
     {
         return parse_string(sys, in);
     }
 #if LISP_READER_PARSE_QUOTE
-    else if (stream_peek_char(in) == '\'')
+    else if (lisp_stream_peek_char(&sys->stream, in) == '\'')
     {
-        stream_skip_char(in);
-        Expr const exp = list_2(intern("quote"), parse_expr(sys, in));
+        lisp_stream_skip_char(&sys->stream, in);
+        Expr const exp = lisp_list_2(&sys->cons, LISP_SYM_QUOTE, parse_expr(sys, in));
         return exp;
     }
-    else if (stream_peek_char(in) == '`')
+    else if (lisp_stream_peek_char(&sys->stream, in) == '`')
     {
-        stream_skip_char(in);
-        Expr const exp = list_2(intern("backquote"), parse_expr(sys, in));
+        lisp_stream_skip_char(&sys->stream, in);
+        Expr const exp = lisp_list_2(&sys->cons, LISP_SYM_BACKQUOTE, parse_expr(sys, in));
         return exp;
     }
-    else if (stream_peek_char(in) == ',')
+    else if (lisp_stream_peek_char(&sys->stream, in) == ',')
     {
-        stream_skip_char(in);
-        if (stream_peek_char(in) == '@')
+        lisp_stream_skip_char(&sys->stream, in);
+        if (lisp_stream_peek_char(&sys->stream, in) == '@')
         {
-            stream_skip_char(in);
-            return list_2(intern("unquote-splicing"), parse_expr(sys, in));
+            lisp_stream_skip_char(&sys->stream, in);
+            return lisp_list_2(&sys->cons, LISP_SYM_UNQUOTE_SPLICING, parse_expr(sys, in));
         }
-        return list_2(intern("unquote"), parse_expr(sys, in));
+        return lisp_list_2(&sys->cons, LISP_SYM_UNQUOTE, parse_expr(sys, in));
     }
 #endif
-    else if (is_symbol_start(stream_peek_char(in)))
+    else if (is_symbol_start(lisp_stream_peek_char(&sys->stream, in)))
     {
+        char const * span;
+        size_t avail;
+        if (lisp_stream_peek_span(&sys->stream, in, &span, &avail))
+        {
+            size_t const len = 1 + lisp_lex_find_delimiter(&sys->lex, span + 1, avail - 1);
+            lisp_stream_skip_span(&sys->stream, in, len);
+            return parse_atom(sys, span, len);
+        }
+
         char lexeme[4096];
-        Expr tok = lisp_make_buffer_output_stream(&sys->stream, 4096, lexeme);
-        stream_put_char(tok, stream_get_char(in));
+        size_t len = 0;
+        lexeme[len++] = lisp_stream_get_char(&sys->stream, in);
 
     symbol_loop:
-        if (is_symbol_part(stream_peek_char(in)))
+        if (is_symbol_part(lisp_stream_peek_char(&sys->stream, in)))
         {
-            stream_put_char(tok, stream_get_char(in));
+            if (len == sizeof(lexeme))
+            {
+                LISP_FAIL("symbol too long\n");
+            }
+            lexeme[len++] = lisp_stream_get_char(&sys->stream, in);
             goto symbol_loop;
         }
         else
@@ -302,21 +389,18 @@ static Expr parse_expr(SystemState * sys, Expr in)
         }
 
     symbol_done:
-        stream_put_char(tok, 0);
-        Expr const ret = intern(lexeme);
-        stream_release(tok);
-        return ret;
+        return parse_atom(sys, lexeme, len);
     }
     else
     {
-        LISP_FAIL("cannot read expression, unexpected '%c'\n", stream_peek_char(in));
+        LISP_FAIL("cannot read expression, unexpected '%c'\n", lisp_stream_peek_char(&sys->stream, in));
         return nil;
     }
 }
 
 bool lisp_maybe_parse_expr(SystemState * sys, Expr in, Expr * exp)
 {
-    skip_whitespace_or_comment(in);
+    skip_whitespace_or_comment(sys, in);
     if (lisp_stream_at_end(&sys->stream, in))
     {
         return false;
@@ -334,6 +418,386 @@ Expr lisp_read_one_from_string(SystemState * sys, char const * src)
     return ret;
 }
 
+/* push parser */
+
+enum
+{
+    PARSER_BLANK,
+    PARSER_COMMENT,
+    PARSER_SYMBOL,
+    PARSER_STRING,
+    PARSER_ESCAPE,
+    PARSER_HEX,
+    PARSER_COMMA,
+};
+
+enum
+{
+    PARSER_FRAME_LIST,
+    PARSER_FRAME_PREFIX,
+};
+
+enum
+{
+    PARSER_DOT_NONE,
+    PARSER_DOT_WANT,        /* after '.', the cdr is next */
+    PARSER_DOT_DONE,        /* the cdr is set, only ')' may follow */
+};
+
+static void _parser_token_append(Parser * parser, char const * data, size_t len)
+{
+    if (parser->num_token + len > parser->max_token)
+    {
+        size_t max = parser->max_token ? parser->max_token : 256;
+        while (max < parser->num_token + len)
+        {
+            max *= 2;
+        }
+        parser->token = (char *) LISP_REALLOC(parser->token, max);
+        if (!parser->token)
+        {
+            LISP_FAIL("parser token allocation failed\n");
+        }
+        parser->max_token = max;
+    }
+    memcpy(parser->token + parser->num_token, data, len);
+    parser->num_token += len;
+}
+
+static ParserFrame * _parser_top(Parser * parser)
+{
+    return parser->num_frames ? parser->frames + parser->num_frames - 1 : NULL;
+}
+
+static void _parser_push_frame(Parser * parser, U64 kind, Expr prefix)
+{
+    if (parser->num_frames == parser->max_frames)
+    {
+        parser->max_frames = parser->max_frames ? parser->max_frames * 2 : 16;
+        parser->frames = (ParserFrame *) LISP_REALLOC(parser->frames, sizeof(ParserFrame) * parser->max_frames);
+        if (!parser->frames)
+        {
+            LISP_FAIL("parser frame allocation failed\n");
+        }
+    }
+    ParserFrame * frame = parser->frames + parser->num_frames++;
+    frame->kind = kind;
+    frame->dot = PARSER_DOT_NONE;
+    frame->prefix = prefix;
+}
+
+static void _parser_open_list(SystemState * sys, Parser * parser)
+{
+    _parser_push_frame(parser, PARSER_FRAME_LIST, nil);
+    parser->lists = lisp_cons(&sys->cons, lisp_cons(&sys->cons, nil, nil), parser->lists);
+}
+
+/* hands a complete form to the innermost open list, wrapping it in any
+   pending quote prefixes first, or queues it at the top level */
+static void _parser_complete(SystemState * sys, Parser * parser, Expr exp, bool dot)
+{
+    ConsState * cons = &sys->cons;
+    ParserFrame * frame;
+    while ((frame = _parser_top(parser)) && frame->kind == PARSER_FRAME_PREFIX)
+    {
+        exp = lisp_cons(cons, frame->prefix, lisp_cons(cons, exp, nil));
+        --parser->num_frames;
+        dot = false;
+    }
+
+    if (!frame)
+    {
+        Expr const next = lisp_cons(cons, exp, nil);
+        if (parser->forms)
+        {
+            lisp_rplacd(cons, parser->forms_tail, next);
+        }
+        else
+        {
+            parser->forms = next;
+        }
+        parser->forms_tail = next;
+        return;
+    }
+
+    Expr const list = lisp_car(cons, parser->lists);
+    if (frame->dot == PARSER_DOT_WANT)
+    {
+        lisp_rplacd(cons, lisp_cdr(cons, list), exp);
+        frame->dot = PARSER_DOT_DONE;
+    }
+    else if (frame->dot == PARSER_DOT_DONE)
+    {
+        LISP_FAIL("missing ')'\n");
+    }
+    else if (dot)
+    {
+        if (!lisp_car(cons, list))
+        {
+            LISP_FAIL("unexpected '.' at the start of a list\n");
+        }
+        frame->dot = PARSER_DOT_WANT;
+    }
+    else
+    {
+        Expr const next = lisp_cons(cons, exp, nil);
+        if (lisp_car(cons, list))
+        {
+            lisp_rplacd(cons, lisp_cdr(cons, list), next);
+        }
+        else
+        {
+            lisp_rplaca(cons, list, next);
+        }
+        lisp_rplacd(cons, list, next);
+    }
+}
+
+static void _parser_close_list(SystemState * sys, Parser * parser)
+{
+    ParserFrame * frame = _parser_top(parser);
+    if (!frame || frame->kind != PARSER_FRAME_LIST)
+    {
+        LISP_FAIL("unexpected ')'\n");
+    }
+    if (frame->dot == PARSER_DOT_WANT)
+    {
+        LISP_FAIL("missing expression after '.'\n");
+    }
+
+    Expr const head = lisp_car(&sys->cons, lisp_car(&sys->cons, parser->lists));
+    parser->lists = lisp_cdr(&sys->cons, parser->lists);
+    --parser->num_frames;
+    _parser_complete(sys, parser, head, false);
+}
+
+static void _parser_complete_symbol(SystemState * sys, Parser * parser)
+{
+    Expr const exp = parse_atom(sys, parser->token, parser->num_token);
+    _parser_complete(sys, parser, exp, exp == LISP_SYM_DOT);
+    parser->state = PARSER_BLANK;
+}
+
+static void _parser_complete_string(SystemState * sys, Parser * parser)
+{
+    _parser_complete(sys, parser, lisp_intern_string_n(&sys->string, parser->token, parser->num_token), false);
+    parser->state = PARSER_BLANK;
+}
+
+static char _parser_hex_digit(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+    {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f')
+    {
+        return 10 + ch - 'a';
+    }
+    if (ch >= 'A' && ch <= 'F')
+    {
+        return 10 + ch - 'A';
+    }
+    LISP_FAIL("malformed string");
+    return 0;
+}
+
+void lisp_parser_init(SystemState * sys, Parser * parser)
+{
+    memset(parser, 0, sizeof(Parser));
+    lisp_gc_push_root(&sys->gc, &parser->lists);
+    lisp_gc_push_root(&sys->gc, &parser->forms);
+}
+
+void lisp_parser_quit(SystemState * sys, Parser * parser)
+{
+    lisp_gc_remove_root(&sys->gc, &parser->forms);
+    lisp_gc_remove_root(&sys->gc, &parser->lists);
+    LISP_FREE(parser->token);
+    LISP_FREE(parser->frames);
+    memset(parser, 0, sizeof(Parser));
+}
+
+/* consumes all of data */
+ParserStatus lisp_parser_feed(SystemState * sys, Parser * parser, char const * data, size_t len)
+{
+    LexState * lex = &sys->lex;
+    size_t i = 0;
+    while (i < len)
+    {
+        switch (parser->state)
+        {
+        case PARSER_BLANK:
+            i += lisp_lex_skip_whitespace(lex, data + i, len - i);
+            if (i == len)
+            {
+                break;
+            }
+            switch (data[i])
+            {
+            case ';':
+                parser->state = PARSER_COMMENT;
+                ++i;
+                break;
+            case '(':
+                _parser_open_list(sys, parser);
+                ++i;
+                break;
+            case ')':
+                _parser_close_list(sys, parser);
+                ++i;
+                break;
+            case '"':
+                parser->num_token = 0;
+                parser->state = PARSER_STRING;
+                ++i;
+                break;
+#if LISP_READER_PARSE_QUOTE
+            case '\'':
+                _parser_push_frame(parser, PARSER_FRAME_PREFIX, LISP_SYM_QUOTE);
+                ++i;
+                break;
+            case '`':
+                _parser_push_frame(parser, PARSER_FRAME_PREFIX, LISP_SYM_BACKQUOTE);
+                ++i;
+                break;
+            case ',':
+                parser->state = PARSER_COMMA;
+                ++i;
+                break;
+#endif
+            default:
+                if (!is_symbol_start(data[i]))
+                {
+                    LISP_FAIL("cannot read expression, unexpected '%c'\n", data[i]);
+                }
+                parser->num_token = 0;
+                parser->state = PARSER_SYMBOL;
+                break;
+            }
+            break;
+
+        case PARSER_COMMENT:
+            i += lisp_lex_find_line_end(lex, data + i, len - i);
+            if (i < len)
+            {
+                ++i;
+                parser->state = PARSER_BLANK;
+            }
+            break;
+
+        case PARSER_SYMBOL:
+            {
+                size_t const n = lisp_lex_find_delimiter(lex, data + i, len - i);
+                _parser_token_append(parser, data + i, n);
+                i += n;
+                if (i < len)
+                {
+                    /* the delimiter is left for the blank state */
+                    _parser_complete_symbol(sys, parser);
+                }
+            }
+            break;
+
+        case PARSER_STRING:
+            {
+                size_t const n = lisp_lex_find_string_special(lex, data + i, len - i);
+                _parser_token_append(parser, data + i, n);
+                i += n;
+                if (i == len)
+                {
+                    break;
+                }
+                if (data[i] == '"')
+                {
+                    _parser_complete_string(sys, parser);
+                }
+                else if (data[i] == '\\')
+                {
+                    parser->state = PARSER_ESCAPE;
+                }
+                else
+                {
+                    LISP_FAIL("unexpected eof in string\n");
+                }
+                ++i;
+            }
+            break;
+
+        case PARSER_ESCAPE:
+            {
+                char const ch = data[i++];
+                if (ch == 'x')
+                {
+                    parser->hex = 0;
+                    parser->num_hex = 0;
+                    parser->state = PARSER_HEX;
+                    break;
+                }
+                char const val = ch == 'n' ? '\n' : ch == 't' ? '\t' : ch;
+                _parser_token_append(parser, &val, 1);
+                parser->state = PARSER_STRING;
+            }
+            break;
+
+        case PARSER_HEX:
+            parser->hex = parser->hex * 16 + _parser_hex_digit(data[i++]);
+            if (++parser->num_hex == 2)
+            {
+                _parser_token_append(parser, &parser->hex, 1);
+                parser->state = PARSER_STRING;
+            }
+            break;
+
+        case PARSER_COMMA:
+            if (data[i] == '@')
+            {
+                _parser_push_frame(parser, PARSER_FRAME_PREFIX, LISP_SYM_UNQUOTE_SPLICING);
+                ++i;
+            }
+            else
+            {
+                _parser_push_frame(parser, PARSER_FRAME_PREFIX, LISP_SYM_UNQUOTE);
+            }
+            parser->state = PARSER_BLANK;
+            break;
+
+        default:
+            LISP_FAIL("internal error\n");
+        }
+    }
+
+    return parser->forms ? PARSER_FORM : PARSER_NEED_MORE;
+}
+
+/* marks the end of input, false if it cut a form short */
+bool lisp_parser_finish(SystemState * sys, Parser * parser)
+{
+    if (parser->state == PARSER_SYMBOL)
+    {
+        _parser_complete_symbol(sys, parser);
+    }
+    if (parser->state == PARSER_COMMENT)
+    {
+        parser->state = PARSER_BLANK;
+    }
+    return parser->state == PARSER_BLANK && !parser->num_frames;
+}
+
+/* takes the oldest complete form */
+bool lisp_parser_next(SystemState * sys, Parser * parser, Expr * exp)
+{
+    if (!parser->forms)
+    {
+        return false;
+    }
+    *exp = lisp_car(&sys->cons, parser->forms);
+    parser->forms = lisp_cdr(&sys->cons, parser->forms);
+    return true;
+}
+
+#if LISP_GLOBAL_API
+
 bool maybe_parse_expr(Expr in, Expr * exp)
 {
     return lisp_maybe_parse_expr(&global, in, exp);
@@ -343,3 +807,30 @@ Expr read_one_from_string(char const * src)
 {
     return lisp_read_one_from_string(&global, src);
 }
+
+void parser_init(Parser * parser)
+{
+    lisp_parser_init(&global, parser);
+}
+
+void parser_quit(Parser * parser)
+{
+    lisp_parser_quit(&global, parser);
+}
+
+ParserStatus parser_feed(Parser * parser, char const * data, size_t len)
+{
+    return lisp_parser_feed(&global, parser, data, len);
+}
+
+bool parser_finish(Parser * parser)
+{
+    return lisp_parser_finish(&global, parser);
+}
+
+bool parser_next(Parser * parser, Expr * exp)
+{
+    return lisp_parser_next(&global, parser, exp);
+}
+
+#endif
@@ -17,6 +17,15 @@ bool is_special(Expr exp)
 
 Expr lisp_make_special(SpecialState * special, char const * name, SpecialFun fun)
 {
+    /* every core env registers the same functions, share their entries */
+    for (U64 i = 0; i < special->num; i++)
+    {
+        if (special->info[i].fun == fun && !strcmp(special->info[i].name, name))
+        {
+            return make_expr(TYPE_SPECIAL, i);
+        }
+    }
+
     LISP_ASSERT(special->num < LISP_MAX_SPECIALS);
     U64 const index = special->num++;
     SpecialInfo * info = special->info + index;
@@ -14,12 +14,18 @@
 ;;      nil
 ;;      t))
 
-(defun append (a b)
+(defun revappend (a b)
   (if a
-      (cons (car a)
-            (append (cdr a) b))
+      (revappend (cdr a) (cons (car a) b))
       b))
 
+(defun reverse (a)
+  (revappend a nil))
+
+;; tail recursive, so long lists do not grow the stack
+(defun append (a b)
+  (revappend (reverse a) b))
+
 (defun list args
   (append args nil))
 
@@ -6,19 +6,55 @@ void stream_init(StreamState * stream)
     memset(stream, 0, sizeof(StreamState));
 
     stream->stdin = lisp_make_file_input_stream(stream, stdin, false);
+    stream->info[expr_data(stream->stdin)].interactive = true;
     stream->stdout = lisp_make_file_output_stream(stream, stdout, false);
+    stream->info[expr_data(stream->stdout)].line_flush = true;
     stream->stderr = lisp_make_file_output_stream(stream, stderr, false);
+    stream->info[expr_data(stream->stderr)].line_flush = true;
 }
 
-void stream_quit(StreamState * stream)
+static void _stream_spill(StreamInfo * info)
 {
-    for (U64 i = 0; i < stream->num; i++)
+    if (info->write_cursor)
     {
-        StreamInfo * info = stream->info + i;
-        if (info->close_on_quit)
+        fwrite(info->write_buffer, 1, info->write_cursor, info->file);
+        info->write_cursor = 0;
+    }
+}
+
+static void _stream_close(StreamInfo * info)
+{
+    if (info->file)
+    {
+        /* file streams own their buffers, only output ones are flushed */
+        if (info->write_buffer)
         {
-            fclose(info->file);
+            _stream_spill(info);
+            fflush(info->file);
         }
+        LISP_FREE((char *) info->read_buffer);
+        LISP_FREE(info->write_buffer);
+    }
+    else if (info->growable)
+    {
+        LISP_FREE(info->write_buffer);
+    }
+    else if (info->write_buffer)
+    {
+        /* room for the terminator is reserved in fixed buffers */
+        info->write_buffer[info->write_cursor] = 0;
+    }
+    if (info->close_on_quit)
+    {
+        fclose(info->file);
+    }
+}
+
+void stream_quit(StreamState * stream)
+{
+    for (U64 i = 0; i < stream->num; i++)
+    {
+        _stream_close(stream->info + i);
     }
 }
 
@@ -44,13 +80,23 @@ static Expr _make_buffer_stream(StreamState * stream, size_t size, char * buffer
     U64 const index = stream->num++;
     StreamInfo * info = stream->info + index;
     memset(info, 0, sizeof(StreamInfo));
-    info->size = size;
-    info->buffer = buffer;
-    info->cursor = 0;
+    info->write_size = size;
+    info->write_buffer = buffer;
+    info->write_cursor = 0;
 
     return make_expr(TYPE_STREAM, index);
 }
 
+static char * _stream_alloc(size_t size)
+{
+    char * buffer = (char *) LISP_MALLOC(size);
+    if (!buffer)
+    {
+        LISP_FAIL("stream buffer allocation failed\n");
+    }
+    return buffer;
+}
+
 void lisp_stream_show_info(StreamState * stream)
 {
     for (U64 i = 0; i < stream->num; i++)
@@ -58,7 +104,8 @@ void lisp_stream_show_info(StreamState * stream)
         StreamInfo * info = stream->info + i;
         fprintf(stderr, "stream %d:\n", (int) i);
         fprintf(stderr, "- file: %p\n", info->file);
-        fprintf(stderr, "- buffer: %p\n", info->buffer);
+        fprintf(stderr, "- read buffer: %p\n", info->read_buffer);
+        fprintf(stderr, "- write buffer: %p\n", info->write_buffer);
     }
 }
 
@@ -69,67 +116,98 @@ Expr lisp_make_file_input_stream(StreamState * stream, FILE * file, bool close_o
 
 Expr lisp_make_file_output_stream(StreamState * stream, FILE * file, bool close_on_quit)
 {
-    return _make_file_stream(stream, file, close_on_quit);
+    Expr const exp = _make_file_stream(stream, file, close_on_quit);
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    info->write_buffer = _stream_alloc(LISP_STREAM_WRITE_SIZE);
+    info->write_size = LISP_STREAM_WRITE_SIZE;
+    return exp;
 }
 
 Expr lisp_make_string_input_stream(StreamState * stream, char const * str)
 {
     // TODO copy string into buffer?
-    size_t const len = strlen(str);
-    return _make_buffer_stream(stream, len + 1, (char *) str);
+    return lisp_make_buffer_input_stream(stream, strlen(str), str);
+}
+
+Expr lisp_make_buffer_input_stream(StreamState * stream, size_t size, char const * buffer)
+{
+    Expr const exp = _make_buffer_stream(stream, 0, NULL);
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    info->read_buffer = buffer;
+    info->read_size = size;
+    return exp;
 }
 
 Expr lisp_make_buffer_output_stream(StreamState * stream, size_t size, char * buffer)
 {
-    return _make_buffer_stream(stream, size, buffer);
+    LISP_ASSERT(size > 0);
+    return _make_buffer_stream(stream, size - 1, buffer);
 }
 
-char lisp_stream_peek_char(StreamState * stream, Expr exp)
+Expr lisp_make_string_output_stream(StreamState * stream)
 {
-    U64 const index = expr_data(exp);
-    LISP_ASSERT(index < stream->num);
-    StreamInfo * info = stream->info + index;
-    if (info->file)
+    size_t const size = 256;
+    Expr const exp = _make_buffer_stream(stream, size, _stream_alloc(size));
+    lisp_stream_info(stream, exp)->growable = true;
+    return exp;
+}
+
+static bool _stream_refill(StreamInfo * info)
+{
+    char * buffer = (char *) info->read_buffer;
+    if (!buffer)
     {
-        int ch = fgetc(info->file);
-        if (ch == EOF)
+        buffer = (char *) LISP_MALLOC(LISP_STREAM_READ_SIZE);
+        if (!buffer)
         {
-            return 0;
+            LISP_FAIL("stream buffer allocation failed\n");
         }
-        ungetc(ch, info->file);
-        return ch;
+        info->read_buffer = buffer;
     }
 
-    if (info->buffer)
+    info->read_cursor = 0;
+    if (info->interactive)
     {
-        if (info->cursor < info->size)
-        {
-            return info->buffer[info->cursor];
-        }
-        else
-        {
-            return 0;
-        }
+        info->read_size = fgets(buffer, LISP_STREAM_READ_SIZE, info->file) ? strlen(buffer) : 0;
+    }
+    else
+    {
+        info->read_size = fread(buffer, 1, LISP_STREAM_READ_SIZE, info->file);
+    }
+    return info->read_size > 0;
+}
+
+char lisp_stream_peek_char_slow(StreamState * stream, Expr exp)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    if (info->file)
+    {
+        return _stream_refill(info) ? info->read_buffer[0] : 0;
+    }
+
+    if (info->read_buffer)
+    {
+        return 0;
     }
 
     LISP_FAIL("cannot read from stream\n");
     return 0;
 }
 
-void lisp_stream_skip_char(StreamState * stream, Expr exp)
+void lisp_stream_skip_char_slow(StreamState * stream, Expr exp)
 {
-    U64 const index = expr_data(exp);
-    LISP_ASSERT(index < stream->num);
-    StreamInfo * info = stream->info + index;
+    StreamInfo * info = lisp_stream_info(stream, exp);
     if (info->file)
     {
-        fgetc(info->file);
+        if (_stream_refill(info))
+        {
+            ++info->read_cursor;
+        }
         return;
     }
 
-    if (info->buffer)
+    if (info->read_buffer)
     {
-        ++info->cursor;
         return;
     }
 
@@ -141,31 +219,133 @@ bool lisp_stream_at_end(StreamState * stream, Expr exp)
     return lisp_stream_peek_char(stream, exp) == 0;
 }
 
+/* makes room for at least len more bytes in the output window */
+static void _stream_make_room(StreamInfo * info, size_t len)
+{
+    if (info->file && info->write_buffer)
+    {
+        _stream_spill(info);
+        return;
+    }
+
+    if (info->growable)
+    {
+        size_t size = info->write_size * 2;
+        while (size < info->write_cursor + len)
+        {
+            size *= 2;
+        }
+        info->write_buffer = (char *) LISP_REALLOC(info->write_buffer, size);
+        if (!info->write_buffer)
+        {
+            LISP_FAIL("stream buffer allocation failed\n");
+        }
+        info->write_size = size;
+        return;
+    }
+
+    if (info->write_buffer)
+    {
+        LISP_FAIL("stream buffer overflow\n");
+    }
+
+    LISP_FAIL("cannot write to stream\n");
+}
+
+void lisp_stream_put_char_slow(StreamState * stream, Expr exp, char ch)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    if (info->write_cursor == info->write_size)
+    {
+        _stream_make_room(info, 1);
+    }
+    info->write_buffer[info->write_cursor++] = ch;
+    if (ch == '\n' && info->line_flush)
+    {
+        _stream_spill(info);
+    }
+}
+
+void lisp_stream_write(StreamState * stream, Expr exp, char const * data, size_t len)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    bool const flush = info->line_flush && memchr(data, '\n', len);
+    while (len)
+    {
+        if (info->write_cursor == info->write_size)
+        {
+            _stream_make_room(info, len);
+        }
+        size_t const room = info->write_size - info->write_cursor;
+        size_t const num = len < room ? len : room;
+        memcpy(info->write_buffer + info->write_cursor, data, num);
+        info->write_cursor += num;
+        data += num;
+        len -= num;
+    }
+    if (flush)
+    {
+        _stream_spill(info);
+    }
+}
+
 void lisp_stream_put_string(StreamState * stream, Expr exp, char const * str)
 {
-    LISP_ASSERT(is_stream(exp));
-    U64 const index = expr_data(exp);
-    LISP_ASSERT(index < stream->num);
-    StreamInfo * info = stream->info + index;
-    if (info->file)
+    lisp_stream_write(stream, exp, str, strlen(str));
+}
+
+void lisp_stream_put_u64(StreamState * stream, Expr exp, U64 val)
+{
+    char str[32];
+    sprintf(str, "%" PRIu64, val);
+    lisp_stream_put_string(stream, exp, str);
+}
+
+void lisp_stream_put_i64(StreamState * stream, Expr exp, I64 val)
+{
+    char str[32];
+    sprintf(str, "%" PRId64, val);
+    lisp_stream_put_string(stream, exp, str);
+}
+
+void lisp_stream_put_x64(StreamState * stream, Expr exp, U64 val)
+{
+    char str[32];
+    sprintf(str, "%016" PRIu64, val);
+    lisp_stream_put_string(stream, exp, str);
+}
+
+void lisp_stream_flush(StreamState * stream, Expr exp)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    if (info->file && info->write_buffer)
     {
-        fputs(str, info->file);
+        _stream_spill(info);
+        fflush(info->file);
     }
+}
 
-    if (info->buffer)
+char const * lisp_stream_output(StreamState * stream, Expr exp, size_t * len)
+{
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    LISP_ASSERT(!info->file && info->write_buffer);
+    if (info->growable && info->write_cursor == info->write_size)
     {
-        size_t const len = strlen(str);
-        LISP_ASSERT(info->cursor + len + 1 < info->size);
-        memcpy(info->buffer + info->cursor, str, len + 1);
-        info->cursor += len;
+        _stream_make_room(info, 1);
     }
+    info->write_buffer[info->write_cursor] = 0;
+    if (len)
+    {
+        *len = info->write_cursor;
+    }
+    return info->write_buffer;
 }
 
-void lisp_stream_put_char(StreamState * stream, Expr exp, char ch)
+void lisp_stream_clear_output(StreamState * stream, Expr exp)
 {
-    // TODO make this more efficient
-    char const tmp[2] = { ch, 0 };
-    lisp_stream_put_string(stream, exp, tmp);
+    StreamInfo * info = lisp_stream_info(stream, exp);
+    LISP_ASSERT(!info->file && info->write_buffer);
+    info->write_cursor = 0;
 }
 
 void lisp_stream_release(StreamState * stream, Expr exp)
@@ -174,10 +354,7 @@ void lisp_stream_release(StreamState * stream, Expr exp)
     U64 const index = expr_data(exp);
     LISP_ASSERT(index < stream->num);
     StreamInfo * info = stream->info + index;
-    if (info->close_on_quit)
-    {
-        fclose(info->file);
-    }
+    _stream_close(info);
     memcpy(info, stream->info + --stream->num, sizeof(StreamInfo));
 }
 
@@ -195,19 +372,14 @@ Expr make_string_input_stream(char const * str)
     return lisp_make_string_input_stream(&global.stream, str);
 }
 
-char stream_peek_char(Expr exp)
+Expr make_string_output_stream()
 {
-    return lisp_stream_peek_char(&global.stream, exp);
+    return lisp_make_string_output_stream(&global.stream);
 }
 
-void stream_skip_char(Expr exp)
+void stream_write(Expr exp, char const * data, size_t len)
 {
-    lisp_stream_skip_char(&global.stream, exp);
-}
-
-void stream_put_char(Expr exp, char ch)
-{
-    lisp_stream_put_char(&global.stream, exp, ch);
+    lisp_stream_write(&global.stream, exp, data, len);
 }
 
 void stream_put_string(Expr exp, char const * str)
@@ -217,16 +389,27 @@ void stream_put_string(Expr exp, char const * str)
 
 void stream_put_u64(Expr exp, U64 val)
 {
-    char str[32];
-    sprintf(str, "%" PRIu64, val);
-    stream_put_string(exp, str);
+    lisp_stream_put_u64(&global.stream, exp, val);
+}
+
+void stream_put_i64(Expr exp, I64 val)
+{
+    lisp_stream_put_i64(&global.stream, exp, val);
 }
 
 void stream_put_x64(Expr exp, U64 val)
 {
-    char str[32];
-    sprintf(str, "%016" PRIu64, val);
-    stream_put_string(exp, str);
+    lisp_stream_put_x64(&global.stream, exp, val);
+}
+
+void stream_flush(Expr exp)
+{
+    lisp_stream_flush(&global.stream, exp);
+}
+
+char const * stream_output(Expr exp, size_t * len)
+{
+    return lisp_stream_output(&global.stream, exp, len);
 }
 
 void stream_release(Expr exp)
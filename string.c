@@ -1,42 +1,138 @@
-
 #include "common.h"
 
-static Expr string_alloc(StringState * string, size_t len)
+struct StringChunk
+{
+    StringChunk * next;
+    U64 data[];         /* records are kept aligned for their header */
+};
+
+static void _string_maybe_realloc(StringState * string)
 {
-    if (string->count < LISP_MAX_STRINGS)
+    if (string->num < string->max)
     {
-        U64 const index = string->count;
-        string->values[index] = (char *) LISP_MALLOC(len + 1);
-        ++string->count;
-        return make_expr(TYPE_STRING, index);
+        return;
     }
 
-    LISP_FAIL("cannot make string of length %d\n", (int) len);
-    return nil;
+    string->max = string->max ? string->max * 2 : LISP_DEF_STRINGS;
+    string->records = (StringRecord **) LISP_REALLOC(string->records, sizeof(StringRecord *) * string->max);
+    if (!string->records)
+    {
+        LISP_FAIL("string memory allocation failed\n");
+    }
 }
 
-static char * string_buffer(StringState * string, Expr exp)
+static void _string_insert_slot(StringState * string, U64 index)
+{
+    U64 const mask = string->num_slots - 1;
+    for (U64 slot = string->records[index]->hash & mask;; slot = (slot + 1) & mask)
+    {
+        if (!string->slots[slot])
+        {
+            string->slots[slot] = index + 1;
+            return;
+        }
+    }
+}
+
+static void _string_maybe_rehash(StringState * string)
+{
+    /* keep the load factor at or below one half */
+    if ((string->num_unique + 1) * 2 <= string->num_slots)
+    {
+        return;
+    }
+
+    U64 * old_slots = string->slots;
+    U64 const old_num_slots = string->num_slots;
+
+    string->num_slots = string->num_slots ? string->num_slots * 2 : LISP_DEF_STRINGS * 2;
+    string->slots = (U64 *) LISP_MALLOC(sizeof(U64) * string->num_slots);
+    if (!string->slots)
+    {
+        LISP_FAIL("string index allocation failed\n");
+    }
+    memset(string->slots, 0, sizeof(U64) * string->num_slots);
+
+    for (U64 i = 0; i < old_num_slots; i++)
+    {
+        if (old_slots[i])
+        {
+            _string_insert_slot(string, old_slots[i] - 1);
+        }
+    }
+    LISP_FREE(old_slots);
+}
+
+static StringRecord * _string_store(StringState * string, char const * str, size_t len, U32 hash)
+{
+    if (len > UINT32_MAX)
+    {
+        LISP_FAIL("cannot make string of length %" PRIu64 "\n", (U64) len);
+    }
+
+    size_t const size = (sizeof(StringRecord) + len + 1 + 7) & ~(size_t) 7;
+    if (!string->chunk || string->chunk_used + size > string->chunk_size)
+    {
+        size_t const chunk_size = size > LISP_STRING_CHUNK_SIZE ? size : LISP_STRING_CHUNK_SIZE;
+        StringChunk * chunk = (StringChunk *) LISP_MALLOC(sizeof(StringChunk) + chunk_size);
+        if (!chunk)
+        {
+            LISP_FAIL("string memory allocation failed\n");
+        }
+        chunk->next = string->chunk;
+        string->chunk = chunk;
+        string->chunk_used = 0;
+        string->chunk_size = chunk_size;
+    }
+
+    StringRecord * record = (StringRecord *) ((char *) string->chunk->data + string->chunk_used);
+    record->len = (U32) len;
+    record->hash = hash;
+    memcpy(record->data, str, len);
+    record->data[len] = 0;
+    string->chunk_used += size;
+    return record;
+}
+
+static Expr _string_add(StringState * string, char const * str, size_t len, U32 hash)
+{
+    _string_maybe_realloc(string);
+    U64 const index = string->num;
+    string->records[index] = _string_store(string, str, len, hash);
+    ++string->num;
+    return make_expr(TYPE_STRING, index);
+}
+
+static StringRecord * _string_record(StringState * string, Expr exp)
 {
     LISP_ASSERT(is_string(exp));
 
     U64 const index = expr_data(exp);
-    if (index >= string->count)
+    if (index >= string->num)
     {
         LISP_FAIL("illegal string index %" PRIu64 "\n", index);
     }
 
-    return string->values[index];
+    return string->records[index];
 }
 
 void string_init(StringState * string)
 {
     memset(string, 0, sizeof(StringState));
-    string->values = (char **) LISP_MALLOC(sizeof(char *) * LISP_MAX_STRINGS);
+    _string_maybe_realloc(string);
+    _string_maybe_rehash(string);
 }
 
 void string_quit(StringState * string)
 {
-    LISP_FREE(string->values);
+    while (string->chunk)
+    {
+        StringChunk * next = string->chunk->next;
+        LISP_FREE(string->chunk);
+        string->chunk = next;
+    }
+    LISP_FREE(string->slots);
+    LISP_FREE(string->records);
     memset(string, 0, sizeof(StringState));
 }
 
@@ -45,35 +141,80 @@ bool is_string(Expr exp)
     return expr_type(exp) == TYPE_STRING;
 }
 
+Expr lisp_make_string_n(StringState * string, char const * str, size_t len)
+{
+    return _string_add(string, str, len, hash_bytes(str, len));
+}
+
 Expr lisp_make_string(StringState * string, char const * str)
 {
-    size_t const len = strlen(str);
+    return lisp_make_string_n(string, str, strlen(str));
+}
 
-    /* TODO fixstrs sound attractive,
-       but the string_value API breaks
-       b/c it has to return a pointer */
+/* strings are immutable, so equal literals can share one record */
+Expr lisp_intern_string_n(StringState * string, char const * str, size_t len)
+{
+    U32 const hash = hash_bytes(str, len);
+
+    U64 const mask = string->num_slots - 1;
+    for (U64 slot = hash & mask; string->slots[slot]; slot = (slot + 1) & mask)
+    {
+        U64 const index = string->slots[slot] - 1;
+        StringRecord const * record = string->records[index];
+        if (record->hash == hash && record->len == len && !memcmp(str, record->data, len))
+        {
+            return make_expr(TYPE_STRING, index);
+        }
+    }
 
-    Expr ret = string_alloc(string, len);
-    memcpy(string_buffer(string, ret), str, len + 1);
+    _string_maybe_rehash(string);
+    Expr const ret = _string_add(string, str, len, hash);
+    ++string->num_unique;
+    _string_insert_slot(string, expr_data(ret));
     return ret;
 }
 
+bool lisp_string_is_interned(StringState * string, Expr exp)
+{
+    StringRecord const * record = _string_record(string, exp);
+    U64 const mask = string->num_slots - 1;
+    for (U64 slot = record->hash & mask; string->slots[slot]; slot = (slot + 1) & mask)
+    {
+        if (string->slots[slot] - 1 == expr_data(exp))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 char const * lisp_string_value(StringState * string, Expr exp)
 {
-    return string_buffer(string, exp);
+    return _string_record(string, exp)->data;
 }
 
 U64 lisp_string_length(StringState * string, Expr exp)
 {
-    // TODO cache this
-    return (U64) strlen(lisp_string_value(string, exp));
+    return _string_record(string, exp)->len;
 }
 
+#if LISP_GLOBAL_API
+
 Expr make_string(char const * str)
 {
     return lisp_make_string(&global.string, str);
 }
 
+Expr make_string_n(char const * str, size_t len)
+{
+    return lisp_make_string_n(&global.string, str, len);
+}
+
+Expr intern_string_n(char const * str, size_t len)
+{
+    return lisp_intern_string_n(&global.string, str, len);
+}
+
 char const * string_value(Expr exp)
 {
     return lisp_string_value(&global.string, exp);
@@ -83,3 +224,5 @@ U64 string_length(Expr exp)
 {
     return lisp_string_length(&global.string, exp);
 }
+
+#endif
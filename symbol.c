@@ -1,6 +1,12 @@
 
 #include "common.h"
 
+struct SymbolChunk
+{
+    SymbolChunk * next;
+    char data[];
+};
+
 static void _symbol_maybe_realloc(SymbolState * symbol)
 {
     if (symbol->num < symbol->max)
@@ -19,8 +25,8 @@ static void _symbol_maybe_realloc(SymbolState * symbol)
             symbol->max *= 2;
         }
 
-        symbol->names = (char **) LISP_REALLOC(symbol->names, sizeof(char *) * symbol->max);
-        if (!symbol->names)
+        symbol->info = (SymbolInfo *) LISP_REALLOC(symbol->info, sizeof(SymbolInfo) * symbol->max);
+        if (!symbol->info)
         {
             LISP_FAIL("symbol memory allocation failed\n");
         }
@@ -30,52 +36,137 @@ static void _symbol_maybe_realloc(SymbolState * symbol)
     LISP_FAIL("intern ran over memory budget\n");
 }
 
+static void _symbol_insert_slot(SymbolState * symbol, U64 index)
+{
+    U64 const mask = symbol->num_slots - 1;
+    for (U64 slot = symbol->info[index].hash & mask;; slot = (slot + 1) & mask)
+    {
+        if (!symbol->slots[slot])
+        {
+            symbol->slots[slot] = index + 1;
+            return;
+        }
+    }
+}
+
+static void _symbol_maybe_rehash(SymbolState * symbol)
+{
+    /* keep the load factor at or below one half */
+    if ((symbol->num + 1) * 2 <= symbol->num_slots)
+    {
+        return;
+    }
+
+    LISP_FREE(symbol->slots);
+    symbol->num_slots = symbol->num_slots ? symbol->num_slots * 2 : LISP_DEF_SYMBOLS * 2;
+    symbol->slots = (U64 *) LISP_MALLOC(sizeof(U64) * symbol->num_slots);
+    if (!symbol->slots)
+    {
+        LISP_FAIL("symbol index allocation failed\n");
+    }
+    memset(symbol->slots, 0, sizeof(U64) * symbol->num_slots);
+
+    for (U64 i = 0; i < symbol->num; i++)
+    {
+        _symbol_insert_slot(symbol, i);
+    }
+}
+
+static char * _symbol_store_name(SymbolState * symbol, char const * name, size_t len)
+{
+    if (!symbol->chunk || symbol->chunk_used + len + 1 > symbol->chunk_size)
+    {
+        size_t const size = len + 1 > LISP_SYMBOL_CHUNK_SIZE ? len + 1 : LISP_SYMBOL_CHUNK_SIZE;
+        SymbolChunk * chunk = (SymbolChunk *) LISP_MALLOC(sizeof(SymbolChunk) + size);
+        if (!chunk)
+        {
+            LISP_FAIL("symbol memory allocation failed\n");
+        }
+        chunk->next = symbol->chunk;
+        symbol->chunk = chunk;
+        symbol->chunk_used = 0;
+        symbol->chunk_size = size;
+    }
+
+    char * buffer = symbol->chunk->data + symbol->chunk_used;
+    memcpy(buffer, name, len);
+    buffer[len] = 0;
+    symbol->chunk_used += len + 1;
+    return buffer;
+}
+
 void symbol_init(SymbolState * symbol)
 {
     LISP_ASSERT_DEBUG(symbol);
 
     memset(symbol, 0, sizeof(SymbolState));
     _symbol_maybe_realloc(symbol);
+    _symbol_maybe_rehash(symbol);
+
+    static char const * const names[] =
+    {
+#define LISP_SYMBOL_NAME(id, name) name,
+        LISP_SYMBOLS(LISP_SYMBOL_NAME)
+#undef LISP_SYMBOL_NAME
+    };
+
+    for (U64 i = 0; i < NUM_WELL_KNOWN_SYMBOLS; i++)
+    {
+        Expr const exp = lisp_make_symbol(symbol, names[i]);
+        LISP_ASSERT(exp == LISP_MAKE_EXPR(TYPE_SYMBOL, i));
+    }
 }
 
 void symbol_quit(SymbolState * symbol)
 {
-    for (U64 i = 0; i < symbol->num; i++)
+    while (symbol->chunk)
     {
-        LISP_FREE(symbol->names[i]);
+        SymbolChunk * next = symbol->chunk->next;
+        LISP_FREE(symbol->chunk);
+        symbol->chunk = next;
     }
-    LISP_FREE(symbol->names);
+    LISP_FREE(symbol->slots);
+    LISP_FREE(symbol->info);
     memset(symbol, 0, sizeof(SymbolState));
 }
 
 Expr lisp_make_symbol(SymbolState * symbol, char const * name)
 {
     LISP_ASSERT(name);
-    size_t const len = strlen(name);
+    return lisp_make_symbol_n(symbol, name, strlen(name));
+}
+
+Expr lisp_make_symbol_n(SymbolState * symbol, char const * name, size_t len)
+{
+    LISP_ASSERT(name);
+    U32 const hash = hash_bytes(name, len);
 
-    for (U64 index = 0; index < symbol->num; ++index)
+    U64 const mask = symbol->num_slots - 1;
+    for (U64 slot = hash & mask; symbol->slots[slot]; slot = (slot + 1) & mask)
     {
-        char const * str = symbol->names[index];
-        size_t const tmp = strlen(str); // TODO cache this?
-        if (len == tmp && !strncmp(name, str, len))
+        U64 const index = symbol->slots[slot] - 1;
+        SymbolInfo const * info = symbol->info + index;
+        if (info->hash == hash && info->len == len && !memcmp(name, info->name, len))
         {
             return make_expr(TYPE_SYMBOL, index);
         }
     }
 
     _symbol_maybe_realloc(symbol);
+    _symbol_maybe_rehash(symbol);
 
     U64 const index = symbol->num;
-    char * buffer = (char *) LISP_MALLOC(len + 1);
-    memcpy(buffer, name, len);
-    buffer[len] = 0;
-    symbol->names[index] = buffer;
+    SymbolInfo * info = symbol->info + index;
+    info->name = _symbol_store_name(symbol, name, len);
+    info->len = (U32) len;
+    info->hash = hash;
     ++symbol->num;
+    _symbol_insert_slot(symbol, index);
 
     return make_expr(TYPE_SYMBOL, index);
 }
 
-char const * lisp_symbol_name(SymbolState * symbol, Expr exp)
+static SymbolInfo * _symbol_expr_to_info(SymbolState * symbol, Expr exp)
 {
     LISP_ASSERT(is_symbol(exp));
     U64 const index = expr_data(exp);
@@ -83,7 +174,17 @@ char const * lisp_symbol_name(SymbolState * symbol, Expr exp)
     {
         LISP_FAIL("illegal symbol index %" PRIu64 "\n", index);
     }
-    return symbol->names[index];
+    return symbol->info + index;
+}
+
+char const * lisp_symbol_name(SymbolState * symbol, Expr exp)
+{
+    return _symbol_expr_to_info(symbol, exp)->name;
+}
+
+size_t lisp_symbol_length(SymbolState * symbol, Expr exp)
+{
+    return _symbol_expr_to_info(symbol, exp)->len;
 }
 
 #if LISP_GLOBAL_API
@@ -92,6 +193,11 @@ Expr make_symbol(char const * name)
     return lisp_make_symbol(&global.symbol, name);
 }
 
+Expr make_symbol_n(char const * name, size_t len)
+{
+    return lisp_make_symbol_n(&global.symbol, name, len);
+}
+
 char const * symbol_name(Expr exp)
 {
 #if LISP_SYMBOL_NAME_OF_NIL
@@ -103,4 +209,15 @@ char const * symbol_name(Expr exp)
     return lisp_symbol_name(&global.symbol, exp);
 }
 
+size_t symbol_length(Expr exp)
+{
+#if LISP_SYMBOL_NAME_OF_NIL
+    if (exp == nil)
+    {
+        return 3;
+    }
+#endif
+    return lisp_symbol_length(&global.symbol, exp);
+}
+
 #endif
@@ -1,35 +1,273 @@
 
+/* for mmap */
+#define _POSIX_C_SOURCE 200809L
+
 #include "common.h"
 
+#if LISP_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 void system_init(SystemState * system)
 {
+    util_init(&system->util);
     symbol_init(&system->symbol);
     cons_init(&system->cons);
     gensym_init(&system->gensym);
     string_init(&system->string);
     stream_init(&system->stream);
+    lex_init(&system->lex);
+    binary_init(&system->binary);
     special_init(&system->special);
     builtin_init(&system->builtin);
+    gc_init(&system->gc);
+    lexical_init(&system->lexical);
+    env_init(&system->env);
+    closure_init(&system->closure);
+    expand_init(&system->expand);
+    vm_init(&system->vm);
+    profile_init(&system->profile);
 }
 
 void system_quit(SystemState * system)
 {
+    profile_quit(&system->profile);
+    vm_quit(&system->vm);
+    expand_quit(&system->expand);
+    closure_quit(&system->closure);
+    env_quit(&system->env);
+    lexical_quit(&system->lexical);
+    gc_quit(&system->gc);
     special_quit(&system->special);
     builtin_quit(&system->builtin);
     string_quit(&system->string);
     gensym_quit(&system->gensym);
+    binary_quit(&system->binary);
+    lex_quit(&system->lex);
     stream_quit(&system->stream);
     cons_quit(&system->cons);
     symbol_quit(&system->symbol);
+    util_quit(&system->util);
 }
 
-void load_file(char const * path, Expr env)
+/* files that cannot be mapped, such as pipes, are fed to a push parser in
+   chunks, and the forms complete in each chunk are handled in order */
+static U64 load_file_chunked(SystemState * sys, char const * path, LoadFormFun fun, void * data)
 {
-    Expr const in = make_file_input_stream_from_path(path);
+    FILE * file = fopen(path, "rb");
+    if (!file)
+    {
+        LISP_FAIL("cannot open %s\n", path);
+    }
+
+    char * buffer = (char *) LISP_MALLOC(LISP_STREAM_READ_SIZE);
+    if (!buffer)
+    {
+        LISP_FAIL("load buffer allocation failed\n");
+    }
+
+    Parser parser;
+    lisp_parser_init(sys, &parser);
+
+    U64 num = 0;
+    bool done = false;
+    while (!done)
+    {
+        size_t const len = fread(buffer, 1, LISP_STREAM_READ_SIZE, file);
+        if (len)
+        {
+            lisp_parser_feed(sys, &parser, buffer, len);
+        }
+        else
+        {
+            if (ferror(file))
+            {
+                LISP_FAIL("cannot read %s\n", path);
+            }
+            if (!lisp_parser_finish(sys, &parser))
+            {
+                LISP_FAIL("unexpected eof\n");
+            }
+            done = true;
+        }
+
+        Expr exp = nil;
+        while (lisp_parser_next(sys, &parser, &exp))
+        {
+            fun(sys, exp, data);
+            ++num;
+        }
+    }
+
+    lisp_parser_quit(sys, &parser);
+    LISP_FREE(buffer);
+    fclose(file);
+    return num;
+}
+
+#if LISP_MMAP
+
+/* hands the forms read from in to fun and returns their number */
+static U64 load_stream(SystemState * sys, Expr in, LoadFormFun fun, void * data)
+{
+    U64 num = 0;
     Expr exp = nil;
-    while (maybe_parse_expr(in, &exp))
+    while (lisp_maybe_parse_expr(sys, in, &exp))
     {
-        eval(exp, env);
+        fun(sys, exp, data);
+        ++num;
     }
-    stream_release(in);
+    lisp_stream_release(&sys->stream, in);
+    return num;
 }
+
+/* the contents of a regular file mapped into memory, or NULL */
+static char const * map_file(char const * path, size_t * size)
+{
+    int const fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    *size = (size_t) st.st_size;
+    void * map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+    posix_madvise(map, *size, POSIX_MADV_SEQUENTIAL);
+    return (char const *) map;
+}
+
+/* large files are read in parallel, where there is more than one cpu and
+   reading does not depend on evaluating what came before */
+static bool load_file_mapped(SystemState * sys, char const * path, bool parallel, LoadFormFun fun, void * data, U64 * num)
+{
+    size_t size = 0;
+    char const * map = map_file(path, &size);
+    if (!map)
+    {
+        return false;
+    }
+
+    U64 const chunks = parallel ? lisp_parallel_chunks(size) : 1;
+    if (chunks > 1)
+    {
+        *num = lisp_load_parallel(sys, map, size, chunks, fun, data);
+    }
+    else
+    {
+        *num = load_stream(sys, lisp_make_buffer_input_stream(&sys->stream, size, map), fun, data);
+    }
+
+    munmap((void *) map, size);
+    return true;
+}
+
+#endif
+
+static U64 load_forms(SystemState * sys, char const * path, bool parallel, LoadFormFun fun, void * data)
+{
+#if LISP_MMAP
+    U64 num = 0;
+    if (load_file_mapped(sys, path, parallel, fun, data, &num))
+    {
+        return num;
+    }
+#endif
+    return load_file_chunked(sys, path, fun, data);
+}
+
+U64 lisp_load_forms(SystemState * system, char const * path, LoadFormFun fun, void * data)
+{
+    return load_forms(system, path, false, fun, data);
+}
+
+static void load_form_eval(SystemState * sys, Expr exp, void * data)
+{
+    lisp_eval(sys, exp, *(Expr const *) data);
+}
+
+static void load_form_read(SystemState * sys, Expr exp, void * data)
+{
+    /* nothing is live between forms when only reading */
+    lisp_gc_maybe_collect(sys, &sys->cons);
+}
+
+void lisp_load_file(SystemState * system, char const * path, Expr env)
+{
+    if (env)
+    {
+        load_forms(system, path, false, load_form_eval, &env);
+    }
+    else
+    {
+        load_forms(system, path, true, load_form_read, NULL);
+    }
+}
+
+U64 lisp_read_file(SystemState * system, char const * path)
+{
+    return load_forms(system, path, true, load_form_read, NULL);
+}
+
+typedef struct
+{
+    Expr head;
+    Expr tail;
+} ReadAllList;
+
+static void read_all_form(SystemState * sys, Expr exp, void * data)
+{
+    ReadAllList * list = (ReadAllList *) data;
+    Expr const next = lisp_cons(&sys->cons, exp, nil);
+    if (list->tail)
+    {
+        lisp_rplacd(&sys->cons, list->tail, next);
+    }
+    else
+    {
+        list->head = next;
+    }
+    list->tail = next;
+}
+
+Expr lisp_read_all(SystemState * system, char const * path)
+{
+    ReadAllList list = { nil, nil };
+    lisp_gc_push_root(&system->gc, &list.head);
+    load_forms(system, path, true, read_all_form, &list);
+    lisp_gc_pop_roots(&system->gc, 1);
+    return list.head;
+}
+
+#if LISP_GLOBAL_API
+
+void load_file(char const * path, Expr env)
+{
+    lisp_load_file(&global, path, env);
+}
+
+U64 read_file(char const * path)
+{
+    return lisp_read_file(&global, path);
+}
+
+Expr read_all(char const * path)
+{
+    return lisp_read_all(&global, path);
+}
+
+#endif
@@ -30,3 +30,38 @@
 
 (test (car (cons 'a 'b)) a)
 (test (cdr (cons 'a 'b)) b)
+
+(test (+ 1 2) 3)
+(test (- 10 4 3) 3)
+(test (* 6 7) 42)
+(test (/ 7 2) 3)
+(test (mod 7 -2) -1)
+(test (< 1 2) t)
+(test (= 1 2) nil)
+(test (equal '(1 2) (list 1 2)) t)
+
+(defun count-down (n)
+  (if (= n 0) 'done (count-down (- n 1))))
+
+(defun make-list (n acc)
+  (if (= n 0) acc (make-list (- n 1) (cons n acc))))
+
+(defun last (a)
+  (if (cdr a) (last (cdr a)) (car a)))
+
+(test (count-down 1000000) done)
+(test (last (append (make-list 200000 nil) '(end))) end)
+(test (reverse '(1 2 3)) (3 2 1))
+(test (when t 'a) a)
+(test (read-binary (write-binary '(a (b . -5) a . c))) (a (b . -5) a . c))
+
+;; a macro defined after the function that uses it gets its argument as written
+(defun late-macro-user (x) (late-quote x))
+(defmacro late-quote (y) (list 'quote y))
+(test (eq (late-macro-user 'a) 'x) t)
+
+;; a form spliced into two lambdas is resolved for each of them
+(defmacro splice-twice (e)
+  `(cons (((lambda (a) (lambda (z) ,e)) 'outer) 'zz)
+         ((lambda (a) ((lambda (a) ,e) 'inner)) 'outer2)))
+(test (splice-twice (cons a a)) ((outer . outer) inner . inner))
@@ -1,90 +1,116 @@
 
 #include "common.h"
 
-#define TEMP_BUF_SIZE  4096
-#define TEMP_BUF_COUNT 4
+void util_init(UtilState * util)
+{
+    memset(util, 0, sizeof(UtilState));
+}
 
-bool is_named_call(Expr exp, Expr name)
+void util_quit(UtilState * util)
 {
-    return is_cons(exp) && eq(car(exp), name);
+    for (U64 i = 0; i < LISP_TEMP_BUF_COUNT; i++)
+    {
+        LISP_FREE(util->temp_buf[i]);
+    }
+    memset(util, 0, sizeof(UtilState));
 }
 
-char * get_temp_buf(size_t size)
+bool lisp_is_named_call(ConsState * cons, Expr exp, Expr name)
 {
-    LISP_ASSERT(size <= TEMP_BUF_SIZE);
+    return is_cons(exp) && eq(lisp_car(cons, exp), name);
+}
 
-    static char buf[TEMP_BUF_COUNT][TEMP_BUF_SIZE];
-    static int idx = 0;
-    char * ret = buf[idx];
-    idx = (idx + 1) % TEMP_BUF_COUNT;
-    return ret;
+char * lisp_get_temp_buf(UtilState * util, size_t size)
+{
+    U64 const idx = util->temp_index;
+    if (util->temp_size[idx] < size)
+    {
+        util->temp_buf[idx] = (char *) LISP_REALLOC(util->temp_buf[idx], size);
+        if (!util->temp_buf[idx])
+        {
+            LISP_FAIL("temp buffer allocation failed\n");
+        }
+        util->temp_size[idx] = size;
+    }
+    util->temp_index = (idx + 1) % LISP_TEMP_BUF_COUNT;
+    return util->temp_buf[idx];
 }
 
-bool equal(Expr a, Expr b)
+U32 hash_bytes(char const * str, size_t len)
+{
+    /* FNV-1a */
+    U32 hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (U8) str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool lisp_equal(ConsState * cons, Expr a, Expr b)
 {
     if (is_cons(a) && is_cons(b))
     {
-        return equal(car(a), car(b)) && equal(cdr(a), cdr(b));
+        return lisp_equal(cons, lisp_car(cons, a), lisp_car(cons, b)) &&
+               lisp_equal(cons, lisp_cdr(cons, a), lisp_cdr(cons, b));
     }
     return eq(a, b);
 }
 
-char const * repr(Expr exp)
+char const * lisp_repr(SystemState * sys, Expr exp)
 {
-    // TODO multiple calls => need temp buffer per call
-    size_t const size = 4096;
-    char * buffer = get_temp_buf(size);
-    Expr out = lisp_make_buffer_output_stream(&global.stream, size, buffer);
-    render_expr(exp, out);
-    stream_release(out);
+    /* valid until LISP_TEMP_BUF_COUNT more calls */
+    Expr out = lisp_make_string_output_stream(&sys->stream);
+    lisp_render_expr(sys, exp, out);
+    size_t len = 0;
+    char const * str = lisp_stream_output(&sys->stream, out, &len);
+    char * buffer = lisp_get_temp_buf(&sys->util, len + 1);
+    memcpy(buffer, str, len + 1);
+    lisp_stream_release(&sys->stream, out);
     return buffer;
 }
 
-void println(Expr exp)
+void lisp_println(SystemState * sys, Expr exp)
 {
-    Expr out = global.stream.stdout;
-    render_expr(exp, out);
-    stream_put_string(out, "\n");
+    Expr out = sys->stream.stdout;
+    lisp_render_expr(sys, exp, out);
+    lisp_stream_put_char(&sys->stream, out, '\n');
 }
 
-Expr intern(char const * name)
+Expr lisp_intern(SymbolState * symbol, char const * name)
+{
+    return lisp_intern_n(symbol, name, strlen(name));
+}
+
+Expr lisp_intern_n(SymbolState * symbol, char const * name, size_t len)
 {
-    if (!strcmp("nil", name))
+    if (len == 3 && !memcmp("nil", name, 3))
     {
         return nil;
     }
     else
     {
-        return make_symbol(name);
+        return lisp_make_symbol_n(symbol, name, len);
     }
 }
 
-Expr list_1(Expr exp1)
+Expr lisp_list_1(ConsState * cons, Expr exp1)
 {
-    return cons(exp1, nil);
+    return lisp_cons(cons, exp1, nil);
 }
 
-Expr list_2(Expr exp1, Expr exp2)
+Expr lisp_list_2(ConsState * cons, Expr exp1, Expr exp2)
 {
-    return cons(exp1, cons(exp2, nil));
+    return lisp_cons(cons, exp1, lisp_cons(cons, exp2, nil));
 }
 
-Expr list_3(Expr exp1, Expr exp2, Expr exp3)
+Expr lisp_list_3(ConsState * cons, Expr exp1, Expr exp2, Expr exp3)
 {
-    return cons(exp1, cons(exp2, cons(exp3, nil)));
+    return lisp_cons(cons, exp1, lisp_cons(cons, exp2, lisp_cons(cons, exp3, nil)));
 }
 
-Expr first(Expr seq)
-{
-    return car(seq);
-}
-
-Expr second(Expr seq)
-{
-    return car(cdr(seq));
-}
-
-Expr nreverse(Expr list)
+Expr lisp_nreverse(ConsState * cons, Expr list)
 {
     if (!list)
     {
@@ -95,28 +121,116 @@ Expr nreverse(Expr list)
     Expr expr = list;
     while (is_cons(expr))
     {
-        Expr next = cdr(expr);
-        rplacd(expr, prev);
+        Expr next = lisp_cdr(cons, expr);
+        lisp_rplacd(cons, expr, prev);
         prev = expr;
         expr = next;
     }
     if (expr)
     {
         Expr iter;
-        for (iter = prev; cdr(iter); iter = cdr(iter))
+        for (iter = prev; lisp_cdr(cons, iter); iter = lisp_cdr(cons, iter))
         {
-            Expr next = car(iter);
-            rplaca(iter, expr);
+            Expr next = lisp_car(cons, iter);
+            lisp_rplaca(cons, iter, expr);
             expr = next;
         }
-        Expr next = car(iter);
-        rplaca(iter, expr);
-        rplacd(iter, next);
+        Expr next = lisp_car(cons, iter);
+        lisp_rplaca(cons, iter, expr);
+        lisp_rplacd(cons, iter, next);
     }
     return prev;
 }
 
+Expr lisp_append(ConsState * cons, Expr a, Expr b)
+{
+    if (!a)
+    {
+        return b;
+    }
+
+    Expr const head = lisp_cons(cons, lisp_car(cons, a), nil);
+    Expr tail = head;
+    for (Expr tmp = lisp_cdr(cons, a); tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        Expr const next = lisp_cons(cons, lisp_car(cons, tmp), nil);
+        lisp_rplacd(cons, tail, next);
+        tail = next;
+    }
+    lisp_rplacd(cons, tail, b);
+    return head;
+}
+
+#if LISP_GLOBAL_API
+
+char * get_temp_buf(size_t size)
+{
+    return lisp_get_temp_buf(&global.util, size);
+}
+
+bool is_named_call(Expr exp, Expr name)
+{
+    return lisp_is_named_call(&global.cons, exp, name);
+}
+
+bool equal(Expr a, Expr b)
+{
+    return lisp_equal(&global.cons, a, b);
+}
+
+char const * repr(Expr exp)
+{
+    return lisp_repr(&global, exp);
+}
+
+void println(Expr exp)
+{
+    lisp_println(&global, exp);
+}
+
+Expr intern(char const * name)
+{
+    return lisp_intern(&global.symbol, name);
+}
+
+Expr intern_n(char const * name, size_t len)
+{
+    return lisp_intern_n(&global.symbol, name, len);
+}
+
+Expr list_1(Expr exp1)
+{
+    return lisp_list_1(&global.cons, exp1);
+}
+
+Expr list_2(Expr exp1, Expr exp2)
+{
+    return lisp_list_2(&global.cons, exp1, exp2);
+}
+
+Expr list_3(Expr exp1, Expr exp2, Expr exp3)
+{
+    return lisp_list_3(&global.cons, exp1, exp2, exp3);
+}
+
+Expr first(Expr seq)
+{
+    return car(seq);
+}
+
+Expr second(Expr seq)
+{
+    return car(cdr(seq));
+}
+
+Expr nreverse(Expr list)
+{
+    return lisp_nreverse(&global.cons, list);
+}
+
 Expr append(Expr a, Expr b)
 {
-    return a ? cons(car(a), append(cdr(a), b)) : b;
+    return lisp_append(&global.cons, a, b);
 }
+
+#endif
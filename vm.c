@@ -0,0 +1,826 @@
+
+#include "common.h"
+
+#define LISP_VM_DEF_SLOTS 256
+
+enum
+{
+    OP_CONST,           /* k            push consts[k] */
+    OP_LOCAL,           /* k            push the local variable consts[k] */
+    OP_GLOBAL,          /* k            push the variable named consts[k] */
+    OP_EVAL,            /* k            push eval(consts[k]) */
+    OP_POP,             /*              drop the top of the stack */
+    OP_JUMP,            /* pc           continue at pc */
+    OP_JUMP_IF_NIL,     /* pc           pop, continue at pc if nil */
+    OP_FORM,            /* k pc         unless the top is a function, replace it with
+                                        eval(consts[k] applied to it) and continue at pc */
+    OP_GUARD,           /* k m f pc     unless consts[k] is still bound to the operator
+                                        consts[m], push eval(consts[f]) and continue at pc */
+    OP_CALL,            /* n            call the function below n arguments */
+    OP_TAIL_CALL,       /* n            same, replacing the current frame */
+    OP_RETURN,          /*              pop the frame, keep the top of the stack */
+    NUM_OPS,
+};
+
+/* code table */
+
+static U64 _vm_hash(Expr body)
+{
+    return expr_data(body) * UINT64_C(0x9e3779b97f4a7c15);
+}
+
+static VmEntry * _vm_find(VmState * vm, Expr body)
+{
+    U64 const mask = vm->num_slots - 1;
+    for (U64 slot = _vm_hash(body) & mask;; slot = (slot + 1) & mask)
+    {
+        VmEntry * entry = vm->slots + slot;
+        if (entry->body == body || entry->body == nil)
+        {
+            return entry;
+        }
+    }
+}
+
+static void _vm_rehash(VmState * vm, U64 num_slots)
+{
+    VmEntry * old_slots = vm->slots;
+    U64 const old_num_slots = vm->num_slots;
+
+    vm->slots = (VmEntry *) LISP_MALLOC(sizeof(VmEntry) * num_slots);
+    if (!vm->slots)
+    {
+        LISP_FAIL("vm code table allocation failed\n");
+    }
+    memset(vm->slots, 0, sizeof(VmEntry) * num_slots);
+    vm->num_slots = num_slots;
+
+    for (U64 i = 0; i < old_num_slots; i++)
+    {
+        if (old_slots[i].body)
+        {
+            *_vm_find(vm, old_slots[i].body) = old_slots[i];
+        }
+    }
+    LISP_FREE(old_slots);
+}
+
+static void _vm_free_code(VmCode * code)
+{
+    LISP_FREE(code->ops);
+    LISP_FREE(code->consts);
+    LISP_FREE(code);
+}
+
+void vm_init(VmState * vm)
+{
+    memset(vm, 0, sizeof(VmState));
+    _vm_rehash(vm, LISP_VM_DEF_SLOTS);
+}
+
+void vm_quit(VmState * vm)
+{
+    for (U64 i = 0; i < vm->num_slots; i++)
+    {
+        if (vm->slots[i].body)
+        {
+            _vm_free_code(vm->slots[i].code);
+        }
+    }
+    LISP_FREE(vm->slots);
+    LISP_FREE(vm->stack);
+    LISP_FREE(vm->frames);
+    memset(vm, 0, sizeof(VmState));
+}
+
+void lisp_vm_sweep(VmState * vm, U64 const * marks)
+{
+    U64 num = 0;
+    for (U64 i = 0; i < vm->num_slots; i++)
+    {
+        VmEntry * entry = vm->slots + i;
+        if (entry->body)
+        {
+            U64 const index = expr_data(entry->body);
+            if ((marks[index / 64] >> (index % 64)) & 1)
+            {
+                ++num;
+            }
+            else
+            {
+                _vm_free_code(entry->code);
+                memset(entry, 0, sizeof(VmEntry));
+            }
+        }
+    }
+
+    /* reinsert the survivors, since removals break the probe sequences */
+    vm->num_entries = num;
+    _vm_rehash(vm, vm->num_slots);
+}
+
+/* compiler */
+
+static void _vm_emit(VmCode * code, U64 op)
+{
+    if (code->num_ops == code->max_ops)
+    {
+        code->max_ops = code->max_ops ? code->max_ops * 2 : 64;
+        code->ops = (U32 *) LISP_REALLOC(code->ops, sizeof(U32) * code->max_ops);
+        if (!code->ops)
+        {
+            LISP_FAIL("vm code allocation failed\n");
+        }
+    }
+    code->ops[code->num_ops++] = (U32) op;
+}
+
+static U64 _vm_const(VmCode * code, Expr exp)
+{
+    for (U64 i = 0; i < code->num_consts; i++)
+    {
+        if (code->consts[i] == exp)
+        {
+            return i;
+        }
+    }
+
+    if (code->num_consts == code->max_consts)
+    {
+        code->max_consts = code->max_consts ? code->max_consts * 2 : 16;
+        code->consts = (Expr *) LISP_REALLOC(code->consts, sizeof(Expr) * code->max_consts);
+        if (!code->consts)
+        {
+            LISP_FAIL("vm code allocation failed\n");
+        }
+    }
+    code->consts[code->num_consts] = exp;
+    return code->num_consts++;
+}
+
+static void _vm_emit_const(VmCode * code, U64 op, Expr exp)
+{
+    _vm_emit(code, op);
+    _vm_emit(code, _vm_const(code, exp));
+}
+
+/* emits a placeholder for a jump target and returns its position */
+static U64 _vm_emit_label(VmCode * code)
+{
+    _vm_emit(code, 0);
+    return code->num_ops - 1;
+}
+
+static void _vm_patch_label(VmCode * code, U64 label)
+{
+    code->ops[label] = (U32) code->num_ops;
+}
+
+static bool _vm_is_param(ConsState * cons, Expr params, Expr name)
+{
+    while (is_cons(params))
+    {
+        if (_vm_is_param(cons, lisp_car(cons, params), name))
+        {
+            return true;
+        }
+        params = lisp_cdr(cons, params);
+    }
+    return params == name;
+}
+
+static I64 _vm_count_flat_params(ConsState * cons, Expr params)
+{
+    I64 ret = 0;
+    for (Expr tmp = params; tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        if (!is_cons(tmp) || !is_symbol(lisp_car(cons, tmp)) || _vm_is_param(cons, lisp_cdr(cons, tmp), lisp_car(cons, tmp)))
+        {
+            return -1;
+        }
+        ++ret;
+    }
+    return ret;
+}
+
+static U64 _vm_list_length(ConsState * cons, Expr exp)
+{
+    U64 ret = 0;
+    for (; is_cons(exp); exp = lisp_cdr(cons, exp))
+    {
+        ++ret;
+    }
+    return exp ? (U64) -1 : ret;
+}
+
+typedef struct
+{
+    SystemState * sys;
+    VmCode * code;
+    Expr env;           /* the closure env, to look up operators */
+    Expr params;
+} VmCompiler;
+
+static void _vm_compile_expr(VmCompiler * c, Expr exp, bool tail);
+
+static void _vm_emit_eval(VmCompiler * c, Expr exp, bool tail)
+{
+    _vm_emit_const(c->code, OP_EVAL, exp);
+    if (tail)
+    {
+        _vm_emit(c->code, OP_RETURN);
+    }
+}
+
+/* the operator's value when the closure is compiled, if it is a global */
+static bool _vm_lookup_operator(VmCompiler * c, Expr op, Expr * val)
+{
+    ConsState * cons = &c->sys->cons;
+    if (!is_symbol(op) || _vm_is_param(cons, c->params, op) || !lisp_env_can_set(c->sys, c->env, op))
+    {
+        return false;
+    }
+    *val = lisp_env_get(c->sys, c->env, op);
+    return true;
+}
+
+static void _vm_compile_if(VmCompiler * c, Expr exp, bool tail)
+{
+    ConsState * cons = &c->sys->cons;
+    Expr const args = lisp_cdr(cons, exp);
+    _vm_compile_expr(c, lisp_car(cons, args), false);
+    _vm_emit(c->code, OP_JUMP_IF_NIL);
+    U64 const label_else = _vm_emit_label(c->code);
+
+    _vm_compile_expr(c, lisp_cadr(cons, args), tail);
+    U64 label_done = 0;
+    if (!tail)
+    {
+        _vm_emit(c->code, OP_JUMP);
+        label_done = _vm_emit_label(c->code);
+    }
+
+    _vm_patch_label(c->code, label_else);
+    _vm_compile_expr(c, lisp_cddr(cons, args) ? lisp_caddr(cons, args) : nil, tail);
+    if (!tail)
+    {
+        _vm_patch_label(c->code, label_done);
+    }
+}
+
+/* operators known when compiling are guarded against being redefined,
+   the form is handed to eval once they are. returns the label to patch
+   after the inline code. */
+static U64 _vm_emit_guard(VmCompiler * c, Expr exp, Expr op)
+{
+    _vm_emit(c->code, OP_GUARD);
+    _vm_emit(c->code, _vm_const(c->code, lisp_car(&c->sys->cons, exp)));
+    _vm_emit(c->code, _vm_const(c->code, op));
+    _vm_emit(c->code, _vm_const(c->code, exp));
+    return _vm_emit_label(c->code);
+}
+
+static void _vm_patch_guard(VmCompiler * c, U64 label, bool tail)
+{
+    _vm_patch_label(c->code, label);
+    if (tail)
+    {
+        _vm_emit(c->code, OP_RETURN);
+    }
+}
+
+/* the expansion is compiled in place, as the expansion cache does for eval */
+static void _vm_compile_macro(VmCompiler * c, Expr exp, Expr macro, bool tail)
+{
+    U64 const label = _vm_emit_guard(c, exp, macro);
+    _vm_compile_expr(c, lisp_macro_expand(c->sys, macro, exp), tail);
+    _vm_patch_guard(c, label, tail);
+}
+
+static void _vm_compile_call(VmCompiler * c, Expr exp, bool tail)
+{
+    ConsState * cons = &c->sys->cons;
+    _vm_compile_expr(c, lisp_car(cons, exp), false);
+
+    /* the operator may turn out to be special, leave that to eval */
+    _vm_emit_const(c->code, OP_FORM, exp);
+    U64 const label_form = _vm_emit_label(c->code);
+
+    U64 num = 0;
+    for (Expr tmp = lisp_cdr(cons, exp); tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        _vm_compile_expr(c, lisp_car(cons, tmp), false);
+        ++num;
+    }
+    _vm_emit(c->code, tail ? OP_TAIL_CALL : OP_CALL);
+    _vm_emit(c->code, num);
+
+    _vm_patch_label(c->code, label_form);
+    if (tail)
+    {
+        _vm_emit(c->code, OP_RETURN);
+    }
+}
+
+static void _vm_compile_expr(VmCompiler * c, Expr exp, bool tail)
+{
+    ConsState * cons = &c->sys->cons;
+    switch (expr_type(exp))
+    {
+    case TYPE_NIL:
+    case TYPE_STRING:
+    case TYPE_FIXNUM:
+        _vm_emit_const(c->code, OP_CONST, exp);
+        break;
+    case TYPE_LOCAL:
+        _vm_emit_const(c->code, OP_LOCAL, exp);
+        break;
+    case TYPE_SYMBOL:
+        if (exp == LISP_SYM_ENV)
+        {
+            _vm_emit_eval(c, exp, tail);
+            return;
+        }
+        _vm_emit_const(c->code, OP_GLOBAL, exp);
+        break;
+    case TYPE_CONS:
+    {
+        Expr val = nil;
+        U64 const len = _vm_list_length(&c->sys->cons, exp);
+        if (len == (U64) -1)
+        {
+            _vm_emit_eval(c, exp, tail);
+            return;
+        }
+        if (_vm_lookup_operator(c, lisp_car(cons, exp), &val))
+        {
+            if (is_special(val))
+            {
+                SpecialFun const fun = lisp_special_fun(&c->sys->special, val);
+                if (fun == s_quote && len == 2)
+                {
+                    U64 const label = _vm_emit_guard(c, exp, val);
+                    _vm_emit_const(c->code, OP_CONST, lisp_cadr(cons, exp));
+                    if (tail)
+                    {
+                        _vm_emit(c->code, OP_RETURN);
+                    }
+                    _vm_patch_guard(c, label, tail);
+                    return;
+                }
+                if (fun == s_if && (len == 3 || len == 4))
+                {
+                    U64 const label = _vm_emit_guard(c, exp, val);
+                    _vm_compile_if(c, exp, tail);
+                    _vm_patch_guard(c, label, tail);
+                    return;
+                }
+                _vm_emit_eval(c, exp, tail);
+                return;
+            }
+            if (lisp_is_macro(&c->sys->closure, val))
+            {
+                _vm_compile_macro(c, exp, val, tail);
+                return;
+            }
+        }
+        _vm_compile_call(c, exp, tail);
+        return;
+    }
+    default:
+        _vm_emit_eval(c, exp, tail);
+        return;
+    }
+
+    if (tail)
+    {
+        _vm_emit(c->code, OP_RETURN);
+    }
+}
+
+static VmCode * _vm_compile(SystemState * sys, Expr fun)
+{
+    ConsState * cons = &sys->cons;
+    Closure const * info = lisp_closure(&sys->closure, fun);
+    VmCode * code = (VmCode *) LISP_MALLOC(sizeof(VmCode));
+    if (!code)
+    {
+        LISP_FAIL("vm code allocation failed\n");
+    }
+    memset(code, 0, sizeof(VmCode));
+
+    VmCompiler compiler;
+    compiler.sys = sys;
+    compiler.code = code;
+    compiler.env = info->env;
+    compiler.params = info->params;
+    code->num_params = _vm_count_flat_params(cons, compiler.params);
+
+    Expr body = info->body;
+    if (!body)
+    {
+        _vm_compile_expr(&compiler, nil, true);
+        return code;
+    }
+    for (; lisp_cdr(cons, body); body = lisp_cdr(cons, body))
+    {
+        _vm_compile_expr(&compiler, lisp_car(cons, body), false);
+        _vm_emit(code, OP_POP);
+    }
+    _vm_compile_expr(&compiler, lisp_car(cons, body), true);
+    return code;
+}
+
+static VmCode * _vm_table_code(SystemState * sys, Expr fun, bool compile)
+{
+    VmState * vm = &sys->vm;
+    Expr const body = lisp_closure(&sys->closure, fun)->body;
+    if (!body || (!compile && !vm->num_entries))
+    {
+        return NULL;
+    }
+
+    VmEntry * entry = _vm_find(vm, body);
+    if (entry->body == body)
+    {
+        return entry->code;
+    }
+    if (!compile)
+    {
+        return NULL;
+    }
+
+    /* expanding macros runs code, which may compile this very body */
+    VmCode * code = _vm_compile(sys, fun);
+    entry = _vm_find(vm, body);
+    if (entry->body == body)
+    {
+        _vm_free_code(code);
+        return entry->code;
+    }
+
+    if ((vm->num_entries + 1) * 2 > vm->num_slots)
+    {
+        _vm_rehash(vm, vm->num_slots * 2);
+        entry = _vm_find(vm, body);
+    }
+    entry->body = body;
+    entry->code = code;
+    ++vm->num_entries;
+    return code;
+}
+
+/* the closure caches the code of its body, which stays in the table for
+   as long as the closure keeps the body alive */
+static VmCode const * _vm_code(SystemState * sys, Expr fun, bool compile)
+{
+    Closure const * info = lisp_closure(&sys->closure, fun);
+    if (info->code)
+    {
+        return info->code;
+    }
+
+    VmCode const * code = _vm_table_code(sys, fun, compile);
+    /* compiling may have moved the pool */
+    lisp_closure(&sys->closure, fun)->code = code;
+    return code;
+}
+
+/* machine */
+
+static void _vm_push(VmState * vm, Expr exp)
+{
+    if (vm->num_stack == vm->max_stack)
+    {
+        vm->max_stack = vm->max_stack ? vm->max_stack * 2 : 1024;
+        vm->stack = (Expr *) LISP_REALLOC(vm->stack, sizeof(Expr) * vm->max_stack);
+        if (!vm->stack)
+        {
+            LISP_FAIL("vm stack allocation failed\n");
+        }
+    }
+    vm->stack[vm->num_stack++] = exp;
+}
+
+static void _vm_push_frame(VmState * vm, VmCode const * code, Expr body, Expr env)
+{
+    if (vm->num_frames == vm->max_frames)
+    {
+        vm->max_frames = vm->max_frames ? vm->max_frames * 2 : 256;
+        vm->frames = (VmFrame *) LISP_REALLOC(vm->frames, sizeof(VmFrame) * vm->max_frames);
+        if (!vm->frames)
+        {
+            LISP_FAIL("vm frame allocation failed\n");
+        }
+    }
+    VmFrame * frame = vm->frames + vm->num_frames++;
+    frame->code = code;
+    frame->body = body;
+    frame->env = env;
+    frame->pc = 0;
+}
+
+static Expr _vm_list(SystemState * sys, U64 first, U64 num)
+{
+    ConsState * cons = &sys->cons;
+    VmState * vm = &sys->vm;
+    Expr ret = nil;
+    for (U64 i = first + num; i-- > first;)
+    {
+        ret = lisp_cons(cons, vm->stack[i], ret);
+    }
+    return ret;
+}
+
+/* binds the num arguments on the stack from first on in a new frame */
+static Expr _vm_bind(SystemState * sys, Expr fun, VmCode const * code, U64 first, U64 num)
+{
+    ConsState * cons = &sys->cons;
+    VmState * vm = &sys->vm;
+    Closure const * info = lisp_closure(&sys->closure, fun);
+    Expr const params = info->params;
+    if (code->num_params == (I64) num)
+    {
+        Expr const env = lisp_make_env(&sys->env, cons, info->env, num);
+        Expr tmp = params;
+        for (U64 i = 0; i < num; i++, tmp = lisp_cdr(cons, tmp))
+        {
+            lisp_env_def(sys, env, lisp_car(cons, tmp), vm->stack[first + i]);
+        }
+        return env;
+    }
+
+    /* destructuring, or the wrong number of arguments */
+    Expr const env = lisp_make_env(&sys->env, cons, info->env, lisp_env_count_vars(sys, params));
+    lisp_env_destructuring_bind(sys, env, params, _vm_list(sys, first, num));
+    return env;
+}
+
+/* runs until the frame at index entry returns */
+static Expr _vm_run(SystemState * sys, U64 entry)
+{
+    VmState * vm = &sys->vm;
+#if LISP_VM_COMPUTED_GOTO
+    static void * const labels[NUM_OPS] =
+    {
+        [OP_CONST] = &&label_OP_CONST,
+        [OP_LOCAL] = &&label_OP_LOCAL,
+        [OP_GLOBAL] = &&label_OP_GLOBAL,
+        [OP_EVAL] = &&label_OP_EVAL,
+        [OP_POP] = &&label_OP_POP,
+        [OP_JUMP] = &&label_OP_JUMP,
+        [OP_JUMP_IF_NIL] = &&label_OP_JUMP_IF_NIL,
+        [OP_FORM] = &&label_OP_FORM,
+        [OP_GUARD] = &&label_OP_GUARD,
+        [OP_CALL] = &&label_OP_CALL,
+        [OP_TAIL_CALL] = &&label_OP_TAIL_CALL,
+        [OP_RETURN] = &&label_OP_RETURN,
+    };
+#define VM_DISPATCH() goto *labels[ops[pc++]];
+#define VM_CASE(op) label_##op
+#else
+#define VM_DISPATCH() switch (ops[pc++])
+#define VM_CASE(op) case op
+#endif
+
+    /* the current frame, cached in locals. calls out of the machine can
+       move the frames, so they are saved before and loaded after. */
+    U32 const * ops;
+    Expr const * consts;
+    Expr env;
+    U64 pc;
+
+#define VM_SAVE() (vm->frames[vm->num_frames - 1].pc = pc)
+#define VM_LOAD() \
+    do \
+    { \
+        VmFrame const * frame = vm->frames + vm->num_frames - 1; \
+        ops = frame->code->ops; \
+        consts = frame->code->consts; \
+        env = frame->env; \
+        pc = frame->pc; \
+    } while (0)
+
+    VM_LOAD();
+
+    Expr ret = nil;
+    U64 num = 0;
+    bool tail = false;
+
+    for (;;)
+    {
+        VM_DISPATCH()
+        {
+        VM_CASE(OP_CONST):
+            _vm_push(vm, consts[ops[pc++]]);
+            continue;
+        VM_CASE(OP_LOCAL):
+            _vm_push(vm, lisp_env_get_local(sys, env, consts[ops[pc++]]));
+            continue;
+        VM_CASE(OP_GLOBAL):
+            _vm_push(vm, lisp_env_get(sys, env, consts[ops[pc++]]));
+            continue;
+        VM_CASE(OP_EVAL):
+        {
+            Expr const exp = consts[ops[pc++]];
+            VM_SAVE();
+            ret = lisp_eval(sys, exp, env);
+            VM_LOAD();
+            _vm_push(vm, ret);
+            continue;
+        }
+        VM_CASE(OP_POP):
+            --vm->num_stack;
+            continue;
+        VM_CASE(OP_JUMP):
+            pc = ops[pc];
+            continue;
+        VM_CASE(OP_JUMP_IF_NIL):
+        {
+            U64 const target = ops[pc++];
+            if (vm->stack[--vm->num_stack] == nil)
+            {
+                pc = target;
+            }
+            continue;
+        }
+        VM_CASE(OP_FORM):
+        {
+            Expr const exp = consts[ops[pc++]];
+            U64 const target = ops[pc++];
+            Expr const op = vm->stack[vm->num_stack - 1];
+            if (!is_builtin(op) && !lisp_is_function(&sys->closure, op))
+            {
+                --vm->num_stack;
+                /* a symbol is looked up again, anything else is not
+                   evaluated twice, so eval goes on from its value */
+                Expr const form = is_symbol(lisp_car(&sys->cons, exp)) ? exp :
+                    lisp_cons(&sys->cons, op, lisp_cdr(&sys->cons, exp));
+                VM_SAVE();
+                ret = lisp_eval(sys, form, env);
+                VM_LOAD();
+                _vm_push(vm, ret);
+                pc = target;
+            }
+            continue;
+        }
+        VM_CASE(OP_GUARD):
+        {
+            Expr const name = consts[ops[pc++]];
+            Expr const op = consts[ops[pc++]];
+            Expr const exp = consts[ops[pc++]];
+            U64 const target = ops[pc++];
+            if (lisp_env_get(sys, env, name) != op)
+            {
+                VM_SAVE();
+                ret = lisp_eval(sys, exp, env);
+                VM_LOAD();
+                _vm_push(vm, ret);
+                pc = target;
+            }
+            continue;
+        }
+        VM_CASE(OP_CALL):
+            tail = false;
+            goto call;
+        VM_CASE(OP_TAIL_CALL):
+            tail = true;
+            goto call;
+        VM_CASE(OP_RETURN):
+            ret = vm->stack[--vm->num_stack];
+            goto done;
+        }
+
+    call:
+        num = ops[pc++];
+        {
+            U64 const base = vm->num_stack - num - 1;
+            Expr const fun = vm->stack[base];
+            if (is_builtin(fun))
+            {
+                /* the argument list stays on the stack while the builtin runs */
+                // TODO parse keyword args
+                BuiltinFun const bfun = lisp_builtin_fun(&sys->builtin, fun);
+                Expr const args = _vm_list(sys, base + 1, num);
+                vm->stack[base] = args;
+                vm->num_stack = base + 1;
+                VM_SAVE();
+                lisp_profile_enter(&sys->profile, fun);
+                ret = bfun(sys, args, nil, env);
+                lisp_profile_leave(&sys->profile);
+                VM_LOAD();
+                vm->num_stack = base;
+                if (tail)
+                {
+                    goto done;
+                }
+                _vm_push(vm, ret);
+                continue;
+            }
+
+            if (!lisp_is_function(&sys->closure, fun))
+            {
+                LISP_FAIL("cannot apply %s\n", lisp_repr(sys, fun));
+            }
+
+            /* everything live is on the machine stack or in its frames */
+            VM_SAVE();
+            lisp_gc_maybe_collect(sys, &sys->cons);
+
+            VmCode const * code = _vm_code(sys, fun, true);
+            Expr const body = lisp_closure(&sys->closure, fun)->body;
+            Expr const fenv = _vm_bind(sys, fun, code, base + 1, num);
+            vm->num_stack = base;
+            if (tail)
+            {
+                VmFrame * frame = vm->frames + vm->num_frames - 1;
+                frame->code = code;
+                frame->body = body;
+                frame->env = fenv;
+                frame->pc = 0;
+                lisp_profile_replace(&sys->profile, fun);
+            }
+            else
+            {
+                _vm_push_frame(vm, code, body, fenv);
+                lisp_profile_enter(&sys->profile, fun);
+            }
+            VM_LOAD();
+            continue;
+        }
+
+    done:
+        --vm->num_frames;
+        if (vm->num_frames == entry)
+        {
+            /* the caller keeps the profile entry of the first frame */
+            return ret;
+        }
+        lisp_profile_leave(&sys->profile);
+        VM_LOAD();
+        _vm_push(vm, ret);
+    }
+
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_SAVE
+#undef VM_LOAD
+}
+
+bool lisp_vm_runs(SystemState * sys, Expr fun)
+{
+    return sys->vm.enabled || _vm_code(sys, fun, false);
+}
+
+void lisp_vm_compile(SystemState * sys, Expr fun)
+{
+    LISP_ASSERT(lisp_is_function(&sys->closure, fun));
+    _vm_code(sys, fun, true);
+}
+
+Expr lisp_vm_apply(SystemState * sys, Expr fun, Expr args)
+{
+    ConsState * cons = &sys->cons;
+    VmState * vm = &sys->vm;
+    VmCode const * code = _vm_code(sys, fun, true);
+    if (!code)
+    {
+        /* nothing to run for an empty body, but the arguments must fit */
+        Closure const * info = lisp_closure(&sys->closure, fun);
+        Expr const params = info->params;
+        Expr const env = lisp_make_env(&sys->env, cons, info->env, lisp_env_count_vars(sys, params));
+        lisp_env_destructuring_bind(sys, env, params, args);
+        return nil;
+    }
+
+    U64 const first = vm->num_stack;
+    for (Expr tmp = args; tmp; tmp = lisp_cdr(cons, tmp))
+    {
+        _vm_push(vm, lisp_car(cons, tmp));
+    }
+    Expr const env = _vm_bind(sys, fun, code, first, vm->num_stack - first);
+    vm->num_stack = first;
+
+    U64 const entry = vm->num_frames;
+    _vm_push_frame(vm, code, lisp_closure(&sys->closure, fun)->body, env);
+    return _vm_run(sys, entry);
+}
+
+#if LISP_GLOBAL_API
+
+bool vm_runs(Expr fun)
+{
+    return lisp_vm_runs(&global, fun);
+}
+
+void vm_compile(Expr fun)
+{
+    lisp_vm_compile(&global, fun);
+}
+
+Expr vm_apply(Expr fun, Expr args)
+{
+    return lisp_vm_apply(&global, fun, args);
+}
+
+#endif